@@ -17,7 +17,46 @@
 
 #if defined(THREADED_RTS) /* to near the end */
 
-#if defined(HAVE_PTHREAD_H) && !defined(mingw32_HOST_OS)
+#if defined(gestalt_HOST_OS)
+
+#if CMINUSMINUS
+
+#define ACQUIRE_LOCK(mutex) foreign "C" gestaltAcquireLock(mutex)
+#define RELEASE_LOCK(mutex) foreign "C" gestaltReleaseLock(mutex)
+#define ASSERT_LOCK_HELD(mutex) /* nothing */
+
+#else
+
+// Gestalt kernel threads.  A Mutex or Condition is a single word that
+// threads block on through the kernel's futex wait queues, see
+// rts/gestalt/OSThreads.c.  An OSThreadId is the address of the kernel
+// thread, which like a pthread_t is unique while the thread lives.
+typedef struct { volatile StgWord32 state; } Mutex;
+typedef struct { volatile StgWord32 seq; } Condition;
+typedef StgWord   OSThreadId;
+typedef StgWord32 ThreadLocalKey;
+
+#define OSThreadProcAttr /* nothing */
+
+#define INIT_COND_VAR       {0}
+
+void gestaltAcquireLock    (Mutex *mutex);
+int  gestaltTryAcquireLock (Mutex *mutex);
+void gestaltReleaseLock    (Mutex *mutex);
+
+#define ACQUIRE_LOCK(mutex) gestaltAcquireLock(mutex)
+
+// Returns zero if the lock was acquired.
+#define TRY_ACQUIRE_LOCK(mutex) gestaltTryAcquireLock(mutex)
+
+#define RELEASE_LOCK(mutex) gestaltReleaseLock(mutex)
+
+// The mutex does not record its owner, so only check that it is held.
+#define ASSERT_LOCK_HELD(mutex) ASSERT((mutex)->state != 0)
+
+#endif // CMINUSMINUS
+
+#elif defined(HAVE_PTHREAD_H) && !defined(mingw32_HOST_OS)
 
 #if CMINUSMINUS
 
@@ -0,0 +1,106 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The University of Glasgow 2006-2007
+ *
+ * OS-specific memory management, Gestalt kernel version
+ *
+ * ---------------------------------------------------------------------------*/
+
+#include "Rts.h"
+
+#include "RtsUtils.h"
+#include "sm/OSMem.h"
+#include "sm/HeapAlloc.h"
+
+/* Kernel interfaces, from the Gestalt include directory. */
+#include <frame.h>
+#include <paging.h>
+
+/* -----------------------------------------------------------------------------
+   The palloc() method
+
+   The RTS is linked into the Gestalt kernel, so megablocks come straight
+   from the kernel page allocator instead of from mmap().  We reserve
+   address space with palloc_lazy(), which does not take any frames:
+   the kernel page fault handler backs each page with a zeroed frame
+   the first time it is touched, so a megablock costs only what the
+   heap actually uses.
+
+   palloc_lazy() only guarantees page alignment.  As in the posix
+   version we ask for one megablock more than we need and hand the
+   slop on either side back with pfree(), which for a reservation
+   returns the address space and any frames behind it.
+
+   Gestalt is a 32-bit kernel, so USE_LARGE_ADDRESS_SPACE is never
+   defined and the reserve/commit interface is not provided.  Keeping
+   the HEAP_ALLOCED map up to date is left to sm/MBlock.c, which marks
+   every megablock we return and unmarks the ones given back.
+   -------------------------------------------------------------------------- */
+
+#define MBLOCK_PAGES (MBLOCK_SIZE / FRAME_SIZE)
+
+void osMemInit(void)
+{
+}
+
+void *
+osGetMBlocks(nat n)
+{
+    W_ size = MBLOCK_SIZE * (W_)n;
+    W_ base, start, slop;
+
+    base = palloc_lazy((n + 1) * MBLOCK_PAGES);
+    if (base == 0) {
+        errorBelch("out of memory (requested %" FMT_Word " bytes)", size);
+        stg_exit(EXIT_HEAPOVERFLOW);
+    }
+
+    start = (W_)MBLOCK_ROUND_UP(base);
+    slop = start - base;
+
+    if (slop > 0) {
+        pfree(base, slop / FRAME_SIZE);
+    }
+    pfree(start + size, (MBLOCK_SIZE - slop) / FRAME_SIZE);
+
+    return (void *)start;
+}
+
+void osFreeMBlocks(char *addr, nat n)
+{
+    if (!pfree((W_)addr, n * MBLOCK_PAGES)) {
+        barf("osFreeMBlocks: pfree failed for %p", addr);
+    }
+}
+
+void osReleaseFreeMemory(void) {
+    /* Every megablock given back goes straight to the kernel */
+}
+
+void osFreeAllMBlocks(void)
+{
+    void *mblock;
+    void *state;
+
+    for (mblock = getFirstMBlock(&state);
+         mblock != NULL;
+         mblock = getNextMBlock(&state, mblock)) {
+        pfree((W_)mblock, MBLOCK_PAGES);
+    }
+}
+
+W_ getPageSize (void)
+{
+    return FRAME_SIZE;
+}
+
+StgWord64 getPhysicalMemorySize (void)
+{
+    return (StgWord64)frames_total() * FRAME_SIZE;
+}
+
+void setExecutable (void *p STG_UNUSED, W_ len STG_UNUSED,
+                    rtsBool exec STG_UNUSED)
+{
+    /* Without PAE there is no NX bit: every kernel mapping is executable */
+}
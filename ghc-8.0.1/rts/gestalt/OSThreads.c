@@ -0,0 +1,293 @@
+/* ---------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2001-2005
+ *
+ * Accessing OS threads functionality, Gestalt kernel version
+ *
+ * --------------------------------------------------------------------------*/
+
+#include "Rts.h"
+
+/* Kernel interfaces, from the Gestalt include directory. */
+#include <futex.h>
+#include <smp.h>
+#include GESTALT_SCHED_H
+
+/*
+ * The RTS is linked into the kernel, so an OS thread is a kernel thread
+ * from thread_create() and is scheduled preemptively across all the
+ * processors.  The RTS should be started from such a thread rather than
+ * from the boot context: that is the idle thread, which cannot block, so
+ * futex_wait() returns at once there and every wait turns into a spin.
+ *
+ * Mutexes and condition variables are single words.  A thread that has
+ * to wait for one sleeps in futex_wait() on its address, which compares
+ * the word under the futex bucket lock, so a wakeup that races with
+ * going to sleep is never lost.
+ *
+ * getNumberOfProcessors() counts the processors the kernel started, so
+ * +RTS -N puts one capability on each, and with -qa setThreadAffinity()
+ * pins each capability's workers to its processor.
+ */
+
+#if defined(THREADED_RTS)
+
+/* -----------------------------------------------------------------------------
+   Mutexes
+
+   The three-state futex mutex from Drepper's "Futexes Are Tricky":
+   0 is unlocked, 1 is locked, and 2 is locked with (possibly) waiters,
+   so an uncontended lock and unlock never enter the kernel's wait
+   queues.
+   -------------------------------------------------------------------------- */
+
+#define MUTEX_UNLOCKED  0
+#define MUTEX_LOCKED    1
+#define MUTEX_CONTENDED 2
+
+static void
+lockContended (Mutex *pMut, StgWord32 c)
+{
+    if (c != MUTEX_CONTENDED) {
+        c = __sync_lock_test_and_set(&pMut->state, MUTEX_CONTENDED);
+    }
+    while (c != MUTEX_UNLOCKED) {
+        futex_wait(&pMut->state, MUTEX_CONTENDED);
+        c = __sync_lock_test_and_set(&pMut->state, MUTEX_CONTENDED);
+    }
+}
+
+void
+gestaltAcquireLock (Mutex *pMut)
+{
+    StgWord32 c = __sync_val_compare_and_swap(&pMut->state, MUTEX_UNLOCKED,
+                                              MUTEX_LOCKED);
+    if (c != MUTEX_UNLOCKED) {
+        lockContended(pMut, c);
+    }
+}
+
+int
+gestaltTryAcquireLock (Mutex *pMut)
+{
+    return __sync_val_compare_and_swap(&pMut->state, MUTEX_UNLOCKED,
+                                       MUTEX_LOCKED) != MUTEX_UNLOCKED;
+}
+
+void
+gestaltReleaseLock (Mutex *pMut)
+{
+    if (__sync_fetch_and_sub(&pMut->state, 1) != MUTEX_LOCKED) {
+        pMut->state = MUTEX_UNLOCKED;
+        __sync_synchronize();
+        futex_wake(&pMut->state, 1);
+    }
+}
+
+void
+initMutex (Mutex *pMut)
+{
+    pMut->state = MUTEX_UNLOCKED;
+}
+
+void
+closeMutex (Mutex *pMut STG_UNUSED)
+{
+}
+
+/* -----------------------------------------------------------------------------
+   Condition variables
+
+   A sequence number bumped by every signal.  A waiter sleeps until it
+   moves on from the value seen while the mutex was still held, and
+   takes the mutex back as contended, since other waiters may have been
+   woken along with it.
+   -------------------------------------------------------------------------- */
+
+void
+initCondition (Condition *pCond)
+{
+    pCond->seq = 0;
+}
+
+void
+closeCondition (Condition *pCond STG_UNUSED)
+{
+}
+
+rtsBool
+broadcastCondition (Condition *pCond)
+{
+    __sync_fetch_and_add(&pCond->seq, 1);
+    futex_wake(&pCond->seq, FUTEX_WAKE_ALL);
+    return rtsTrue;
+}
+
+rtsBool
+signalCondition (Condition *pCond)
+{
+    __sync_fetch_and_add(&pCond->seq, 1);
+    futex_wake(&pCond->seq, 1);
+    return rtsTrue;
+}
+
+rtsBool
+waitCondition (Condition *pCond, Mutex *pMut)
+{
+    StgWord32 seq = pCond->seq;
+
+    gestaltReleaseLock(pMut);
+    futex_wait(&pCond->seq, seq);
+    lockContended(pMut, MUTEX_UNLOCKED);
+    return rtsTrue;
+}
+
+/* -----------------------------------------------------------------------------
+   Threads
+   -------------------------------------------------------------------------- */
+
+void
+yieldThread (void)
+{
+    thread_yield();
+}
+
+void
+shutdownThread (void)
+{
+    thread_exit();
+}
+
+int
+createOSThread (OSThreadId* pId, char *name STG_UNUSED,
+                OSThreadProc *startProc, void *param)
+{
+    thread *t = thread_create(startProc, param, THREAD_PRIORITY_NORMAL);
+
+    if (t == NULL) {
+        return -1;
+    }
+    *pId = (OSThreadId)t;
+    return 0;
+}
+
+OSThreadId
+osThreadId (void)
+{
+    return (OSThreadId)thread_current();
+}
+
+rtsBool
+osThreadIsAlive (OSThreadId id STG_UNUSED)
+{
+    // Exited threads are freed, so there is nothing left to ask.
+    // Returning true is safe.
+    return rtsTrue;
+}
+
+void
+interruptOSThread (OSThreadId id STG_UNUSED)
+{
+    // Kernel threads have no signals, and a foreign call made from the
+    // kernel cannot be interrupted part way, so this does nothing.
+}
+
+/* -----------------------------------------------------------------------------
+   Thread-local storage
+
+   Each kernel thread carries THREAD_TLS_SLOTS words for us.  The RTS
+   only creates a couple of keys, so they are handed out once and never
+   reused.
+   -------------------------------------------------------------------------- */
+
+static StgWord32 next_tls_key = 0;
+
+void
+newThreadLocalKey (ThreadLocalKey *key)
+{
+    StgWord32 k = __sync_fetch_and_add(&next_tls_key, 1);
+
+    if (k >= THREAD_TLS_SLOTS) {
+        barf("newThreadLocalKey: out of thread-local slots");
+    }
+    *key = k;
+}
+
+void *
+getThreadLocalVar (ThreadLocalKey *key)
+{
+    return thread_current()->tls[*key];
+}
+
+void
+setThreadLocalVar (ThreadLocalKey *key, void *value)
+{
+    thread_current()->tls[*key] = value;
+}
+
+void
+freeThreadLocalKey (ThreadLocalKey *key STG_UNUSED)
+{
+}
+
+static void
+forkOS_createThreadWrapper ( void * entry )
+{
+    Capability *cap;
+    cap = rts_lock();
+    rts_evalStableIO(&cap, (HsStablePtr) entry, NULL);
+    rts_unlock(cap);
+}
+
+int
+forkOS_createThread ( HsStablePtr entry )
+{
+    thread *t = thread_create(forkOS_createThreadWrapper, (void *)entry,
+                              THREAD_PRIORITY_NORMAL);
+    return t != NULL ? 0 : -1;
+}
+
+nat
+getNumberOfProcessors (void)
+{
+    return smp_cpu_count();
+}
+
+// Schedules the thread to run on CPU n of m.  m may be less than the
+// number of processors, in which case, the thread will be allowed
+// to run on CPU n, n+m, n+2m etc.
+void
+setThreadAffinity (nat n, nat m)
+{
+    nat nproc;
+    unsigned int mask = 0;
+    nat i;
+
+    nproc = getNumberOfProcessors();
+    for (i = n; i < nproc; i += m) {
+        mask |= 1U << i;
+    }
+    if (mask != 0) {
+        thread_set_affinity(mask);
+    }
+}
+
+#else /* !defined(THREADED_RTS) */
+
+int
+forkOS_createThread ( HsStablePtr entry STG_UNUSED )
+{
+    return -1;
+}
+
+nat getNumberOfProcessors (void)
+{
+    return 1;
+}
+
+#endif /* defined(THREADED_RTS) */
+
+KernelThreadId kernelThreadId (void)
+{
+    return (KernelThreadId) thread_current()->id;
+}
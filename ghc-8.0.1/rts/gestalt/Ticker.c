@@ -0,0 +1,110 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team 2005
+ *
+ * Interface to the Gestalt kernel clock, which drives the RTS ticker.
+ *
+ * ---------------------------------------------------------------------------*/
+
+#include "Rts.h"
+#include "Ticker.h"
+
+/* Kernel interfaces, from the Gestalt include directory. */
+#include <clock.h>
+
+/*
+ * The RTS is linked into the kernel, so there is no need for a signal
+ * or a ticker thread: we hook the kernel clock's tick handler list and
+ * call handle_tick straight from the timer IRQ.  The kernel clock runs
+ * at CLOCK_HZ, and the RTS tick interval (+RTS -V) is rounded to a
+ * whole number of clock ticks, at least one.
+ *
+ * handle_tick therefore runs with interrupts disabled on the bootstrap
+ * processor.  It only updates counters and flags.  In the threaded RTS
+ * it may also call wakeUpRts(), which takes no RTS lock: it only writes
+ * to the IO manager's wakeup fd, and does nothing when none is set.
+ * stopTicker() may itself be called from handle_tick, via stopTimer().
+ *
+ * exitTicker(rtsTrue) may run on another processor while a tick is in
+ * progress.  gestalt_tick marks itself in_tick before it looks at
+ * ticker_running, so once the handler is uninstalled and in_tick is
+ * seen clear, handle_tick is not running and never will again.
+ */
+
+static TickProc tick_proc = NULL;
+static nat clock_ticks_per_tick = 1;
+static volatile nat ticks_left = 1;
+static volatile rtsBool ticker_running = rtsFalse;
+static volatile rtsBool in_tick = rtsFalse;
+static rtsBool ticker_installed = rtsFalse;
+
+static void
+gestalt_tick (regs *r STG_UNUSED)
+{
+    in_tick = rtsTrue;
+    __sync_synchronize();
+
+    if (ticker_running && --ticks_left == 0) {
+        ticks_left = clock_ticks_per_tick;
+        tick_proc(0);
+    }
+
+    __sync_synchronize();
+    in_tick = rtsFalse;
+}
+
+void
+initTicker (Time interval, TickProc handle_tick)
+{
+    StgWord64 clock_ticks = TimeToUS(interval) * CLOCK_HZ / 1000000;
+
+    tick_proc = handle_tick;
+    clock_ticks_per_tick = clock_ticks > 0 ? (nat)clock_ticks : 1;
+    ticks_left = clock_ticks_per_tick;
+
+    if (!install_tick_handler(gestalt_tick)) {
+        errorBelch("initTicker: no free kernel tick handler slot");
+        stg_exit(EXIT_FAILURE);
+    }
+    ticker_installed = rtsTrue;
+}
+
+void
+startTicker(void)
+{
+    ticks_left = clock_ticks_per_tick;
+    ticker_running = rtsTrue;
+}
+
+void
+stopTicker(void)
+{
+    // The handler runs with interrupts off on one processor, so once the
+    // flag is clear no further tick can start.
+    ticker_running = rtsFalse;
+}
+
+void
+exitTicker (rtsBool wait)
+{
+    ticker_running = rtsFalse;
+
+    if (ticker_installed) {
+        uninstall_tick_handler(gestalt_tick);
+        ticker_installed = rtsFalse;
+    }
+
+    if (wait) {
+        __sync_synchronize();
+        while (in_tick) {
+            __asm__ __volatile__ ("pause");
+        }
+    }
+}
+
+int
+rtsTimerSignal(void)
+{
+    // There is no timer signal on Gestalt.
+    return 0;
+}
@@ -41,11 +41,25 @@ ALL_DIRS = hooks sm eventlog
 
 ifeq "$(HostOS_CPP)" "mingw32"
 ALL_DIRS += win32
+else ifeq "$(HostOS_CPP)" "gestalt"
+ALL_DIRS += posix gestalt
 else
 ALL_DIRS += posix
 endif
 
 rts_C_SRCS := $(wildcard rts/*.c $(foreach dir,$(ALL_DIRS),rts/$(dir)/*.c))
+
+# On Gestalt the RTS is linked into the kernel.  Backends in rts/gestalt
+# replace their posix namesakes, and see the kernel headers after the
+# system ones so they cannot shadow libc.
+ifeq "$(HostOS_CPP)" "gestalt"
+GESTALT_POSIX_OVERRIDES = $(patsubst rts/gestalt/%,rts/posix/%,$(wildcard rts/gestalt/*.c))
+# The posix ticker lives in Itimer.c rather than Ticker.c.
+GESTALT_POSIX_OVERRIDES += rts/posix/Itimer.c
+rts_C_SRCS := $(filter-out $(GESTALT_POSIX_OVERRIDES),$(rts_C_SRCS))
+GESTALT_INCLUDE_DIR ?= $(TOP)/../include
+endif
+
 rts_CMM_SRCS := $(wildcard rts/*.cmm)
 
 # Don't compile .S files when bootstrapping a new arch
@@ -341,6 +355,13 @@ endif
 
 #-----------------------------------------------------------------------------
 # Flags for compiling specific files
+ifeq "$(HostOS_CPP)" "gestalt"
+$(foreach src,$(wildcard rts/gestalt/*.c),\
+  $(eval $(basename $(src))_CC_OPTS += -idirafter $(GESTALT_INCLUDE_DIR)))
+# The kernel's sched.h has the same name as libc's, so include it by path.
+rts/gestalt/OSThreads_CC_OPTS += -DGESTALT_SCHED_H=\"$(GESTALT_INCLUDE_DIR)/sched.h\"
+endif
+
 rts/RtsMessages_CC_OPTS += -DProjectVersion=\"$(ProjectVersion)\"
 rts/RtsUtils_CC_OPTS += -DProjectVersion=\"$(ProjectVersion)\"
 rts/Trace_CC_OPTS += -DProjectVersion=\"$(ProjectVersion)\"
@@ -0,0 +1,31 @@
+#ifndef APIC_H
+#define APIC_H
+
+#include <cpu.h>
+#include <stdbool.h>
+
+#define APIC_SPURIOUS_VECTOR 0xFF
+
+#define LAPIC_ID 0x20
+#define LAPIC_TPR 0x80
+#define LAPIC_EOI 0xB0
+#define LAPIC_SVR 0xF0
+#define LAPIC_ICR_LOW 0x300
+#define LAPIC_ICR_HIGH 0x310
+
+extern bool apic_enabled;
+
+extern unsigned int apic_cpu_count;
+extern unsigned char apic_cpu_ids[MAX_CPUS];
+
+extern bool init_apic();
+
+extern unsigned int lapic_read(unsigned int reg);
+extern void lapic_write(unsigned int reg, unsigned int value);
+extern unsigned int lapic_id();
+extern void lapic_eoi();
+
+extern void ioapic_unmask(unsigned char irq);
+extern void ioapic_mask(unsigned char irq);
+
+#endif
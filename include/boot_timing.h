@@ -0,0 +1,8 @@
+#ifndef BOOT_TIMING_H
+#define BOOT_TIMING_H
+
+extern void boot_timing_start();
+extern void boot_stage(char* name);
+extern void print_boot_stages();
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <regs.h>
+#include <stdbool.h>
+
+#define CLOCK_HZ 1000
+
+extern volatile unsigned int clock_ticks;
+extern unsigned int tsc_khz;
+
+extern bool init_clock();
+
+extern unsigned long long ktime_ns();
+extern void udelay(unsigned int us);
+
+extern bool install_tick_handler(void (*handler)(regs* r));
+extern bool uninstall_tick_handler(void (*handler)(regs* r));
+
+#endif
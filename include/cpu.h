@@ -0,0 +1,30 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include <stdbool.h>
+
+#define MAX_CPUS 8
+
+#define CPU_FEATURE_PSE (1 << 3)
+#define CPU_FEATURE_TSC (1 << 4)
+#define CPU_FEATURE_MSR (1 << 5)
+#define CPU_FEATURE_APIC (1 << 9)
+#define CPU_FEATURE_SEP (1 << 11)
+#define CPU_FEATURE_PGE (1 << 13)
+#define CPU_FEATURE_FXSR (1 << 24)
+#define CPU_FEATURE_SSE (1 << 25)
+#define CPU_FEATURE_SSE2 (1 << 26)
+
+extern bool sse_enabled;
+
+extern void init_cpu();
+extern void cpuid(unsigned int leaf, unsigned int* eax, unsigned int* ebx, unsigned int* ecx, unsigned int* edx);
+extern bool cpu_has(unsigned int feature);
+
+extern unsigned long long rdmsr(unsigned int msr);
+extern void wrmsr(unsigned int msr, unsigned long long value);
+extern unsigned long long rdtsc();
+
+extern unsigned int cpu_id();
+
+#endif
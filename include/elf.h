@@ -0,0 +1,89 @@
+#ifndef ELF_H
+#define ELF_H
+
+// The parts of the 32-bit ELF format needed to link relocatable objects.
+
+#define ELF_MAGIC 0x464C457F // "\x7FELF", read as a little endian word.
+#define ELF_CLASS_32 1
+#define ELF_DATA_LSB 1
+#define ELF_TYPE_REL 1
+#define ELF_MACHINE_386 3
+
+#define ELF_SECTION_SYMTAB 2
+#define ELF_SECTION_RELA 4
+#define ELF_SECTION_NOBITS 8
+#define ELF_SECTION_REL 9
+
+#define ELF_FLAG_ALLOC 0x2
+
+#define ELF_SYMBOL_UNDEF 0
+#define ELF_SYMBOL_ABS 0xFFF1
+#define ELF_SYMBOL_COMMON 0xFFF2
+
+#define ELF_BIND_WEAK 2
+#define elf_symbol_bind(info) ((info) >> 4)
+
+#define ELF_R_386_NONE 0
+#define ELF_R_386_32 1
+#define ELF_R_386_PC32 2
+#define elf_rel_symbol(info) ((info) >> 8)
+#define elf_rel_type(info) ((info) & 0xFF)
+
+typedef struct elf_header elf_header;
+typedef struct elf_section elf_section;
+typedef struct elf_symbol elf_symbol;
+typedef struct elf_rel elf_rel;
+
+struct elf_header
+{
+  unsigned int magic;
+  unsigned char class;
+  unsigned char data;
+  unsigned char ident_version;
+  unsigned char ident_pad[9];
+  unsigned short type;
+  unsigned short machine;
+  unsigned int version;
+  unsigned int entry;
+  unsigned int phoff;
+  unsigned int shoff;
+  unsigned int flags;
+  unsigned short ehsize;
+  unsigned short phentsize;
+  unsigned short phnum;
+  unsigned short shentsize;
+  unsigned short shnum;
+  unsigned short shstrndx;
+};
+
+struct elf_section
+{
+  unsigned int name;
+  unsigned int type;
+  unsigned int flags;
+  unsigned int addr;
+  unsigned int offset;
+  unsigned int size;
+  unsigned int link;
+  unsigned int info;
+  unsigned int addralign;
+  unsigned int entsize;
+};
+
+struct elf_symbol
+{
+  unsigned int name;
+  unsigned int value;
+  unsigned int size;
+  unsigned char info;
+  unsigned char other;
+  unsigned short shndx;
+};
+
+struct elf_rel
+{
+  unsigned int offset;
+  unsigned int info;
+};
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <multiboot.h>
+#include <stdbool.h>
+
+#define FRAME_SIZE 4096
+#define FRAME_MAX_ORDER 20
+
+bool init_frames(multiboot_info_t* multi_data);
+void frame_metadata(unsigned long* begin_addr, unsigned long* end_addr);
+
+unsigned long frame_alloc(unsigned int order);
+bool frame_free(unsigned long frame_address, unsigned int order);
+
+unsigned long frame_alloc_pages(int num_pages);
+bool frame_free_pages(unsigned long frame_address, int num_pages);
+bool frames_allocated(unsigned long frame_address, int num_pages);
+
+void frame_reserve(unsigned long begin_addr, unsigned long end_addr);
+
+unsigned int frames_free();
+unsigned int frames_total();
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef FUTEX_H
+#define FUTEX_H
+
+#include <stdbool.h>
+
+#define FUTEX_BUCKETS 64
+#define FUTEX_WAKE_ALL (~0U)
+
+extern bool futex_wait(volatile unsigned int* addr, unsigned int expected);
+extern unsigned int futex_wake(volatile unsigned int* addr, unsigned int count);
+
+#endif
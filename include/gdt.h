@@ -26,7 +26,20 @@ struct gdt_entry
   unsigned char base_tt;
 } __attribute__ ((packed));
 
+typedef struct tss_entry tss_entry;
+
+struct tss_entry
+{
+  unsigned int prev_tss;
+  unsigned int esp0, ss0, esp1, ss1, esp2, ss2;
+  unsigned int cr3, eip, eflags;
+  unsigned int eax, ecx, edx, ebx, esp, ebp, esi, edi;
+  unsigned int es, cs, ss, ds, fs, gs, ldt;
+  unsigned short trap, iomap_base;
+} __attribute__ ((packed));
+
 extern bool init_gdt();
+extern unsigned short add_gdt_system_entry(unsigned int base, unsigned int limit, unsigned char access, unsigned char flags);
 extern void lgdt();
 
 extern bool set_segment_registers(segment code, segment data);
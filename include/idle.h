@@ -0,0 +1,11 @@
+#ifndef IDLE_H
+#define IDLE_H
+
+#include <stdbool.h>
+
+extern bool install_idle_handler(bool (*handler)());
+extern bool uninstall_idle_handler(bool (*handler)());
+
+extern void idle() __attribute__ ((noreturn));
+
+#endif
@@ -23,6 +23,7 @@ struct idt_entry
 extern void setup_idt();
 
 extern void install_kint(unsigned char no, unsigned int offset, unsigned short selector);
+extern void install_uint(unsigned char no, unsigned int offset, unsigned short selector);
 
 extern void lidt();
 
@@ -7,4 +7,8 @@
 extern bool install_irq_handler(unsigned char irq, void (*handler)(regs *r));
 extern bool uninstall_irq_handler(unsigned char irq);
 
+extern void irq_unmask(unsigned char irq);
+extern void irq_mask(unsigned char irq);
+extern void irq_eoi(unsigned char irq);
+
 #endif
@@ -0,0 +1,22 @@
+#ifndef KSYMS_H
+#define KSYMS_H
+
+#include <stdbool.h>
+
+typedef struct ksym ksym;
+
+struct ksym
+{
+  unsigned long address;
+  unsigned int name;
+  bool global;
+};
+
+extern unsigned int ksym_count();
+extern int ksym_find(unsigned long address);
+extern const char* ksym_name(unsigned int index);
+extern unsigned long ksym_address(unsigned int index);
+extern const char* ksym_lookup(unsigned long address, unsigned long* offset);
+extern unsigned long ksym_resolve(const char* name);
+
+#endif
@@ -72,6 +72,11 @@ extern int liballoc_unlock();
  */
 extern void* liballoc_alloc(int);
 
+/** The same as liballoc_alloc, but the pages returned are already
+ * zero-filled.
+ */
+extern void* liballoc_alloc_zeroed(int);
+
 /** This frees previously allocated memory. The void* parameter passed
  * to the function is the exact same value returned from a previous
  * liballoc_alloc call.
@@ -82,6 +87,25 @@ extern void* liballoc_alloc(int);
  */
 extern int liballoc_free(void*,int);
 
+/** Small requests are served by exact-fit size classes in front of the
+ * boundary tag allocator. This returns memory for sizes up to
+ * LIBALLOC_SMALL_MAX, or NULL to fall back to the boundary tags.
+ */
+extern void* liballoc_small_alloc(size_t);
+
+/** Returns the usable size of a block from liballoc_small_alloc, or 0
+ * if the pointer belongs to the boundary tag allocator.
+ */
+extern size_t liballoc_small_size(void*);
+
+/** Returns a block to its size class.
+ *
+ * \return 0 if the pointer was a small block and has been freed.
+ */
+extern int liballoc_small_free(void*);
+
+#define LIBALLOC_SMALL_MAX	512
+
        
 
 void     *malloc(size_t);				//< The standard function.
@@ -0,0 +1,37 @@
+#ifndef MODULE_H
+#define MODULE_H
+
+#include <multiboot.h>
+#include <stdbool.h>
+
+#define MAX_MODULES 16
+#define MODULE_NAME_MAX 64
+#define MODULE_ENTRY "module_main"
+
+enum module_type {MODULE_DATA = 0, MODULE_ELF = 1};
+
+typedef enum module_type module_type;
+
+typedef struct boot_module boot_module;
+
+struct boot_module
+{
+  char name[MODULE_NAME_MAX];
+  module_type type;
+  unsigned long phys;
+  unsigned long size;
+  unsigned long base;
+  unsigned long bss;
+  int bss_pages;
+  void (*entry)(void* arg);
+  unsigned long long load_ns;
+};
+
+extern bool init_modules(multiboot_info_t* multi_data);
+extern unsigned int start_modules();
+
+extern unsigned int module_count();
+extern boot_module* module_get(unsigned int index);
+extern boot_module* module_find(const char* name);
+
+#endif
@@ -33,6 +33,10 @@
 /* The magic number passed by a Multiboot-compliant boot loader. */
 #define MULTIBOOT_BOOTLOADER_MAGIC      0x2BADB002
 
+/* The flags in the Multiboot information. */
+#define MULTIBOOT_MODS                  0x00000008
+#define MULTIBOOT_MMAP                  0x00000040
+
 /* The size of our stack (16KB). */
 #define STACK_SIZE                      0x4000
 
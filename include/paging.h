@@ -4,11 +4,37 @@
 #include <stdbool.h>
 #include <multiboot.h>
 
+#define PAGE_TAG_NONE 0
+#define PAGE_TAG_SLAB 1
+
+#define PAGE_UNCACHED 0x18
+
+#define TLB_SHOOTDOWN_VECTOR 0xF2
+
 bool setup_paging(multiboot_info_t* multi_data);
 
 unsigned long palloc(int num_pages);
+unsigned long palloc_zeroed(int num_pages);
+unsigned long palloc_lazy(int num_pages);
 bool pfree(unsigned long page_address, int num_pages);
 
+unsigned long virt_to_phys(unsigned long virt_addr);
+
+bool map_range(unsigned long virt_addr, unsigned long phys_addr, int num_pages, unsigned short config);
+bool unmap_range(unsigned long virt_addr, int num_pages);
+
+unsigned long map_physical(unsigned long phys_addr, unsigned long size, unsigned short config);
+void unmap_physical(unsigned long virt_addr, unsigned long size);
+
+unsigned long frame_alloc_zeroed();
+void zero_frame(unsigned long phys_addr);
+bool refill_zero_pool();
+
+bool set_page_tag(unsigned long virt_addr, unsigned int tag);
+unsigned int get_page_tag(unsigned long virt_addr);
+
+void tlb_shootdown_poll();
+
 void lock_allocation();
 void unlock_allocation();
 
@@ -4,5 +4,8 @@
 #define PIC_BASE 32
 
 extern void pic_remap();
+extern void pic_unmask(unsigned char irq);
+extern void pic_mask(unsigned char irq);
+extern void pic_eoi(unsigned char irq);
 
 #endif
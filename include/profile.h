@@ -0,0 +1,19 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <regs.h>
+#include <stdbool.h>
+
+#define PROFILE_SAMPLES 4096 // Per processor, a power of two.
+#define PROFILE_TOP 15
+
+extern bool init_profile();
+extern void profile_sample(regs* r);
+
+extern void profile_start();
+extern void profile_stop();
+extern void profile_reset();
+
+extern void print_profile(unsigned int entries);
+
+#endif
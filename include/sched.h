@@ -0,0 +1,74 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <regs.h>
+#include <spinlock.h>
+#include <stdbool.h>
+
+#define THREAD_PRIORITIES 4
+#define THREAD_PRIORITY_LOW 0
+#define THREAD_PRIORITY_NORMAL 1
+#define THREAD_PRIORITY_HIGH 3
+
+#define SCHED_YIELD_VECTOR 0x81
+#define SCHED_IPI_VECTOR 0xF1
+#define SCHED_SLICE_TICKS 10
+
+#define THREAD_TLS_SLOTS 8
+#define THREAD_ANY_CPU (~0U)
+#define THREAD_FPU_SIZE 512
+
+enum thread_state {THREAD_RUNNABLE = 0, THREAD_RUNNING = 1, THREAD_BLOCKED = 2, THREAD_SLEEPING = 3, THREAD_EXITED = 4};
+
+typedef enum thread_state thread_state;
+
+typedef struct thread thread;
+typedef struct wait_queue wait_queue;
+
+struct thread
+{
+  regs* frame;
+  unsigned int id;
+  unsigned int priority;
+  volatile thread_state state;
+  volatile bool on_cpu;
+  unsigned int cpu;
+  unsigned int affinity;
+  unsigned long stack;
+  unsigned long long wake_time;
+  void (*entry)(void* arg);
+  void* arg;
+  wait_queue* wait;
+  spinlock* wait_lock;
+  unsigned long wait_key;
+  void* tls[THREAD_TLS_SLOTS];
+  thread* next;
+  unsigned char fpu[THREAD_FPU_SIZE] __attribute__ ((aligned(16)));
+};
+
+struct wait_queue
+{
+  spinlock lock;
+  thread* head;
+  thread* tail;
+};
+
+#define WAIT_QUEUE_INIT {.lock = SPINLOCK_INIT(NULL), .head = 0, .tail = 0}
+
+extern bool init_sched();
+extern regs* sched_switch(regs* r);
+
+extern thread* thread_create(void (*entry)(void* arg), void* arg, unsigned int priority);
+extern thread* thread_current();
+extern void thread_yield();
+extern void thread_exit() __attribute__ ((noreturn));
+extern void thread_sleep_ns(unsigned long long ns);
+extern bool thread_set_affinity(unsigned int mask);
+
+extern bool sleep_on(wait_queue* queue, spinlock* lock);
+extern bool wake_up(wait_queue* queue);
+extern void wake_up_all(wait_queue* queue);
+extern bool sleep_on_key(wait_queue* queue, spinlock* lock, unsigned long key);
+extern unsigned int wake_up_key(wait_queue* queue, unsigned long key, unsigned int count);
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef SELFTEST_H
+#define SELFTEST_H
+
+extern void run_selftests();
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#include <stdbool.h>
+
+extern bool init_serial();
+extern void serial_putch(char c);
+extern void serial_flush();
+
+#endif
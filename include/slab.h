@@ -0,0 +1,25 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stdbool.h>
+
+#define SLAB_MIN_SIZE 16
+#define SLAB_MAX_SIZE 512
+
+typedef struct kmem_cache kmem_cache;
+
+extern bool init_slab();
+
+extern kmem_cache* kmem_cache_create(const char* name, unsigned int size, unsigned int align, void (*ctor)(void* obj));
+extern bool kmem_cache_destroy(kmem_cache* cache);
+
+extern void* kmem_cache_alloc(kmem_cache* cache);
+extern void kmem_cache_free(kmem_cache* cache, void* obj);
+
+extern void* kmem_alloc(unsigned int size);
+extern void kmem_free(void* obj);
+extern unsigned int kmem_size(void* obj);
+
+extern void print_slab_info();
+
+#endif
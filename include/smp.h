@@ -0,0 +1,38 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include <cpu.h>
+#include <gdt.h>
+#include <stdbool.h>
+
+#define SMP_TRAMPOLINE 0x8000
+#define SMP_WAKE_VECTOR 0xF0
+#define KERNEL_STACK_PAGES 4
+
+typedef struct cpu_data cpu_data;
+
+struct cpu_data
+{
+  unsigned int id; // Read through gs by cpu_id(), keep first.
+  unsigned int apic_id;
+  cpu_data* self;
+  unsigned long stack;
+  unsigned short gs_selector;
+  unsigned short tss_selector;
+  volatile bool online;
+  void (*volatile work)(void* arg);
+  void* work_arg;
+  tss_entry tss;
+};
+
+extern bool cpu_data_ready;
+
+extern bool init_smp();
+extern unsigned int smp_cpu_count();
+extern unsigned int smp_online_mask();
+extern cpu_data* cpu_local();
+
+extern bool smp_run_on(unsigned int cpu, void (*work)(void* arg), void* arg);
+extern void smp_send_ipi(unsigned int cpu, unsigned char vector);
+
+#endif
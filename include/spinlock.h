@@ -0,0 +1,25 @@
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include <stats.h>
+#include <stdbool.h>
+
+typedef struct spinlock spinlock;
+
+struct spinlock
+{
+  volatile unsigned short next;
+  volatile unsigned short owner;
+  stat_counter* contention;
+};
+
+#define SPINLOCK_INIT(counter) {.next = 0, .owner = 0, .contention = counter}
+
+extern void spin_lock(spinlock* lock);
+extern bool spin_trylock(spinlock* lock);
+extern void spin_unlock(spinlock* lock);
+
+extern unsigned int spin_lock_irqsave(spinlock* lock);
+extern void spin_unlock_irqrestore(spinlock* lock, unsigned int flags);
+
+#endif
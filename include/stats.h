@@ -0,0 +1,24 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <cpu.h>
+
+typedef struct stat_counter stat_counter;
+
+struct stat_counter
+{
+  const char* name;
+  unsigned int values[MAX_CPUS];
+  stat_counter* next;
+};
+
+#define STAT_COUNTER(desc) {.name = desc, .values = {0}, .next = 0}
+
+#define stat_inc(counter) ((counter)->values[cpu_id()]++)
+#define stat_add(counter, n) ((counter)->values[cpu_id()] += (n))
+
+extern void install_stat(stat_counter* counter);
+extern unsigned int stat_total(stat_counter* counter);
+extern void print_stats();
+
+#endif
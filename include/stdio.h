@@ -8,5 +8,6 @@ extern void gotoxy(unsigned short x, unsigned short y);
 extern void clear_screen();
 extern void scroll(unsigned char lines);
 extern void putch(char c);
+extern void flush_console();
 
 #endif
@@ -0,0 +1,16 @@
+#ifndef STRING_H
+#define STRING_H
+
+#ifndef _HAVE_SIZE_T
+#define _HAVE_SIZE_T
+typedef	unsigned int	size_t;
+#endif
+
+extern void* memset(void* dest, int c, size_t n);
+extern void* memcpy(void* dest, const void* src, size_t n);
+extern void* memmove(void* dest, const void* src, size_t n);
+extern int memcmp(const void* s1, const void* s2, size_t n);
+extern size_t strlen(const char* s);
+extern int strcmp(const char* s1, const char* s2);
+
+#endif
@@ -3,9 +3,13 @@
 
 extern unsigned char inb(unsigned short port);
 extern void outb(unsigned short port, unsigned char val);
+extern void io_wait();
 extern void cli();
 extern void sti();
 
+extern unsigned int irq_save();
+extern void irq_restore(unsigned int flags);
+
 extern void kill() __attribute__ ((noreturn));
 
 #endif
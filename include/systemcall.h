@@ -0,0 +1,37 @@
+#ifndef SYSTEMCALL_H
+#define SYSTEMCALL_H
+
+#include <regs.h>
+#include <stdbool.h>
+
+/* Calling convention, for both sysenter and int 0x80: eax holds the call
+ * number and receives the result, arguments go in ebx, esi, edi and ebp.
+ * sysenter additionally takes the return address in edx and the user
+ * stack pointer in ecx, both of which are clobbered.
+ */
+
+#define SYSCALL_VECTOR 0x80
+#define SYSCALL_COUNT 64
+
+#define SYS_NULL 0
+#define SYS_YIELD 1
+#define SYS_THREAD_ID 2
+
+#define SYSCALL_ERROR 0xFFFFFFFF
+
+#define MSR_SYSENTER_CS 0x174
+#define MSR_SYSENTER_ESP 0x175
+#define MSR_SYSENTER_EIP 0x176
+
+typedef unsigned int (*syscall_handler)(unsigned int a, unsigned int b, unsigned int c, unsigned int d);
+
+extern bool sysenter_enabled;
+extern unsigned short sysenter_cs;
+
+extern bool install_syscalls();
+extern void syscall_cpu_init();
+
+extern bool register_syscall(unsigned int number, syscall_handler handler);
+extern unsigned int syscall_dispatch(unsigned int number, unsigned int a, unsigned int b, unsigned int c, unsigned int d);
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef VMM_H
+#define VMM_H
+
+#include <stdbool.h>
+
+#define VMM_BASE 0xD0000000
+#define VMM_END 0xF0000000
+
+void init_vmm();
+
+unsigned long vmm_alloc(int num_pages);
+bool vmm_free(unsigned long virt_addr, int num_pages);
+bool vmm_owns(unsigned long virt_addr);
+bool vmm_allocated(unsigned long virt_addr, int num_pages);
+
+unsigned long vmm_reserve(int num_pages);
+bool vmm_lazy_page(unsigned long virt_addr);
+
+unsigned int vmm_pages_used();
+
+#endif
@@ -1,13 +1,28 @@
+#include <apic.h>
+#include <boot_timing.h>
+#include <clock.h>
+#include <cpu.h>
 #include <gdt.h>
+#include <idle.h>
 #include <interrupt_handler.h>
 #include <liballoc.h>
 #include <linker_symbols.h>
+#include <module.h>
 #include <multiboot.h>
 #include <paging.h>
+#include <profile.h>
+#include <sched.h>
+#include <selftest.h>
+#include <serial.h>
+#include <slab.h>
+#include <smp.h>
 #include <stack_protector.h>
+#include <stats.h>
+#include <stdbool.h>
 #include <stdio.h>
+#include <systemcall.h>
 
-void k_main(multiboot_info_t* multi_data __attribute__ ((unused)), unsigned int magic)
+void k_main(multiboot_info_t* multi_data, unsigned int magic)
 {
   
   if(magic != MULTIBOOT_BOOTLOADER_MAGIC)
@@ -16,12 +31,26 @@ void k_main(multiboot_info_t* multi_data __attribute__ ((unused)), unsigned int
       return;
     }
 
+  init_cpu();
+  boot_timing_start();
+
   clear_screen();
+  bool serial = init_serial();
+  boot_stage("console");
 
   //print("Gestalt OS v 0.0.1 beta booting.\n\n");
   
   print("Gestalt OS initial build\n");
 
+  if(serial)
+    print("- Logging to COM1.\n");
+
+  print("\nProcessor:\n");
+  if(sse_enabled)
+    print("- SSE2 enabled for string routines.\n");
+  else
+    print("- No SSE2, using rep movsd/stosd string routines.\n");
+
 
   print("\nSegmentation:\n");
   if(init_gdt())    
@@ -44,6 +73,7 @@ void k_main(multiboot_info_t* multi_data __attribute__ ((unused)), unsigned int
      print("Error: Invalid segment descriptor offsets.\nHalting.\n");
      return;
    }
+  boot_stage("segmentation");
 
   print("\nPaging:\n");
 
@@ -51,10 +81,84 @@ void k_main(multiboot_info_t* multi_data __attribute__ ((unused)), unsigned int
     print("Error: Paging initialization failure.\nHalting.\n");
     return; 
   }
-  
+  boot_stage("paging");
+
   print("Interrupts:\n");
   install_ints();
-  print("- Interrupt system initialised.\n\n");
+  print("- Interrupt system initialised.\n");
+  if(init_apic())
+    print("- Local APIC and IOAPIC enabled, %u processors found.\n\n", apic_cpu_count);
+  else
+    print("- No APIC found, using the 8259 PIC.\n\n");
+  boot_stage("interrupts");
+
+  print("System calls:\n");
+  if(!install_syscalls()) {
+    print("Error: System call initialization failure.\nHalting.\n");
+    return;
+  }
+  if(sysenter_enabled)
+    print("- sysenter enabled, int 0x80 as fallback.\n\n");
+  else
+    print("- Using int 0x80.\n\n");
+  boot_stage("system calls");
+
+  print("Clock:\n");
+  if(!init_clock()) {
+    print("Error: Clock initialization failure.\nHalting.\n");
+    return;
+  }
+  print("- PIT running at %u Hz.\n", CLOCK_HZ);
+  if(tsc_khz)
+    print("- TSC calibrated at %u kHz.\n\n", tsc_khz);
+  else
+    print("- No TSC, clock has tick resolution.\n\n");
+  boot_stage("clock");
+
+  print("Profiler:\n");
+  if(init_profile())
+    print("- Sampling every clock tick.\n\n");
+  else
+    print("- No tick handler slot left, profiler disabled.\n\n");
+  boot_stage("profiler");
+
+  print("Processors:\n");
+  if(!init_smp()) {
+    print("Error: Per-CPU data initialization failure.\nHalting.\n");
+    return;
+  }
+  print("- %u processors online.\n\n", smp_cpu_count());
+  boot_stage("processors");
+
+  print("Object caches:\n");
+  if(!init_slab()) {
+    print("Error: Object cache initialization failure.\nHalting.\n");
+    return;
+  }
+  print("- General purpose caches created.\n\n");
+  boot_stage("object caches");
+
+  print("Scheduler:\n");
+  if(!init_sched()) {
+    print("Error: Scheduler initialization failure.\nHalting.\n");
+    return;
+  }
+  print("- Preemptive scheduling on %u processors.\n\n", smp_cpu_count());
+  boot_stage("scheduler");
+
+  print("Modules:\n");
+  if(!init_modules(multi_data)) {
+    print("Error: Boot module information unreadable.\nHalting.\n");
+    return;
+  }
+  print("- %u modules mapped in place, %u started.\n\n", module_count(), start_modules());
+  boot_stage("modules");
+
+#ifdef SELFTEST
+  print("Self tests:\n");
+  run_selftests();
+  boot_stage("self tests");
+#endif
 
   print("Allocation test:\n");
 
@@ -63,7 +167,12 @@ void k_main(multiboot_info_t* multi_data __attribute__ ((unused)), unsigned int
 
   free(test);
 
-  print("- Memory freed\n");
-  
-  return;
+  print("- Memory freed\n\n");
+  boot_stage("allocation test");
+
+  print_boot_stages();
+  print_profile(PROFILE_TOP);
+  print_stats();
+
+  idle();
 }
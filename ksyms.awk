@@ -0,0 +1,35 @@
+# Turns `nm -n` output for the first link pass into ksyms_table.c, the
+# symbol table linked into the final kernel.bin. Local symbols are kept
+# for naming addresses, but marked so modules cannot link against them.
+
+BEGIN {
+  count = 0
+  offset = 0
+}
+
+$2 ~ /^[tTdDbBrR]$/ && NF == 3 {
+  addrs[count] = $1
+  offsets[count] = offset
+  names[count] = $3
+  globals[count] = $2 ~ /^[TDBR]$/
+  offset += length($3) + 1
+  count++
+}
+
+END {
+  print "#include <ksyms.h>"
+  print ""
+  print "const char ksyms_names[] __attribute__ ((section (\".ksyms\"))) ="
+  for(i = 0; i < count; i++)
+    printf "  \"%s\\0\"\n", names[i]
+  print "  \"\";"
+  print ""
+  print "const ksym ksyms_table[] __attribute__ ((section (\".ksyms\"))) = {"
+  for(i = 0; i < count; i++)
+    printf "  {0x%s, %u, %u},\n", addrs[i], offsets[i], globals[i]
+  if(!count)
+    print "  {0, 0, 0},"
+  print "};"
+  print ""
+  printf "const unsigned int ksyms_table_count __attribute__ ((section (\".ksyms\"))) = %u;\n", count
+}
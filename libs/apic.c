@@ -0,0 +1,465 @@
+#include <cpu.h>
+#include <interrupt_handler.h>
+#include <paging.h>
+#include <pic.h>
+#include <regs.h>
+#include <stdbool.h>
+#include <stdsymbols.h>
+#include <string.h>
+#include <system.h>
+#include <apic.h>
+
+/* Local APIC and IOAPIC support.
+ *
+ * The processors, IOAPICs and ISA interrupt overrides are read from the
+ * ACPI MADT, or from the MP configuration table when there is no ACPI.
+ * ISA IRQs keep their PIC_BASE + irq vectors, so handlers installed with
+ * install_irq_handler do not change, and are routed through the IOAPIC
+ * to the bootstrap processor. The 8259s stay remapped but fully masked.
+ * An EOI is then a single store to the local APIC instead of one or two
+ * port writes.
+ */
+
+#define MAX_IOAPICS 4
+#define ISA_IRQS 16
+
+#define APIC_BASE_MSR 0x1B
+#define APIC_BASE_ENABLE (1 << 11)
+
+#define IOAPIC_VERSION 0x01
+#define IOAPIC_REDIRECTION 0x10
+#define REDIRECT_LOW_ACTIVE (1 << 13)
+#define REDIRECT_LEVEL (1 << 15)
+#define REDIRECT_MASKED (1 << 16)
+
+#define BIOS_ROM_BEGIN 0xE0000
+#define BIOS_ROM_END 0x100000
+#define EBDA_SEGMENT 0x40E
+
+typedef struct ioapic ioapic;
+
+struct ioapic
+{
+  unsigned long phys_addr;
+  volatile unsigned int* regs;
+  unsigned int gsi_base;
+  unsigned int gsi_count;
+};
+
+typedef struct acpi_header acpi_header;
+
+struct acpi_header
+{
+  char signature[4];
+  unsigned int length;
+  unsigned char revision;
+  unsigned char checksum;
+  char oem[6];
+  char oem_table[8];
+  unsigned int oem_revision;
+  unsigned int creator;
+  unsigned int creator_revision;
+} __attribute__ ((packed));
+
+bool apic_enabled = false;
+
+unsigned int apic_cpu_count = 0;
+unsigned char apic_cpu_ids[MAX_CPUS];
+
+static unsigned long lapic_phys = 0;
+static volatile unsigned int* lapic = NULL;
+static unsigned int bsp_apic_id = 0;
+
+static ioapic ioapics[MAX_IOAPICS];
+static unsigned int ioapic_count = 0;
+
+static unsigned int isa_gsi[ISA_IRQS];
+static unsigned short isa_flags[ISA_IRQS];
+
+unsigned int lapic_read(unsigned int reg)
+{
+  return lapic[reg >> 2];
+}
+
+void lapic_write(unsigned int reg, unsigned int value)
+{
+  lapic[reg >> 2] = value;
+  return;
+}
+
+unsigned int lapic_id()
+{
+  return lapic_read(LAPIC_ID) >> 24;
+}
+
+void lapic_eoi()
+{
+  lapic_write(LAPIC_EOI, 0);
+  return;
+}
+
+static unsigned int ioapic_read(ioapic* io, unsigned int reg)
+{
+  io->regs[0] = reg;
+  return io->regs[4];
+}
+
+static void ioapic_write(ioapic* io, unsigned int reg, unsigned int value)
+{
+  io->regs[0] = reg;
+  io->regs[4] = value;
+  return;
+}
+
+static ioapic* ioapic_for(unsigned int gsi)
+{
+  for(unsigned int i = 0; i < ioapic_count; i++)
+    if(gsi >= ioapics[i].gsi_base && gsi < ioapics[i].gsi_base + ioapics[i].gsi_count)
+      return &ioapics[i];
+
+  return NULL;
+}
+
+static void route_irq(unsigned char irq, bool masked)
+{
+  unsigned int gsi = isa_gsi[irq];
+  ioapic* io = ioapic_for(gsi);
+
+  if(!io)
+    return;
+
+  // ISA interrupts default to active high, edge triggered.
+  unsigned int low = PIC_BASE + irq;
+  if((isa_flags[irq] & 3) == 3)
+    low |= REDIRECT_LOW_ACTIVE;
+  if(((isa_flags[irq] >> 2) & 3) == 3)
+    low |= REDIRECT_LEVEL;
+  if(masked)
+    low |= REDIRECT_MASKED;
+
+  unsigned int entry = IOAPIC_REDIRECTION + 2 * (gsi - io->gsi_base);
+  ioapic_write(io, entry + 1, bsp_apic_id << 24);
+  ioapic_write(io, entry, low);
+
+  return;
+}
+
+void ioapic_unmask(unsigned char irq)
+{
+  if(irq < ISA_IRQS)
+    route_irq(irq, false);
+  return;
+}
+
+void ioapic_mask(unsigned char irq)
+{
+  if(irq < ISA_IRQS)
+    route_irq(irq, true);
+  return;
+}
+
+static bool checksum(unsigned char* data, unsigned int length)
+{
+  unsigned char sum = 0;
+
+  for(unsigned int i = 0; i < length; i++)
+    sum += data[i];
+
+  return !sum;
+}
+
+static void add_cpu(unsigned char apic_id)
+{
+  if(apic_cpu_count < MAX_CPUS)
+    apic_cpu_ids[apic_cpu_count++] = apic_id;
+  return;
+}
+
+static void add_ioapic(unsigned long phys_addr, unsigned int gsi_base)
+{
+  if(ioapic_count < MAX_IOAPICS)
+    {
+      ioapics[ioapic_count].phys_addr = phys_addr;
+      ioapics[ioapic_count].gsi_base = gsi_base;
+      ioapic_count++;
+    }
+  return;
+}
+
+// Searches [begin, end) of physical memory for a 16 byte aligned structure
+// starting with signature and returns its physical address.
+static unsigned long scan_bios(unsigned long begin_addr, unsigned long end_addr, char* signature,
+			       unsigned int sig_length, unsigned int check_length)
+{
+  unsigned long area = map_physical(begin_addr, end_addr - begin_addr, 1);
+  unsigned long found = 0;
+
+  if(!area)
+    return 0;
+
+  for(unsigned long offset = 0; !found && offset + check_length <= end_addr - begin_addr; offset += 16)
+    if(!memcmp((void*)(area + offset), signature, sig_length)
+       && checksum((unsigned char*)(area + offset), check_length))
+      found = begin_addr + offset;
+
+  unmap_physical(area, end_addr - begin_addr);
+
+  return found;
+}
+
+static unsigned long find_bios_table(char* signature, unsigned int sig_length, unsigned int check_length)
+{
+  unsigned short* ebda_segment = (unsigned short*)map_physical(EBDA_SEGMENT, 2, 1);
+  unsigned long ebda = 0;
+
+  if(ebda_segment)
+    {
+      ebda = (unsigned long)*ebda_segment << 4;
+      unmap_physical((unsigned long)ebda_segment, 2);
+    }
+
+  unsigned long found = 0;
+  if(ebda)
+    found = scan_bios(ebda, ebda + 1024, signature, sig_length, check_length);
+  if(!found)
+    found = scan_bios(BIOS_ROM_BEGIN, BIOS_ROM_END, signature, sig_length, check_length);
+
+  return found;
+}
+
+static acpi_header* map_acpi_table(unsigned long phys_addr)
+{
+  acpi_header* header = (acpi_header*)map_physical(phys_addr, sizeof(acpi_header), 1);
+
+  if(!header)
+    return NULL;
+
+  unsigned int length = header->length;
+  unmap_physical((unsigned long)header, sizeof(acpi_header));
+
+  header = (acpi_header*)map_physical(phys_addr, length, 1);
+  if(header && !checksum((unsigned char*)header, length))
+    {
+      unmap_physical((unsigned long)header, length);
+      return NULL;
+    }
+
+  return header;
+}
+
+static void parse_madt_entries(unsigned char* entry, unsigned char* entries_end)
+{
+  for(; entry + 2 <= entries_end && entry[1]; entry += entry[1])
+    switch(entry[0])
+      {
+      case 0:
+	// Processor local APIC, usable if enabled.
+	if(*(unsigned int*)(entry + 4) & 1)
+	  add_cpu(entry[3]);
+	break;
+      case 1:
+	add_ioapic(*(unsigned int*)(entry + 4), *(unsigned int*)(entry + 8));
+	break;
+      case 2:
+	// Interrupt source override for an ISA IRQ.
+	if(entry[3] < ISA_IRQS)
+	  {
+	    isa_gsi[entry[3]] = *(unsigned int*)(entry + 4);
+	    isa_flags[entry[3]] = *(unsigned short*)(entry + 8);
+	  }
+	break;
+      }
+
+  return;
+}
+
+static bool parse_madt()
+{
+  unsigned long rsdp = find_bios_table("RSD PTR ", 8, 20);
+  if(!rsdp)
+    return false;
+
+  unsigned int* rsdt_addr = (unsigned int*)map_physical(rsdp + 16, 4, 1);
+  if(!rsdt_addr)
+    return false;
+  acpi_header* rsdt = map_acpi_table(*rsdt_addr);
+  unmap_physical((unsigned long)rsdt_addr, 4);
+  if(!rsdt)
+    return false;
+
+  bool found = false;
+  unsigned int* tables = (unsigned int*)(rsdt + 1);
+  for(unsigned int i = 0; !found && i < (rsdt->length - sizeof(acpi_header)) / 4; i++)
+    {
+      acpi_header* table = map_acpi_table(tables[i]);
+      if(!table)
+	continue;
+
+      if(!memcmp(table->signature, "APIC", 4))
+	{
+	  unsigned char* madt = (unsigned char*)table;
+	  lapic_phys = *(unsigned int*)(madt + sizeof(acpi_header));
+	  parse_madt_entries(madt + sizeof(acpi_header) + 8, madt + table->length);
+	  found = true;
+	}
+
+      unmap_physical((unsigned long)table, table->length);
+    }
+
+  unmap_physical((unsigned long)rsdt, rsdt->length);
+
+  return found;
+}
+
+static bool parse_mp()
+{
+  unsigned long floating = find_bios_table("_MP_", 4, 16);
+  if(!floating)
+    return false;
+
+  unsigned int* config_addr = (unsigned int*)map_physical(floating + 4, 4, 1);
+  if(!config_addr)
+    return false;
+  unsigned long config_phys = *config_addr;
+  unmap_physical((unsigned long)config_addr, 4);
+
+  // Default configurations without a table are not supported.
+  if(!config_phys)
+    return false;
+
+  unsigned short* header = (unsigned short*)map_physical(config_phys, 44, 1);
+  if(!header)
+    return false;
+  unsigned int length = header[2];
+  unmap_physical((unsigned long)header, 44);
+
+  unsigned char* config = (unsigned char*)map_physical(config_phys, length, 1);
+  if(!config)
+    return false;
+  if(memcmp(config, "PCMP", 4) || !checksum(config, length))
+    {
+      unmap_physical((unsigned long)config, length);
+      return false;
+    }
+
+  lapic_phys = *(unsigned int*)(config + 0x24);
+
+  unsigned int isa_buses = 0;
+  unsigned char ioapic_ids[MAX_IOAPICS];
+  unsigned char* entry = config + 44;
+  for(unsigned int i = 0; i < *(unsigned short*)(config + 0x22) && entry < config + length; i++)
+    switch(entry[0])
+      {
+      case 0:
+	if(entry[3] & 1)
+	  add_cpu(entry[1]);
+	entry += 20;
+	break;
+      case 1:
+	if(!memcmp(entry + 2, "ISA", 3) && entry[1] < 32)
+	  isa_buses |= 1 << entry[1];
+	entry += 8;
+	break;
+      case 2:
+	if((entry[3] & 1) && ioapic_count < MAX_IOAPICS)
+	  {
+	    ioapic_ids[ioapic_count] = entry[1];
+	    add_ioapic(*(unsigned int*)(entry + 4), 0);
+	  }
+	entry += 8;
+	break;
+      case 3:
+	// Vectored interrupt from an ISA bus, mapped to an IOAPIC input.
+	if(!entry[1] && entry[4] < 32 && (isa_buses & (1 << entry[4])) && entry[5] < ISA_IRQS)
+	  for(unsigned int io = 0; io < ioapic_count; io++)
+	    if(ioapic_ids[io] == entry[6])
+	      {
+		isa_gsi[entry[5]] = (io << 8) | entry[7];
+		isa_flags[entry[5]] = *(unsigned short*)(entry + 2);
+	      }
+	entry += 8;
+	break;
+      default:
+	entry += 8;
+	break;
+      }
+
+  unmap_physical((unsigned long)config, length);
+
+  return true;
+}
+
+static void apic_spurious(regs* r __attribute__ ((unused)))
+{
+  return;
+}
+
+bool init_apic()
+{
+  if(!cpu_has(CPU_FEATURE_APIC | CPU_FEATURE_MSR))
+    return false;
+
+  for(unsigned int i = 0; i < ISA_IRQS; i++)
+    {
+      isa_gsi[i] = i;
+      isa_flags[i] = 0;
+    }
+
+  bool from_mp = false;
+  if(!parse_madt())
+    {
+      if(!parse_mp())
+	return false;
+      from_mp = true;
+    }
+
+  if(!lapic_phys || !ioapic_count || !apic_cpu_count)
+    return false;
+
+  lapic = (volatile unsigned int*)map_physical(lapic_phys, 4096, 3 | PAGE_UNCACHED);
+  if(!lapic)
+    return false;
+
+  unsigned int gsi_base = 0;
+  for(unsigned int i = 0; i < ioapic_count; i++)
+    {
+      ioapics[i].regs = (volatile unsigned int*)map_physical(ioapics[i].phys_addr, 32, 3 | PAGE_UNCACHED);
+      if(!ioapics[i].regs)
+	return false;
+      ioapics[i].gsi_count = ((ioapic_read(&ioapics[i], IOAPIC_VERSION) >> 16) & 0xFF) + 1;
+
+      // MP tables number inputs per IOAPIC, give them consecutive GSIs.
+      if(from_mp)
+	{
+	  ioapics[i].gsi_base = gsi_base;
+	  gsi_base += ioapics[i].gsi_count;
+	}
+
+      for(unsigned int pin = 0; pin < ioapics[i].gsi_count; pin++)
+	ioapic_write(&ioapics[i], IOAPIC_REDIRECTION + 2 * pin, REDIRECT_MASKED);
+    }
+
+  if(from_mp)
+    for(unsigned int irq = 0; irq < ISA_IRQS; irq++)
+      if(isa_gsi[irq] >> 8)
+	isa_gsi[irq] = ioapics[isa_gsi[irq] >> 8].gsi_base + (isa_gsi[irq] & 0xFF);
+
+  wrmsr(APIC_BASE_MSR, rdmsr(APIC_BASE_MSR) | APIC_BASE_ENABLE);
+  int_routines[APIC_SPURIOUS_VECTOR] = apic_spurious;
+  bsp_apic_id = lapic_id();
+  lapic_write(LAPIC_TPR, 0);
+  lapic_write(LAPIC_SVR, 0x100 | APIC_SPURIOUS_VECTOR);
+
+  // Carry the PIC masks over, then silence the PICs.
+  unsigned int pic_masks = inb(0x21) | (inb(0xA1) << 8);
+  outb(0x21, 0xFF);
+  outb(0xA1, 0xFF);
+
+  apic_enabled = true;
+
+  for(unsigned char irq = 0; irq < ISA_IRQS; irq++)
+    if(irq != 2)
+      route_irq(irq, pic_masks & (1 << irq));
+
+  return true;
+}
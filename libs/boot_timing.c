@@ -0,0 +1,83 @@
+#include <clock.h>
+#include <cpu.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <boot_timing.h>
+
+/* Boot stage timestamps.
+ *
+ * k_main calls boot_stage() as each initialisation step finishes. Only
+ * the raw TSC values are stored, since the TSC is not calibrated until
+ * the clock is up; print_boot_stages() converts them afterwards.
+ */
+
+#define MAX_BOOT_STAGES 16
+
+typedef struct boot_stage_mark boot_stage_mark;
+
+struct boot_stage_mark
+{
+  char* name;
+  unsigned long long tsc;
+};
+
+static boot_stage_mark boot_stages[MAX_BOOT_STAGES];
+static unsigned int boot_stage_count = 0;
+static unsigned long long boot_start = 0;
+static bool boot_timing = false;
+
+void boot_timing_start()
+{
+  boot_timing = cpu_has(CPU_FEATURE_TSC);
+  if(boot_timing)
+    boot_start = rdtsc();
+  return;
+}
+
+void boot_stage(char* name)
+{
+  if(!boot_timing || boot_stage_count >= MAX_BOOT_STAGES)
+    return;
+
+  boot_stages[boot_stage_count].name = name;
+  boot_stages[boot_stage_count].tsc = rdtsc();
+  boot_stage_count++;
+
+  return;
+}
+
+static void print_duration(char* name, unsigned long long cycles)
+{
+  unsigned int mhz = tsc_khz / 1000;
+
+  if(cycles >> 32)
+    print("- %s: over 2^32 cycles", name);
+  else
+    print("- %s: %u cycles", name, (unsigned int)cycles);
+
+  if(mhz && !(cycles >> 32))
+    print(" (%u us)", (unsigned int)cycles / mhz);
+
+  print("\n");
+  return;
+}
+
+void print_boot_stages()
+{
+  if(!boot_timing)
+    return;
+
+  print("Boot timing:\n");
+
+  unsigned long long previous = boot_start;
+  for(unsigned int i = 0; i < boot_stage_count; i++)
+    {
+      print_duration(boot_stages[i].name, boot_stages[i].tsc - previous);
+      previous = boot_stages[i].tsc;
+    }
+
+  print_duration("total", previous - boot_start);
+  print("\n");
+
+  return;
+}
@@ -0,0 +1,168 @@
+#include <cpu.h>
+#include <irq.h>
+#include <pic.h>
+#include <regs.h>
+#include <stdbool.h>
+#include <stdsymbols.h>
+#include <system.h>
+#include <clock.h>
+
+/* Kernel clock.
+ *
+ * PIT channel 0 raises IRQ0 CLOCK_HZ times a second and runs the
+ * registered tick handlers. PIT channel 2 is used as a one-shot reference
+ * to calibrate the TSC, which then backs ktime_ns(). The conversion uses
+ * a 32.32 fixed point nanoseconds-per-cycle factor, so no 64 bit
+ * division is needed at run time. Without a TSC, ktime_ns() falls back to
+ * tick resolution.
+ */
+
+#define PIT_FREQUENCY 1193182
+#define PIT_CHANNEL0 0x40
+#define PIT_CHANNEL2 0x42
+#define PIT_COMMAND 0x43
+#define PIT_GATE 0x61
+
+#define CALIBRATION_MS 10
+#define MAX_TICK_HANDLERS 8
+
+volatile unsigned int clock_ticks = 0;
+unsigned int tsc_khz = 0;
+
+static unsigned long long tsc_base = 0;
+static unsigned int ns_per_cycle = 0;
+static unsigned int ns_per_cycle_frac = 0;
+
+void (*tick_routines[MAX_TICK_HANDLERS])(regs* r) = {[0 ... (MAX_TICK_HANDLERS - 1)] = NULL};
+
+static unsigned int div64_32(unsigned int high, unsigned int low, unsigned int divisor)
+{
+  unsigned int quotient, remainder;
+  __asm__ ("div %4" : "=a"(quotient), "=d"(remainder) : "a"(low), "d"(high), "r"(divisor));
+  return quotient;
+}
+
+// Busy waits on PIT channel 2 for up to 54ms, independent of interrupts
+// and of the TSC.
+static void pit_wait(unsigned int us)
+{
+  unsigned int count = us * (PIT_FREQUENCY / 1000) / 1000;
+
+  if(count > 0xFFFF)
+    count = 0xFFFF;
+  if(!count)
+    count = 1;
+
+  outb(PIT_GATE, (inb(PIT_GATE) & ~0x02) | 0x01);
+  outb(PIT_COMMAND, 0xB0);
+  outb(PIT_CHANNEL2, count & 0xFF);
+  outb(PIT_CHANNEL2, (count >> 8) & 0xFF);
+
+  // Restart the count by toggling the gate, then wait for OUT2.
+  unsigned char gate = inb(PIT_GATE);
+  outb(PIT_GATE, gate & ~0x01);
+  outb(PIT_GATE, gate | 0x01);
+  while(!(inb(PIT_GATE) & 0x20));
+
+  return;
+}
+
+static void calibrate_tsc()
+{
+  unsigned long long start = rdtsc();
+  pit_wait(CALIBRATION_MS * 1000);
+  unsigned long long cycles = rdtsc() - start;
+
+  tsc_khz = div64_32(cycles >> 32, cycles, CALIBRATION_MS);
+  if(!tsc_khz)
+    return;
+
+  ns_per_cycle = 1000000 / tsc_khz;
+  ns_per_cycle_frac = div64_32(1000000 % tsc_khz, 0, tsc_khz);
+  tsc_base = rdtsc();
+
+  return;
+}
+
+static void clock_handler(regs* r)
+{
+  clock_ticks++;
+
+  for(int i = 0; i < MAX_TICK_HANDLERS; i++)
+    if(tick_routines[i])
+      tick_routines[i](r);
+
+  return;
+}
+
+bool init_clock()
+{
+  unsigned int divisor = PIT_FREQUENCY / CLOCK_HZ;
+
+  if(cpu_has(CPU_FEATURE_TSC))
+    calibrate_tsc();
+
+  outb(PIT_COMMAND, 0x34);
+  outb(PIT_CHANNEL0, divisor & 0xFF);
+  outb(PIT_CHANNEL0, (divisor >> 8) & 0xFF);
+
+  if(!install_irq_handler(PIC_BASE, clock_handler))
+    return false;
+  irq_unmask(0);
+
+  return true;
+}
+
+unsigned long long ktime_ns()
+{
+  if(!tsc_khz)
+    return (unsigned long long)clock_ticks * (1000000000 / CLOCK_HZ);
+
+  unsigned long long cycles = rdtsc() - tsc_base;
+  unsigned int high = cycles >> 32, low = cycles;
+
+  return cycles * ns_per_cycle
+    + (unsigned long long)high * ns_per_cycle_frac
+    + (((unsigned long long)low * ns_per_cycle_frac) >> 32);
+}
+
+void udelay(unsigned int us)
+{
+  if(!tsc_khz)
+    {
+      for(; us > 50000; us -= 50000)
+	pit_wait(50000);
+      pit_wait(us);
+      return;
+    }
+
+  unsigned long long until = ktime_ns() + (unsigned long long)us * 1000;
+  while(ktime_ns() < until)
+    __asm__ __volatile__ ("pause");
+
+  return;
+}
+
+bool install_tick_handler(void (*handler)(regs* r))
+{
+  for(int i = 0; i < MAX_TICK_HANDLERS; i++)
+    if(!tick_routines[i])
+      {
+	tick_routines[i] = handler;
+	return true;
+      }
+
+  return false;
+}
+
+bool uninstall_tick_handler(void (*handler)(regs* r))
+{
+  for(int i = 0; i < MAX_TICK_HANDLERS; i++)
+    if(tick_routines[i] == handler)
+      {
+	tick_routines[i] = NULL;
+	return true;
+      }
+
+  return false;
+}
@@ -0,0 +1,71 @@
+#include <smp.h>
+#include <stdbool.h>
+#include <cpu.h>
+
+unsigned int cpu_features = 0;
+bool sse_enabled = false;
+
+void cpuid(unsigned int leaf, unsigned int* eax, unsigned int* ebx, unsigned int* ecx, unsigned int* edx)
+{
+  __asm__ __volatile__ ("cpuid" : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx) : "a"(leaf), "c"(0));
+  return;
+}
+
+void init_cpu()
+{
+  unsigned int eax, ebx, ecx, edx;
+
+  cpuid(0, &eax, &ebx, &ecx, &edx);
+  if(eax < 1)
+    return;
+
+  cpuid(1, &eax, &ebx, &ecx, &edx);
+  cpu_features = edx;
+
+  // SSE needs CR4.OSFXSR before any xmm register may be touched.
+  if(cpu_has(CPU_FEATURE_FXSR | CPU_FEATURE_SSE | CPU_FEATURE_SSE2)) {
+    __asm__ __volatile__ ("mov %%eax, %%cr0\n and %%eax, 0xFFFFFFFB\n or %%eax, 0x2\n mov %%cr0, %%eax\n"
+			  "mov %%eax, %%cr4\n or %%eax, 0x600\n mov %%cr4, %%eax" ::: "%eax");
+    sse_enabled = true;
+  }
+
+  return;
+}
+
+bool cpu_has(unsigned int feature)
+{
+  return (cpu_features & feature) == feature;
+}
+
+unsigned long long rdmsr(unsigned int msr)
+{
+  unsigned int low, high;
+  __asm__ __volatile__ ("rdmsr" : "=a"(low), "=d"(high) : "c"(msr));
+  return ((unsigned long long)high << 32) | low;
+}
+
+void wrmsr(unsigned int msr, unsigned long long value)
+{
+  __asm__ __volatile__ ("wrmsr" :: "c"(msr), "a"((unsigned int)value), "d"((unsigned int)(value >> 32)));
+  return;
+}
+
+unsigned long long rdtsc()
+{
+  unsigned int low, high;
+  __asm__ __volatile__ ("rdtsc" : "=a"(low), "=d"(high));
+  return ((unsigned long long)high << 32) | low;
+}
+
+unsigned int cpu_id()
+{
+  unsigned int id;
+
+  // Until init_smp() loads the per-CPU segment only the bootstrap
+  // processor runs.
+  if(!cpu_data_ready)
+    return 0;
+
+  __asm__ __volatile__ ("mov %0, %%gs:[0]" : "=r"(id));
+  return id;
+}
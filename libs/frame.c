@@ -0,0 +1,580 @@
+#include <cpu.h>
+#include <linker_symbols.h>
+#include <multiboot.h>
+#include <spinlock.h>
+#include <stats.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <system.h>
+#include <frame.h>
+
+/* Binary buddy allocator over physical page frames.
+ *
+ * Every free block of 2^order frames is linked into free_lists[order]
+ * through the frame_links entry of its first frame, and free_orders keeps
+ * one bit per order that has a non-empty list, so finding the smallest
+ * block that fits is a single bit scan. frame_bitmap has one bit per
+ * frame (set = allocated or not usable) and is only used to validate
+ * frees and reservations. reserved_bitmap sets the subset that was never
+ * handed out: memory the map does not call usable and frames taken by
+ * frame_reserve(). Neither can be freed. All metadata is sized from the
+ * multiboot memory map and carved out of physical memory right after
+ * the kernel.
+ *
+ * Blocks of up to 2^(FRAME_CACHE_ORDERS - 1) frames are served from
+ * per-CPU magazines with interrupts masked; frame_lock is only taken to
+ * move a batch between a magazine and the buddy lists.
+ */
+
+#define NO_FRAME 0xFFFFFFFF
+#define NOT_FREE 0xFF
+
+#define FRAME_CACHE_ORDERS 5
+#define FRAME_CACHE_PAGES 32
+#define cache_capacity(order) ((FRAME_CACHE_PAGES >> (order)) < 2 ? 2 : (FRAME_CACHE_PAGES >> (order)))
+
+typedef struct frame_link frame_link;
+
+struct frame_link
+{
+  unsigned int next;
+  unsigned int prev;
+};
+
+static frame_link* frame_links;
+static unsigned char* frame_orders;
+static unsigned int* frame_bitmap;
+static unsigned int* reserved_bitmap;
+
+static unsigned int free_lists[FRAME_MAX_ORDER + 1];
+static unsigned int free_orders = 0;
+
+static unsigned int frame_count = 0;
+static unsigned int free_frame_count = 0;
+
+static unsigned long meta_begin = 0, meta_end = 0;
+
+typedef struct frame_cache frame_cache;
+
+struct frame_cache
+{
+  unsigned int count[FRAME_CACHE_ORDERS];
+  unsigned int frames[FRAME_CACHE_ORDERS][FRAME_CACHE_PAGES];
+};
+
+static frame_cache frame_caches[MAX_CPUS];
+
+static stat_counter frame_cache_hits = STAT_COUNTER("frame cache hits");
+static stat_counter frame_cache_misses = STAT_COUNTER("frame cache misses");
+static stat_counter frame_cache_drains = STAT_COUNTER("frame cache drains");
+static stat_counter frame_lock_contention = STAT_COUNTER("frame lock contention");
+
+static spinlock frame_lock = SPINLOCK_INIT(&frame_lock_contention);
+
+static inline unsigned int order_of(unsigned int num_pages)
+{
+  if(num_pages <= 1)
+    return 0;
+  return 32 - __builtin_clz(num_pages - 1);
+}
+
+static void push_block(unsigned int frame, unsigned int order)
+{
+  frame_links[frame].prev = NO_FRAME;
+  frame_links[frame].next = free_lists[order];
+  if(free_lists[order] != NO_FRAME)
+    frame_links[free_lists[order]].prev = frame;
+  free_lists[order] = frame;
+  frame_orders[frame] = order;
+  free_orders |= (1u << order);
+}
+
+static void remove_block(unsigned int frame, unsigned int order)
+{
+  frame_link* link = &frame_links[frame];
+
+  if(link->prev != NO_FRAME)
+    frame_links[link->prev].next = link->next;
+  else
+    free_lists[order] = link->next;
+
+  if(link->next != NO_FRAME)
+    frame_links[link->next].prev = link->prev;
+
+  frame_orders[frame] = NOT_FREE;
+  if(free_lists[order] == NO_FRAME)
+    free_orders &= ~(1u << order);
+}
+
+static void mark_bits(unsigned int* bitmap, unsigned int first, unsigned int count, bool set)
+{
+  while(count) {
+    unsigned int bit = first & 31;
+    unsigned int bits = (32 - bit < count) ? 32 - bit : count;
+    unsigned int mask = (bits == 32) ? 0xFFFFFFFF : (((1u << bits) - 1) << bit);
+
+    if(set)
+      __sync_fetch_and_or(&bitmap[first >> 5], mask);
+    else
+      __sync_fetch_and_and(&bitmap[first >> 5], ~mask);
+
+    first += bits;
+    count -= bits;
+  }
+}
+
+static inline void mark_frames(unsigned int first, unsigned int count, bool used)
+{
+  mark_bits(frame_bitmap, first, count, used);
+}
+
+/* Clears the bits of frames being freed, failing without changing any
+ * if one of them is not allocated or is reserved. Each word is checked and cleared by a
+ * single compare-and-swap, so of two racing frees of the same frames
+ * exactly one succeeds, and the magazine path needs no lock to validate.
+ * A run spanning several words puts back what it cleared on failure.
+ */
+static bool release_frames(unsigned int first, unsigned int count)
+{
+  unsigned int start = first, done = 0;
+
+  while(done < count) {
+    unsigned int bit = first & 31;
+    unsigned int bits = (32 - bit < count - done) ? 32 - bit : count - done;
+    unsigned int mask = (bits == 32) ? 0xFFFFFFFF : (((1u << bits) - 1) << bit);
+    volatile unsigned int* word = &frame_bitmap[first >> 5];
+    unsigned int old;
+
+    do {
+      old = *word;
+      if((old & mask) != mask || (reserved_bitmap[first >> 5] & mask)) {
+	mark_frames(start, done, true);
+	return false;
+      }
+    } while(!__sync_bool_compare_and_swap(word, old, old & ~mask));
+
+    first += bits;
+    done += bits;
+  }
+
+  return true;
+}
+
+static void free_block(unsigned int frame, unsigned int order)
+{
+  while(order < FRAME_MAX_ORDER) {
+    unsigned int buddy = frame ^ (1u << order);
+    if(buddy + (1u << order) > frame_count || frame_orders[buddy] != order)
+      break;
+    remove_block(buddy, order);
+    frame &= ~(1u << order);
+    ++order;
+  }
+  push_block(frame, order);
+}
+
+static void free_range(unsigned int first, unsigned int last)
+{
+  mark_frames(first, last - first, false);
+  free_frame_count += last - first;
+
+  while(first < last) {
+    unsigned int order = first ? (unsigned int)__builtin_ctz(first) : FRAME_MAX_ORDER;
+    if(order > FRAME_MAX_ORDER)
+      order = FRAME_MAX_ORDER;
+    while((1u << order) > last - first)
+      --order;
+    free_block(first, order);
+    first += (1u << order);
+  }
+}
+
+static void take_frame(unsigned int frame)
+{
+  for(unsigned int order = 0; order <= FRAME_MAX_ORDER; ++order) {
+    unsigned int head = frame & ~((1u << order) - 1);
+    if(frame_orders[head] == order) {
+      remove_block(head, order);
+      free_frame_count -= (1u << order);
+      if(head < frame)
+	free_range(head, frame);
+      if(frame + 1 < head + (1u << order))
+	free_range(frame + 1, head + (1u << order));
+      mark_frames(frame, 1, true);
+      return;
+    }
+  }
+}
+
+static bool usable_region(memory_map_t* mmap, unsigned int* begin_frame, unsigned int* end_frame)
+{
+  if(mmap->type != 1 || mmap->base_addr_high != 0)
+    return false;
+
+  unsigned long begin_addr = mmap->base_addr_low;
+  unsigned long end_addr;
+
+  if(mmap->length_high != 0
+     || __builtin_uaddl_overflow(mmap->base_addr_low, mmap->length_low, &end_addr))
+    {
+      end_addr = 0xFFFFFFFF;
+    }
+
+  *begin_frame = (begin_addr >> 12) + ((begin_addr & 0xFFF)?1:0);
+  *end_frame = end_addr >> 12;
+
+  return *begin_frame < *end_frame;
+}
+
+static unsigned long boot_data_end(multiboot_info_t* multi_data)
+{
+  unsigned long highest = end;
+
+  if(multi_data->flags & MULTIBOOT_MODS) {
+    module_t* mods = (module_t*)multi_data->mods_addr;
+    for(unsigned long i = 0; i < multi_data->mods_count; ++i) {
+      if(mods[i].mod_end > highest)
+	highest = mods[i].mod_end;
+      if(mods[i].string && mods[i].string + strlen((char*)mods[i].string) + 1 > highest)
+	highest = mods[i].string + strlen((char*)mods[i].string) + 1;
+    }
+  }
+
+  if(multi_data->mmap_addr + multi_data->mmap_length > highest)
+    highest = multi_data->mmap_addr + multi_data->mmap_length;
+
+  return highest;
+}
+
+static void reserve_boot_data(multiboot_info_t* multi_data)
+{
+  frame_reserve((unsigned long)multi_data, (unsigned long)multi_data + sizeof(multiboot_info_t));
+  frame_reserve(multi_data->mmap_addr, multi_data->mmap_addr + multi_data->mmap_length);
+
+  if(multi_data->flags & MULTIBOOT_MODS) {
+    module_t* mods = (module_t*)multi_data->mods_addr;
+    frame_reserve(multi_data->mods_addr, multi_data->mods_addr + multi_data->mods_count * sizeof(module_t));
+    for(unsigned long i = 0; i < multi_data->mods_count; ++i) {
+      frame_reserve(mods[i].mod_start, mods[i].mod_end);
+      // The module loader still reads the command lines once paging is on.
+      if(mods[i].string)
+	frame_reserve(mods[i].string, mods[i].string + strlen((char*)mods[i].string) + 1);
+    }
+  }
+}
+
+bool init_frames(multiboot_info_t* multi_data)
+{
+  if(!(multi_data->flags & MULTIBOOT_MMAP)) {
+    print("Error: Multiboot data does not contain memory map.\n");
+    return false;
+  }
+
+  char* mmap_base_addr = (char*)multi_data->mmap_addr;
+  unsigned long mmap_length = multi_data->mmap_length;
+  memory_map_t* mmap_curr;
+  unsigned int begin_frame, end_frame;
+
+  for(char* mmap_curr_addr = mmap_base_addr;
+      ((unsigned long)(mmap_curr_addr - mmap_base_addr)) < mmap_length;
+      mmap_curr_addr += (mmap_curr->size + sizeof(unsigned long))) {
+    mmap_curr = (memory_map_t*)mmap_curr_addr;
+    if(usable_region(mmap_curr, &begin_frame, &end_frame) && end_frame > frame_count)
+      frame_count = end_frame;
+  }
+
+  if(!frame_count) {
+    print("Error: Memory map contains no usable memory.\n");
+    return false;
+  }
+
+  unsigned long links_size = frame_count * sizeof(frame_link);
+  unsigned long bitmap_size = ((frame_count + 31) / 32) * sizeof(unsigned int);
+  unsigned long meta_pages = (links_size + 2 * bitmap_size + frame_count + 0xFFF) >> 12;
+  unsigned long floor = boot_data_end(multi_data);
+  unsigned long floor_frame = (floor >> 12) + ((floor & 0xFFF)?1:0);
+
+  for(char* mmap_curr_addr = mmap_base_addr;
+      !meta_end && ((unsigned long)(mmap_curr_addr - mmap_base_addr)) < mmap_length;
+      mmap_curr_addr += (mmap_curr->size + sizeof(unsigned long))) {
+    mmap_curr = (memory_map_t*)mmap_curr_addr;
+    if(!usable_region(mmap_curr, &begin_frame, &end_frame))
+      continue;
+    if(begin_frame < floor_frame)
+      begin_frame = floor_frame;
+    if(begin_frame < end_frame && end_frame - begin_frame >= meta_pages) {
+      meta_begin = (unsigned long)begin_frame << 12;
+      meta_end = meta_begin + (meta_pages << 12);
+    }
+  }
+
+  if(!meta_end) {
+    print("Error: No room for the page frame tables.\n");
+    return false;
+  }
+
+  frame_links = (frame_link*)meta_begin;
+  frame_bitmap = (unsigned int*)(meta_begin + links_size);
+  reserved_bitmap = (unsigned int*)(meta_begin + links_size + bitmap_size);
+  frame_orders = (unsigned char*)(meta_begin + links_size + 2 * bitmap_size);
+
+  memset(frame_bitmap, 0xFF, bitmap_size);
+  memset(reserved_bitmap, 0xFF, bitmap_size);
+  memset(frame_orders, NOT_FREE, frame_count);
+  for(unsigned int i = 0; i <= FRAME_MAX_ORDER; ++i)
+    free_lists[i] = NO_FRAME;
+
+  for(char* mmap_curr_addr = mmap_base_addr;
+      ((unsigned long)(mmap_curr_addr - mmap_base_addr)) < mmap_length;
+      mmap_curr_addr += (mmap_curr->size + sizeof(unsigned long))) {
+    mmap_curr = (memory_map_t*)mmap_curr_addr;
+    if(usable_region(mmap_curr, &begin_frame, &end_frame)) {
+      mark_bits(reserved_bitmap, begin_frame, end_frame - begin_frame, false);
+      free_range(begin_frame, end_frame);
+    }
+  }
+
+  frame_reserve(0, FRAME_SIZE);
+  frame_reserve(begin, end);
+  frame_reserve(meta_begin, meta_end);
+  frame_reserve(0xb8000, 0xb8000 + FRAME_SIZE);
+  reserve_boot_data(multi_data);
+
+  install_stat(&frame_cache_hits);
+  install_stat(&frame_cache_misses);
+  install_stat(&frame_cache_drains);
+  install_stat(&frame_lock_contention);
+
+  print("- Page frame allocator initialised, %u of %u pages free.\n", free_frame_count, frame_count);
+
+  return true;
+}
+
+void frame_metadata(unsigned long* begin_addr, unsigned long* end_addr)
+{
+  *begin_addr = meta_begin;
+  *end_addr = meta_end;
+  return;
+}
+
+static unsigned int buddy_alloc(unsigned int order)
+{
+  unsigned int available = free_orders & ~((1u << order) - 1);
+  if(!available)
+    return NO_FRAME;
+
+  unsigned int curr = __builtin_ctz(available);
+  unsigned int frame = free_lists[curr];
+  remove_block(frame, curr);
+
+  while(curr > order) {
+    --curr;
+    push_block(frame + (1u << curr), curr);
+  }
+
+  free_frame_count -= (1u << order);
+
+  return frame;
+}
+
+static void buddy_free(unsigned int frame, unsigned int order)
+{
+  free_frame_count += (1u << order);
+  free_block(frame, order);
+}
+
+static void drain_cache(frame_cache* cache, unsigned int order, unsigned int keep)
+{
+  stat_inc(&frame_cache_drains);
+  spin_lock(&frame_lock);
+  while(cache->count[order] > keep)
+    buddy_free(cache->frames[order][--cache->count[order]], order);
+  spin_unlock(&frame_lock);
+}
+
+static unsigned int cache_pop(unsigned int order)
+{
+  unsigned int flags = irq_save();
+  frame_cache* cache = &frame_caches[cpu_id()];
+  unsigned int frame;
+
+  if(cache->count[order]) {
+    stat_inc(&frame_cache_hits);
+  } else {
+    stat_inc(&frame_cache_misses);
+    spin_lock(&frame_lock);
+    while(cache->count[order] < cache_capacity(order) / 2
+	  && (frame = buddy_alloc(order)) != NO_FRAME)
+      cache->frames[order][cache->count[order]++] = frame;
+    spin_unlock(&frame_lock);
+
+    if(!cache->count[order]) {
+      for(unsigned int i = 0; i < FRAME_CACHE_ORDERS; ++i)
+	if(cache->count[i])
+	  drain_cache(cache, i, 0);
+
+      spin_lock(&frame_lock);
+      frame = buddy_alloc(order);
+      spin_unlock(&frame_lock);
+
+      irq_restore(flags);
+      return frame;
+    }
+  }
+
+  frame = cache->frames[order][--cache->count[order]];
+  irq_restore(flags);
+
+  return frame;
+}
+
+static void cache_push(unsigned int frame, unsigned int order)
+{
+  unsigned int flags = irq_save();
+  frame_cache* cache = &frame_caches[cpu_id()];
+
+  if(cache->count[order] == cache_capacity(order))
+    drain_cache(cache, order, cache_capacity(order) / 2);
+
+  cache->frames[order][cache->count[order]++] = frame;
+  irq_restore(flags);
+}
+
+unsigned long frame_alloc(unsigned int order)
+{
+  unsigned int frame;
+
+  if(order > FRAME_MAX_ORDER)
+    return 0;
+
+  if(order < FRAME_CACHE_ORDERS) {
+    frame = cache_pop(order);
+  } else {
+    unsigned int flags = spin_lock_irqsave(&frame_lock);
+    frame = buddy_alloc(order);
+    spin_unlock_irqrestore(&frame_lock, flags);
+  }
+
+  if(frame == NO_FRAME)
+    return 0;
+
+  mark_frames(frame, 1u << order, true);
+
+  return (unsigned long)frame << 12;
+}
+
+bool frame_free(unsigned long frame_address, unsigned int order)
+{
+  unsigned int frame = frame_address >> 12;
+
+  if(order > FRAME_MAX_ORDER
+     || (frame_address & 0xFFF)
+     || (frame & ((1u << order) - 1))
+     || frame + (1u << order) > frame_count
+     || !release_frames(frame, 1u << order))
+    return false;
+
+  if(order < FRAME_CACHE_ORDERS) {
+    cache_push(frame, order);
+  } else {
+    unsigned int flags = spin_lock_irqsave(&frame_lock);
+    buddy_free(frame, order);
+    spin_unlock_irqrestore(&frame_lock, flags);
+  }
+
+  return true;
+}
+
+unsigned long frame_alloc_pages(int num_pages)
+{
+  if(num_pages <= 0)
+    return 0;
+
+  unsigned int order = order_of(num_pages);
+
+  if((1u << order) == (unsigned int)num_pages)
+    return frame_alloc(order);
+
+  unsigned int flags = spin_lock_irqsave(&frame_lock);
+  unsigned int frame = buddy_alloc(order);
+
+  if(frame != NO_FRAME) {
+    mark_frames(frame, num_pages, true);
+    free_range(frame + num_pages, frame + (1u << order));
+  }
+  spin_unlock_irqrestore(&frame_lock, flags);
+
+  if(frame == NO_FRAME)
+    return 0;
+
+  return (unsigned long)frame << 12;
+}
+
+bool frame_free_pages(unsigned long frame_address, int num_pages)
+{
+  unsigned int frame = frame_address >> 12;
+
+  if(num_pages <= 0)
+    return false;
+
+  unsigned int order = order_of(num_pages);
+
+  if((1u << order) == (unsigned int)num_pages && !(frame & ((1u << order) - 1)))
+    return frame_free(frame_address, order);
+
+  if((frame_address & 0xFFF)
+     || frame + num_pages > frame_count
+     || !release_frames(frame, num_pages))
+    return false;
+
+  unsigned int flags = spin_lock_irqsave(&frame_lock);
+  free_range(frame, frame + num_pages);
+  spin_unlock_irqrestore(&frame_lock, flags);
+
+  return true;
+}
+
+// Whether every frame of the run was handed out and may be freed.
+bool frames_allocated(unsigned long frame_address, int num_pages)
+{
+  unsigned int frame = frame_address >> 12;
+
+  if(num_pages <= 0 || (frame_address & 0xFFF) || frame + num_pages > frame_count)
+    return false;
+
+  for(unsigned int i = frame; i < frame + num_pages; ++i)
+    if(!(frame_bitmap[i >> 5] & (1u << (i & 31))) || (reserved_bitmap[i >> 5] & (1u << (i & 31))))
+      return false;
+
+  return true;
+}
+
+void frame_reserve(unsigned long begin_addr, unsigned long end_addr)
+{
+  unsigned int first = begin_addr >> 12;
+  unsigned int last = (end_addr >> 12) + ((end_addr & 0xFFF)?1:0);
+
+  if(last > frame_count)
+    last = frame_count;
+
+  unsigned int flags = spin_lock_irqsave(&frame_lock);
+  for(unsigned int frame = first; frame < last; ++frame)
+    if(!(frame_bitmap[frame >> 5] & (1u << (frame & 31)))) {
+      take_frame(frame);
+      mark_bits(reserved_bitmap, frame, 1, true);
+    }
+  spin_unlock_irqrestore(&frame_lock, flags);
+
+  return;
+}
+
+unsigned int frames_free()
+{
+  return free_frame_count;
+}
+
+unsigned int frames_total()
+{
+  return frame_count;
+}
@@ -0,0 +1,64 @@
+#include <sched.h>
+#include <spinlock.h>
+#include <stdbool.h>
+#include <system.h>
+#include <futex.h>
+
+/* Futex-style waiting on a word in memory.
+ *
+ * Waiters are kept on one of FUTEX_BUCKETS wait queues, chosen by hashing
+ * the word's address, and tagged with that address so a wake only picks
+ * out the waiters on its own word. The value is compared under the bucket
+ * lock, which sleep_on_key() only drops once the waiter is queued, so a
+ * store followed by futex_wake() on another processor cannot be missed.
+ * All zero is a valid unlocked bucket, so the table needs no set-up.
+ *
+ * The idle threads cannot block, nor can anything before the scheduler
+ * runs, so there futex_wait() returns at once and the caller, which has
+ * to recheck the word anyway, ends up spinning.
+ */
+
+typedef struct futex_bucket futex_bucket;
+
+struct futex_bucket
+{
+  spinlock lock;
+  wait_queue queue;
+};
+
+static futex_bucket buckets[FUTEX_BUCKETS];
+
+static futex_bucket* bucket_of(volatile unsigned int* addr)
+{
+  return &buckets[((unsigned long)addr >> 2) % FUTEX_BUCKETS];
+}
+
+// Sleeps while *addr is expected, returning false if it already was not
+// or if the current context cannot sleep.
+bool futex_wait(volatile unsigned int* addr, unsigned int expected)
+{
+  futex_bucket* b = bucket_of(addr);
+
+  unsigned int flags = spin_lock_irqsave(&b->lock);
+  if(*addr != expected)
+    {
+      spin_unlock_irqrestore(&b->lock, flags);
+      return false;
+    }
+
+  bool slept = sleep_on_key(&b->queue, &b->lock, (unsigned long)addr);
+  irq_restore(flags);
+
+  return slept;
+}
+
+unsigned int futex_wake(volatile unsigned int* addr, unsigned int count)
+{
+  futex_bucket* b = bucket_of(addr);
+
+  unsigned int flags = spin_lock_irqsave(&b->lock);
+  unsigned int woken = wake_up_key(&b->queue, (unsigned long)addr, count);
+  spin_unlock_irqrestore(&b->lock, flags);
+
+  return woken;
+}
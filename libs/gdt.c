@@ -30,6 +30,28 @@ bool add_gdt_entry(unsigned int base, unsigned int limit, segment t)
   return true;
 }
 
+// Appends a descriptor with explicit access and flag bytes, for TSSs and
+// per-CPU segments, and returns its selector or 0 if the GDT is full.
+unsigned short add_gdt_system_entry(unsigned int base, unsigned int limit, unsigned char access, unsigned char flags)
+{
+  unsigned int index = (gdt_desc.size + 1)/8;
+
+  if(limit >= 1048576 || index >= 8192)
+    return 0;
+
+  gdt_entry* curr = &table[index];
+  curr->limit_b = (unsigned short)(limit & 0x0000FFFF);
+  curr->base_b = (unsigned short)(base & 0x0000FFFF);
+  curr->base_tb = (unsigned char)((base & 0x00FF0000) >> 16);
+  curr->access = access;
+  curr->flags_limt = (flags & 0xF0) | ((0xF0000 & limit) >> 16);
+  curr->base_tt = (unsigned char)((base & 0xFF000000) >> 24);
+
+  gdt_desc.size += 8;
+
+  return index * 8;
+}
+
 void lgdt()
 {
   __asm__ __volatile__ ("lgdt (%0)"::"g"(gdt_desc));
@@ -0,0 +1,49 @@
+#include <stdbool.h>
+#include <stdsymbols.h>
+#include <system.h>
+#include <idle.h>
+
+#define MAX_IDLE_HANDLERS 8
+
+bool (*idle_routines[MAX_IDLE_HANDLERS])() = {[0 ... (MAX_IDLE_HANDLERS - 1)] = NULL};
+
+bool install_idle_handler(bool (*handler)())
+{
+  for(int i = 0; i < MAX_IDLE_HANDLERS; i++)
+    if(!idle_routines[i])
+      {
+	idle_routines[i] = handler;
+	return true;
+      }
+
+  return false;
+}
+
+bool uninstall_idle_handler(bool (*handler)())
+{
+  for(int i = 0; i < MAX_IDLE_HANDLERS; i++)
+    if(idle_routines[i] == handler)
+      {
+	idle_routines[i] = NULL;
+	return true;
+      }
+
+  return false;
+}
+
+void idle()
+{
+  while(true)
+    {
+      // Handlers return true while they still have background work, in
+      // which case we go round again instead of halting.
+      bool busy = false;
+
+      for(int i = 0; i < MAX_IDLE_HANDLERS; i++)
+	if(idle_routines[i] && idle_routines[i]())
+	  busy = true;
+
+      if(!busy)
+	__asm__ __volatile__ ("sti\n hlt");
+    }
+}
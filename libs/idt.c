@@ -27,6 +27,14 @@ void install_kint(unsigned char no, unsigned int offset, unsigned short selector
   return;
 }
 
+// Same as install_kint, but the gate may also be raised from ring 3.
+void install_uint(unsigned char no, unsigned int offset, unsigned short selector)
+{
+  install_kint(no, offset, selector);
+  IDT[no].attr = 0xEE;
+  return;
+}
+
 void lidt()
 {
   __asm__ __volatile__ ("lidt (%0)" :: "m" (idt_desc));
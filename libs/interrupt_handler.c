@@ -1,13 +1,23 @@
+#include <cpu.h>
 #include <idt.h>
 #include <interrupt_stubs.h>
+#include <irq.h>
 #include <pic.h>
 #include <regs.h>
+#include <sched.h>
+#include <stats.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <system.h>
 #include <interrupt_handler.h>
 
 void *int_routines[256] = {[0 ... 255] = 0};
 
+bool irq_tsc_enabled = false;
+
+stat_counter irq_dispatches = STAT_COUNTER("irq dispatches");
+stat_counter irq_entry_cycles = STAT_COUNTER("irq entry to handler cycles");
+
 char* exceptions[32] = {
   "Division By Zero Exception\n",
   "Debug Exception\n",
@@ -303,26 +313,31 @@ void install_ints()
   install_kint(254, (unsigned int)int254, 0x08);
   install_kint(255, (unsigned int)int255, 0x08);
   lidt();
+
+  irq_tsc_enabled = cpu_has(CPU_FEATURE_TSC);
+  install_stat(&irq_dispatches);
+  install_stat(&irq_entry_cycles);
   return;
 }
 
-void int_handler(regs* r)
+regs* int_handler(regs* r)
 {
-  
+
   void (*handler)(regs *r);
   handler = int_routines[r->int_no];
 
   if(r->int_no < 32)
     {
 
-      print("\n%s", exceptions[r->int_no]);
-      print("eip: %h\n", r->eip);
-
+      // Registered handlers deal with the exception themselves, page
+      // faults in particular are routine.
       if(handler)
 	handler(r);
 
       else
 	{
+	  print("\n%s", exceptions[r->int_no]);
+	  print("eip: %h\n", r->eip);
 	  print("System Halting!!!\n");
 	  kill();
 	}
@@ -335,10 +350,7 @@ void int_handler(regs* r)
       if(handler)
 	handler(r);
       
-      if(r->int_no >= 40)
-	outb(0xA0, 0x20);
-      
-      outb(0x20, 0x20);
+      irq_eoi(r->int_no - PIC_BASE);
 
     }
 
@@ -353,5 +365,23 @@ void int_handler(regs* r)
 	}
     }
 
-  return;
+  return sched_switch(r);
+}
+
+// Entered from irq_common for hardware IRQs raised in ring 0. entry_tsc is
+// the low half of the TSC read right after the registers were saved.
+regs* irq_dispatch(regs* r, unsigned int entry_tsc)
+{
+  void (*handler)(regs *r) = int_routines[r->int_no];
+
+  if(irq_tsc_enabled)
+    stat_add(&irq_entry_cycles, (unsigned int)rdtsc() - entry_tsc);
+  stat_inc(&irq_dispatches);
+
+  if(handler)
+    handler(r);
+
+  irq_eoi(r->int_no - PIC_BASE);
+
+  return sched_switch(r);
 }
@@ -256,8 +256,13 @@ global int252
 global int253
 global int254
 global int255
+global load_cpu_gs
 	
 extern int_handler
+extern irq_dispatch
+extern irq_tsc_enabled
+extern sched_finish
+extern table
 
 section .text
 	
@@ -451,97 +456,97 @@ int32:
         cli
         push dword 0
         push dword 32
-        jmp int_common
+        jmp irq_common
 
 int33:
         cli
         push dword 0
         push dword 33
-        jmp int_common
+        jmp irq_common
 
 int34:
         cli
         push dword 0
         push dword 34
-        jmp int_common
+        jmp irq_common
 
 int35:
         cli
         push dword 0
         push dword 35
-        jmp int_common
+        jmp irq_common
 
 int36:
         cli
         push dword 0
         push dword 36
-        jmp int_common
+        jmp irq_common
 
 int37:
         cli
         push dword 0
         push dword 37
-        jmp int_common
+        jmp irq_common
 
 int38:
         cli
         push dword 0
         push dword 38
-        jmp int_common
+        jmp irq_common
 
 int39:
         cli
         push dword 0
         push dword 39
-        jmp int_common
+        jmp irq_common
 
 int40:
         cli
         push dword 0
         push dword 40
-        jmp int_common
+        jmp irq_common
 
 int41:
         cli
         push dword 0
         push dword 41
-        jmp int_common
+        jmp irq_common
 
 int42:
         cli
         push dword 0
         push dword 42
-        jmp int_common
+        jmp irq_common
 
 int43:
         cli
         push dword 0
         push dword 43
-        jmp int_common
+        jmp irq_common
 
 int44:
         cli
         push dword 0
         push dword 44
-        jmp int_common
+        jmp irq_common
 
 int45:
         cli
         push dword 0
         push dword 45
-        jmp int_common
+        jmp irq_common
 
 int46:
         cli
         push dword 0
         push dword 46
-        jmp int_common
+        jmp irq_common
 
 int47:
         cli
         push dword 0
         push dword 47
-        jmp int_common
+        jmp irq_common
 
 int48:
         cli
@@ -1793,19 +1798,29 @@ int255:
 	
 	
 int_common:
+	cld
 	pusha
 	push ds
 	push es
 	push fs
 	push gs
+int_reload:
 	mov ax, 0x10
 	mov ds, ax
 	mov es, ax
 	mov fs, ax
-	mov gs, ax
+	; In ring 0 gs already holds the per-CPU data segment. From ring 3 it
+	; holds the user's, which the frame keeps for the way back.
+	test byte [esp + 60], 3
+	jz .kernel_gs
+	call load_cpu_gs
+.kernel_gs:
 	push esp
 	call int_handler
-	pop esp
+	; int_handler returns the frame to resume, which may be another thread's.
+	mov esp, eax
+	call sched_finish
+int_return:
 	pop gs
 	pop fs
 	pop es
@@ -1813,3 +1828,44 @@ int_common:
 	popa
 	add esp, 8
 	iret
+
+; Hardware IRQs skip the segment reloads and int_handler's checks, which
+; only matter for exceptions and for entries from ring 3. An IRQ taken in
+; ring 3 still goes the long way. Both clear DF, which the C code assumes
+; and which may be set wherever the interrupt landed.
+irq_common:
+	cld
+	pusha
+	push ds
+	push es
+	push fs
+	push gs
+	test byte [esp + 60], 3
+	jnz int_reload
+	xor eax, eax
+	cmp byte [irq_tsc_enabled], 0
+	je .dispatch
+	rdtsc
+.dispatch:
+	mov ecx, esp
+	push eax
+	push ecx
+	call irq_dispatch
+	mov esp, eax
+	call sched_finish
+	jmp int_return
+
+; Loads this processor's data segment into gs on entries from ring 3. The
+; TSS is the one per-CPU structure the processor itself switched to: str
+; names its descriptor, and setup_cpu_data leaves the selector in the
+; TSS's gs field, unused without hardware task switching. Needs the
+; kernel's ds and clobbers eax and ecx.
+load_cpu_gs:
+	xor eax, eax
+	str ax
+	mov ch, [table + eax + 7]
+	mov cl, [table + eax + 4]
+	shl ecx, 16
+	mov cx, [table + eax + 2]
+	mov gs, [ecx + 0x5C]
+	ret
@@ -1,3 +1,4 @@
+#include <apic.h>
 #include <interrupt_handler.h>
 #include <pic.h>
 #include <regs.h>
@@ -27,3 +28,33 @@ bool uninstall_irq_handler(unsigned char int_no)
   return true;
 }
 
+
+void irq_unmask(unsigned char irq)
+{
+  if(apic_enabled)
+    ioapic_unmask(irq);
+  else
+    pic_unmask(irq);
+
+  return;
+}
+
+void irq_mask(unsigned char irq)
+{
+  if(apic_enabled)
+    ioapic_mask(irq);
+  else
+    pic_mask(irq);
+
+  return;
+}
+
+void irq_eoi(unsigned char irq)
+{
+  if(apic_enabled)
+    lapic_eoi();
+  else
+    pic_eoi(irq);
+
+  return;
+}
@@ -0,0 +1,80 @@
+#include <linker_symbols.h>
+#include <stdsymbols.h>
+#include <string.h>
+#include <ksyms.h>
+
+/* Kernel symbol table.
+ *
+ * The table is generated from the first link of kernel.bin by ksyms.awk
+ * and linked in on the second pass. It lives in .ksyms, after everything
+ * else, so adding it moves no other symbol. The first pass links without
+ * it, and the weak references below then resolve to 0.
+ */
+
+extern const ksym ksyms_table[] __attribute__ ((weak));
+extern const char ksyms_names[] __attribute__ ((weak));
+extern const unsigned int ksyms_table_count __attribute__ ((weak));
+
+unsigned int ksym_count()
+{
+  return &ksyms_table_count ? ksyms_table_count : 0;
+}
+
+// Returns the index of the symbol containing address, or -1.
+int ksym_find(unsigned long address)
+{
+  unsigned int count = ksym_count();
+
+  if(!count || address < ksyms_table[0].address || address >= end)
+    return -1;
+
+  unsigned int low = 0, high = count;
+  while(high - low > 1)
+    {
+      unsigned int mid = (low + high) / 2;
+      if(ksyms_table[mid].address <= address)
+	low = mid;
+      else
+	high = mid;
+    }
+
+  return (int)low;
+}
+
+const char* ksym_name(unsigned int index)
+{
+  return index < ksym_count() ? &ksyms_names[ksyms_table[index].name] : NULL;
+}
+
+unsigned long ksym_address(unsigned int index)
+{
+  return index < ksym_count() ? ksyms_table[index].address : 0;
+}
+
+const char* ksym_lookup(unsigned long address, unsigned long* offset)
+{
+  int index = ksym_find(address);
+
+  if(index < 0)
+    return NULL;
+
+  if(offset)
+    *offset = address - ksyms_table[index].address;
+
+  return ksym_name(index);
+}
+
+// Returns the address of the global kernel symbol called name, or 0.
+// Statics may share a name with each other or with a global, so they are
+// never resolved. The table is sorted by address, so this is a linear
+// scan, fine for module loading.
+unsigned long ksym_resolve(const char* name)
+{
+  unsigned int count = ksym_count();
+
+  for(unsigned int i = 0; i < count; i++)
+    if(ksyms_table[i].global && !strcmp(&ksyms_names[ksyms_table[i].name], name))
+      return ksyms_table[i].address;
+
+  return 0;
+}
@@ -1,4 +1,5 @@
 #include <liballoc.h>
+#include <string.h>
 
 /**  Durand's Ridiculously Amazing Super Duper Memory functions.  */
 
@@ -33,6 +34,12 @@ static int l_initialized = 0;			//< Flag to indicate initialization.
 static int l_pageSize  = 4096;			//< Individual page size
 static int l_pageCount = 16;			//< Minimum number of pages to allocate.
 
+#ifdef SELFTEST
+int l_smallClasses = 1;				//< Cleared to time the boundary tags alone.
+#else
+#define l_smallClasses 1
+#endif
+
 
 // ***********   HELPER FUNCTIONS  *******************************
 
@@ -50,58 +57,16 @@ static inline int getexp( unsigned int size )
 		return -1;	// Smaller than the quantum.
 	}
 		
-		
-	int shift = MINEXP;
-
-	while ( shift < MAXEXP )
-	{
-		if ( (1<<shift) > size ) break;
-		shift += 1;
-	}
+	// Index of the highest set bit (bsr).
+	int shift = 31 - __builtin_clz( size );
 
 	#ifdef DEBUG
-	printf("getexp returns %i (%i bytes) for %i size\n", shift - 1, (1<<(shift -1)), size );
+	printf("getexp returns %i (%i bytes) for %i size\n", shift, (1<<shift), size );
 	#endif
 
-	return shift - 1;	
-}
-
-
-static void* 	liballoc_memset(void* s, int c, size_t n)
-{
-	int i;
-	for ( i = 0; i < n ; i++)
-		((char*)s)[i] = c;
-	
-	return s;
-}
-
-static void* 	liballoc_memcpy(void* s1, const void* s2, size_t n)
-{
-  char *cdest;
-  char *csrc;
-  unsigned int *ldest = (unsigned int*)s1;
-  unsigned int *lsrc  = (unsigned int*)s2;
-
-  while ( n >= sizeof(unsigned int) )
-  {
-      *ldest++ = *lsrc++;
-	  n -= sizeof(unsigned int);
-  }
-
-  cdest = (char*)ldest;
-  csrc  = (char*)lsrc;
-  
-  while ( n > 0 )
-  {
-      *cdest++ = *csrc++;
-	  n -= 1;
-  }
-  
-  return s1;
+	return shift;	
 }
 
- 
 
 #ifdef DEBUG
 static void dump_array()
@@ -233,7 +198,7 @@ static inline struct boundary_tag* split_tag( struct boundary_tag* tag )
 
 int test = 0;
 
-static struct boundary_tag* allocate_new_tag( unsigned int size )
+static struct boundary_tag* allocate_new_tag( unsigned int size, int zeroed )
 {
   int x = test;
   unsigned int pages;
@@ -250,7 +215,10 @@ static struct boundary_tag* allocate_new_tag( unsigned int size )
   // Make sure it's >= the minimum size.
   if ( pages < l_pageCount ) pages = l_pageCount;
 	
-  tag = (struct boundary_tag*)liballoc_alloc( pages );
+  if ( zeroed )
+    tag = (struct boundary_tag*)liballoc_alloc_zeroed( pages );
+  else
+    tag = (struct boundary_tag*)liballoc_alloc( pages );
 	
   if ( tag == NULL ) return NULL;	// uh oh, we ran out of memory.
 		
@@ -278,12 +246,18 @@ static struct boundary_tag* allocate_new_tag( unsigned int size )
 
 
 
-void *malloc(size_t size)
+static void *l_malloc(size_t size, int zeroed)
 {
 	int index;
 	void *ptr;
 	struct boundary_tag *tag = NULL;
 
+	// Small sizes come from the exact-fit size classes.
+	if ( l_smallClasses && !zeroed && (size != 0) && (size <= LIBALLOC_SMALL_MAX) )
+	{
+		ptr = liballoc_small_alloc( size );
+		if ( ptr != NULL ) return ptr;
+	}
 	
 	liballoc_lock();
 	
@@ -306,8 +280,8 @@ void *malloc(size_t size)
 	if ( index < MINEXP ) index = MINEXP;
 		
 
-	// Find one big enough.
-	tag = l_freePages[ index ];
+	// Find one big enough. Zeroed requests always take fresh pages.
+	tag = zeroed ? NULL : l_freePages[ index ];
 
 	
 	// Start at the front of the list.
@@ -330,7 +304,7 @@ void *malloc(size_t size)
 	// No page found. Make one.
 	if ( tag == NULL )
 	  {
-	    if ( (tag = allocate_new_tag( size )) == NULL )
+	    if ( (tag = allocate_new_tag( size, zeroed )) == NULL )
 	      {
 		liballoc_unlock();
 		return NULL;
@@ -399,6 +373,13 @@ void *malloc(size_t size)
 
 
 
+void *malloc(size_t size)
+{
+	return l_malloc( size, 0 );
+}
+
+
+
 void free(void *ptr)
 {
 	int index;
@@ -406,6 +387,8 @@ void free(void *ptr)
 
 	if ( ptr == NULL ) return;
 
+	if ( liballoc_small_free( ptr ) == 0 ) return;
+
 	liballoc_lock();
 	
 
@@ -500,10 +483,15 @@ void* calloc(size_t nobj, size_t size)
        void *p;
 
        real_size = nobj * size;
+
+       // Allocations spanning at least a whole refill get their own
+       // pre-zeroed pages, so there is nothing left to clear.
+       if ( real_size + sizeof(struct boundary_tag) >= (unsigned int)(l_pageSize * l_pageCount) )
+	 return l_malloc( real_size, 1 );
        
        p = malloc( real_size );
 
-       liballoc_memset( p, 0, real_size );
+       if ( p != NULL ) memset( p, 0, real_size );
 
        return p;
 }
@@ -523,15 +511,19 @@ void*   realloc(void *p, size_t size)
 	}
 	if ( p == NULL ) return malloc( size );
 
-	if ( liballoc_lock != NULL ) liballoc_lock();		// lockit
-		tag = (struct boundary_tag*)((unsigned int)p - sizeof( struct boundary_tag ));
-		real_size = tag->size;
-	if ( liballoc_unlock != NULL ) liballoc_unlock();
+	real_size = liballoc_small_size( p );
+	if ( real_size == 0 )
+	{
+		if ( liballoc_lock != NULL ) liballoc_lock();		// lockit
+			tag = (struct boundary_tag*)((unsigned int)p - sizeof( struct boundary_tag ));
+			real_size = tag->size;
+		if ( liballoc_unlock != NULL ) liballoc_unlock();
+	}
 
 	if ( real_size > size ) real_size = size;
 
 	ptr = malloc( size );
-	liballoc_memcpy( ptr, p, real_size );
+	memcpy( ptr, p, real_size );
 	free( p );
 
 	return ptr;
@@ -1,4 +1,6 @@
+#include <liballoc.h>
 #include <paging.h>
+#include <slab.h>
 
 int liballoc_lock() {
   lock_allocation();
@@ -14,10 +16,33 @@ void* liballoc_alloc(int num_pages) {
   return (void*)palloc(num_pages);
 }
 
-void* liballoc_free(void* page_address, int num_pages) {
+void* liballoc_alloc_zeroed(int num_pages) {
+  return (void*)palloc_zeroed(num_pages);
+}
+
+int liballoc_free(void* page_address, int num_pages) {
   if(pfree((unsigned long)page_address, num_pages)) {
-    return (void*)0;
+    return 0;
   } else {
-    return (void*)1;
+    return 1;
   }
 }
+
+void* liballoc_small_alloc(size_t size) {
+  return kmem_alloc(size);
+}
+
+size_t liballoc_small_size(void* ptr) {
+  if(get_page_tag((unsigned long)ptr) != PAGE_TAG_SLAB) {
+    return 0;
+  }
+  return kmem_size(ptr);
+}
+
+int liballoc_small_free(void* ptr) {
+  if(get_page_tag((unsigned long)ptr) != PAGE_TAG_SLAB) {
+    return 1;
+  }
+  kmem_free(ptr);
+  return 0;
+}
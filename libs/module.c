@@ -0,0 +1,349 @@
+#include <clock.h>
+#include <elf.h>
+#include <frame.h>
+#include <ksyms.h>
+#include <multiboot.h>
+#include <paging.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdsymbols.h>
+#include <string.h>
+#include <module.h>
+
+/* Boot modules.
+ *
+ * GRUB loads each module line of menu.lst next to the kernel, and
+ * init_frames() keeps those frames out of the allocator, so a module is
+ * only mapped where it already lies, never copied. Raw data is mapped
+ * read-only. Relocatable ELF objects, built with i686-elf-gcc -c
+ * -fno-common, are mapped writable and linked in place: section headers
+ * get the address their section ended up at, uninitialised data gets
+ * zeroed pages, undefined symbols come from the kernel symbol table, and
+ * relocations are applied to the image itself. An object defining
+ * MODULE_ENTRY is run in its own thread by start_modules().
+ */
+
+static boot_module modules[MAX_MODULES];
+static unsigned int modules_loaded = 0;
+
+static bool link_fail(boot_module* m, char* reason)
+{
+  print("- %s: %s, not loaded.\n", m->name, reason);
+  return false;
+}
+
+// Points every section header at its section, allocating the ones not in the file.
+static bool place_sections(boot_module* m, elf_section* sections, unsigned int count)
+{
+  unsigned long bss_size = 0;
+
+  for(unsigned int i = 0; i < count; i++)
+    {
+      elf_section* s = &sections[i];
+
+      if(s->type != ELF_SECTION_NOBITS)
+	{
+	  if(s->offset > m->size || s->size > m->size - s->offset)
+	    return link_fail(m, "section outside the image");
+	  s->addr = m->base + s->offset;
+	}
+      else if(s->flags & ELF_FLAG_ALLOC)
+	{
+	  unsigned long align = s->addralign ? s->addralign : 1;
+	  bss_size = (bss_size + align - 1) & ~(align - 1);
+	  s->addr = bss_size;
+	  bss_size += s->size;
+	}
+    }
+
+  if(!bss_size)
+    return true;
+
+  m->bss_pages = (bss_size + FRAME_SIZE - 1) / FRAME_SIZE;
+  m->bss = palloc_zeroed(m->bss_pages);
+  if(!m->bss)
+    return link_fail(m, "no memory for uninitialised data");
+
+  for(unsigned int i = 0; i < count; i++)
+    if(sections[i].type == ELF_SECTION_NOBITS && (sections[i].flags & ELF_FLAG_ALLOC))
+      sections[i].addr += m->bss;
+
+  return true;
+}
+
+// Rewrites every symbol's value to its final address.
+static bool resolve_symbols(boot_module* m, elf_section* sections, unsigned int count, elf_section* symtab)
+{
+  if(symtab->link >= count)
+    return link_fail(m, "symbol table without names");
+
+  elf_symbol* symbols = (elf_symbol*)symtab->addr;
+  unsigned int symbol_count = symtab->size / sizeof(elf_symbol);
+  elf_section* strtab = &sections[symtab->link];
+  const char* names = (const char*)strtab->addr;
+
+  for(unsigned int i = 1; i < symbol_count; i++)
+    {
+      elf_symbol* sym = &symbols[i];
+
+      if(sym->name >= strtab->size)
+	return link_fail(m, "symbol name outside the string table");
+      const char* name = names + sym->name;
+
+      switch(sym->shndx)
+	{
+	case ELF_SYMBOL_UNDEF:
+	  sym->value = ksym_resolve(name);
+	  if(!sym->value && elf_symbol_bind(sym->info) != ELF_BIND_WEAK)
+	    {
+	      print("- %s: undefined symbol %s, not loaded.\n", m->name, name);
+	      return false;
+	    }
+	  break;
+
+	case ELF_SYMBOL_ABS:
+	  break;
+
+	case ELF_SYMBOL_COMMON:
+	  return link_fail(m, "common symbol, build with -fno-common");
+
+	default:
+	  if(sym->shndx >= count)
+	    return link_fail(m, "symbol in a missing section");
+	  sym->value += sections[sym->shndx].addr;
+	  if(!m->entry && !strcmp(name, MODULE_ENTRY))
+	    m->entry = (void (*)(void*))sym->value;
+	  break;
+	}
+    }
+
+  return true;
+}
+
+static bool relocate(boot_module* m, elf_section* sections, unsigned int count, elf_section* rel, elf_section* symtab)
+{
+  if(rel->info >= count)
+    return link_fail(m, "relocations for a missing section");
+
+  // Relocations for debugging sections are not needed at run time.
+  elf_section* target = &sections[rel->info];
+  if(!(target->flags & ELF_FLAG_ALLOC))
+    return true;
+
+  elf_symbol* symbols = (elf_symbol*)symtab->addr;
+  unsigned int symbol_count = symtab->size / sizeof(elf_symbol);
+  elf_rel* rels = (elf_rel*)rel->addr;
+
+  for(unsigned int i = 0; i < rel->size / sizeof(elf_rel); i++)
+    {
+      unsigned int index = elf_rel_symbol(rels[i].info);
+
+      if(target->size < 4 || rels[i].offset > target->size - 4 || index >= symbol_count)
+	return link_fail(m, "relocation out of range");
+
+      unsigned int* place = (unsigned int*)(target->addr + rels[i].offset);
+
+      switch(elf_rel_type(rels[i].info))
+	{
+	case ELF_R_386_NONE:
+	  break;
+
+	case ELF_R_386_32:
+	  *place += symbols[index].value;
+	  break;
+
+	case ELF_R_386_PC32:
+	  *place += symbols[index].value - (unsigned int)place;
+	  break;
+
+	default:
+	  print("- %s: unsupported relocation type %u, not loaded.\n", m->name, elf_rel_type(rels[i].info));
+	  return false;
+	}
+    }
+
+  return true;
+}
+
+static bool link_elf(boot_module* m)
+{
+  elf_header* header = (elf_header*)m->base;
+
+  if(m->size < sizeof(elf_header) || header->class != ELF_CLASS_32 || header->data != ELF_DATA_LSB
+     || header->type != ELF_TYPE_REL || header->machine != ELF_MACHINE_386)
+    return link_fail(m, "not a 32-bit x86 relocatable object");
+
+  if(header->shentsize != sizeof(elf_section) || header->shoff > m->size
+     || header->shnum * sizeof(elf_section) > m->size - header->shoff)
+    return link_fail(m, "section headers outside the image");
+
+  elf_section* sections = (elf_section*)(m->base + header->shoff);
+  unsigned int count = header->shnum;
+  elf_section* symtab = NULL;
+
+  if(!place_sections(m, sections, count))
+    return false;
+
+  for(unsigned int i = 0; i < count; i++)
+    if(sections[i].type == ELF_SECTION_SYMTAB)
+      symtab = &sections[i];
+
+  if(!symtab)
+    return link_fail(m, "no symbol table");
+
+  if(!resolve_symbols(m, sections, count, symtab))
+    return false;
+
+  for(unsigned int i = 0; i < count; i++)
+    {
+      if(sections[i].type == ELF_SECTION_RELA)
+	return link_fail(m, "RELA relocations are not used on x86");
+
+      if(sections[i].type == ELF_SECTION_REL && !relocate(m, sections, count, &sections[i], symtab))
+	return false;
+    }
+
+  return true;
+}
+
+static void copy_name(boot_module* m, unsigned long string)
+{
+  unsigned int length = 0;
+
+  if(string)
+    {
+      const char* cmdline = (const char*)map_physical(string, MODULE_NAME_MAX, 1);
+      if(cmdline)
+	{
+	  for(; length < MODULE_NAME_MAX - 1 && cmdline[length]; length++)
+	    m->name[length] = cmdline[length];
+	  unmap_physical((unsigned long)cmdline, MODULE_NAME_MAX);
+	}
+    }
+
+  if(!length)
+    {
+      memcpy(m->name, "module", 7);
+      length = 6;
+    }
+  m->name[length] = 0;
+
+  return;
+}
+
+static void unload(boot_module* m)
+{
+  if(m->bss)
+    pfree(m->bss, m->bss_pages);
+  unmap_physical(m->base, m->size);
+  return;
+}
+
+static bool load_module(module_t* mod)
+{
+  boot_module* m = &modules[modules_loaded];
+  unsigned long long start = ktime_ns();
+
+  memset(m, 0, sizeof(boot_module));
+  copy_name(m, mod->string);
+
+  m->phys = mod->mod_start;
+  m->size = mod->mod_end - mod->mod_start;
+  if(mod->mod_end <= mod->mod_start)
+    return link_fail(m, "empty");
+
+  m->base = map_physical(m->phys, m->size, 1);
+  if(!m->base)
+    return link_fail(m, "no address space to map it");
+
+  if(m->size >= 4 && *(unsigned int*)m->base == ELF_MAGIC)
+    {
+      // Linking writes to the image, so the mapping has to be writable.
+      unsigned long offset = m->phys & 0xFFF;
+      if(!map_range(m->base - offset, m->phys - offset, (offset + m->size + 0xFFF) >> 12, 3))
+	{
+	  unload(m);
+	  return link_fail(m, "could not remap it writable");
+	}
+
+      m->type = MODULE_ELF;
+      if(!link_elf(m))
+	{
+	  unload(m);
+	  return false;
+	}
+    }
+
+  m->load_ns = ktime_ns() - start;
+  modules_loaded++;
+
+  print("- %s: %s, %u KiB at %h, loaded in %u us.\n", m->name,
+	m->type == MODULE_ELF ? "ELF object" : "data", (unsigned int)(m->size >> 10), m->base,
+	(unsigned int)m->load_ns / 1000);
+
+  return true;
+}
+
+bool init_modules(multiboot_info_t* multi_data)
+{
+  multiboot_info_t* info = (multiboot_info_t*)map_physical((unsigned long)multi_data, sizeof(multiboot_info_t), 1);
+  if(!info)
+    return false;
+
+  unsigned long count = (info->flags & MULTIBOOT_MODS) ? info->mods_count : 0;
+  unsigned long mods_addr = info->mods_addr;
+  unmap_physical((unsigned long)info, sizeof(multiboot_info_t));
+
+  if(!count)
+    return true;
+
+  module_t* mods = (module_t*)map_physical(mods_addr, count * sizeof(module_t), 1);
+  if(!mods)
+    return false;
+
+  for(unsigned long i = 0; i < count; i++)
+    {
+      if(modules_loaded == MAX_MODULES)
+	{
+	  print("- Only the first %u modules are loaded.\n", MAX_MODULES);
+	  break;
+	}
+      load_module(&mods[i]);
+    }
+
+  unmap_physical((unsigned long)mods, count * sizeof(module_t));
+
+  return true;
+}
+
+// Runs the entry point of every linked object in a thread of its own.
+unsigned int start_modules()
+{
+  unsigned int started = 0;
+
+  for(unsigned int i = 0; i < modules_loaded; i++)
+    if(modules[i].entry && thread_create(modules[i].entry, &modules[i], THREAD_PRIORITY_NORMAL))
+      started++;
+
+  return started;
+}
+
+unsigned int module_count()
+{
+  return modules_loaded;
+}
+
+boot_module* module_get(unsigned int index)
+{
+  return index < modules_loaded ? &modules[index] : NULL;
+}
+
+boot_module* module_find(const char* name)
+{
+  for(unsigned int i = 0; i < modules_loaded; i++)
+    if(!strcmp(modules[i].name, name))
+      return &modules[i];
+
+  return NULL;
+}
@@ -1,9 +1,22 @@
 #include <access.h>
+#include <apic.h>
+#include <cpu.h>
+#include <frame.h>
+#include <idle.h>
+#include <interrupt_handler.h>
+#include <isr.h>
 #include <linker_symbols.h>
 #include <multiboot.h>
+#include <regs.h>
+#include <smp.h>
+#include <spinlock.h>
+#include <stats.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdsymbols.h>
 #include <string.h>
+#include <system.h>
+#include <vmm.h>
 #include <paging.h>
 
 void setup_page_dir();
@@ -14,186 +27,705 @@ void enable_paging();
 bool map_page(unsigned int page_num, unsigned int phys_addr, unsigned short config);
 bool unmap_page(unsigned int virt_addr);
 
-volatile int page_allocation_lock = 0;
+stat_counter allocation_lock_contention = STAT_COUNTER("allocation lock contention");
 
-unsigned int __attribute__ ((aligned(4096))) page_tables [1024][1024] = {[0 ... 1023] = {[0 ... 1023] = 0}};
+spinlock page_allocation_lock = SPINLOCK_INIT(&allocation_lock_contention);
+unsigned int page_allocation_flags;
+
+#define SCRATCH_BASE 0xFF800000
+
+#define ZERO_POOL_SIZE 64
+#define ZERO_POOL_BATCH 8
+
+stat_counter zero_pool_hits = STAT_COUNTER("zero pool hits");
+stat_counter zero_pool_misses = STAT_COUNTER("zero pool misses");
+stat_counter zero_pool_refills = STAT_COUNTER("zero pool frames zeroed when idle");
+
+spinlock zero_pool_lock = SPINLOCK_INIT(NULL);
+unsigned long zero_pool[ZERO_POOL_SIZE];
+unsigned int zero_pool_count = 0;
+
+#define PAGE_TABLES_BASE 0xFFC00000
+#define PAGE_DIRECTORY_SELF 1023
+
+#define PAGE_LARGE 0x80
+#define PAGE_GLOBAL 0x100
+#define LARGE_PAGE_SIZE 0x400000
+#define LARGE_PAGE_MASK (LARGE_PAGE_SIZE - 1)
 
 unsigned int __attribute__ ((aligned(4096))) page_directory[1024] = {[0 ... 1023] = 0};
 
-enum page_state {HARDWARE = 0, NO_MEM = 1, ALLOCATED = 2, UNALLOCATED = 3};
+// Page tables are allocated from the frame allocator the first time a
+// directory entry is populated. Before paging is enabled they are reached
+// through their physical address, afterwards through the recursive entry
+// at the top of the directory, which maps every table at PAGE_TABLES_BASE.
+bool paging_enabled = false;
+unsigned int page_table_count = 0;
+
+// With PSE, aligned identity runs of 4 MiB are mapped by a single
+// directory entry. Such an entry is split back into a page table the
+// first time one of its pages needs its own mapping or tag.
+bool large_pages = false;
+
+// Kernel mappings are marked global when PGE is available, so they stay
+// in the TLB across CR3 reloads. Changed entries are collected in a
+// tlb_batch and invalidated one by one with invlpg, or with a single
+// full flush once more than TLB_BATCH_SIZE pages changed.
+//
+// All processors share the one directory, so a batch is also sent to
+// every other online processor with TLB_SHOOTDOWN_VECTOR, and the flush
+// returns only once each has invalidated it. Frames and VMM ranges are
+// released after that. A processor waiting for a spinlock with
+// interrupts masked answers from its wait loop instead, through
+// tlb_shootdown_poll(), since the lock may be held by the one flushing.
+// Only the per-CPU scratch windows are never cached elsewhere.
+bool global_pages = false;
+
+#define TLB_BATCH_SIZE 32
+
+#define FAULT_PRESENT 0x1
+#define FAULT_WRITE 0x2
+#define FAULT_USER 0x4
+
+typedef struct tlb_batch tlb_batch;
+
+struct tlb_batch
+{
+  unsigned int count;
+  unsigned long pages[TLB_BATCH_SIZE];
+};
+
+stat_counter tlb_pages_invalidated = STAT_COUNTER("tlb pages invalidated");
+stat_counter tlb_full_flushes = STAT_COUNTER("tlb full flushes");
+stat_counter tlb_shootdowns = STAT_COUNTER("tlb shootdowns sent");
+stat_counter minor_faults = STAT_COUNTER("minor page faults");
+
+spinlock page_directory_lock = SPINLOCK_INIT(NULL);
+spinlock demand_lock = SPINLOCK_INIT(NULL);
+spinlock shootdown_lock = SPINLOCK_INIT(NULL);
+
+static tlb_batch shootdown_batch;
+static volatile unsigned int shootdown_pending = 0;
+
+static inline void invlpg(unsigned long virt_addr) {
+  __asm__ __volatile__ ("invlpg [%0]" :: "r"(virt_addr) : "memory");
+}
+
+static void flush_tlb() {
+  stat_inc(&tlb_full_flushes);
+
+  // A CR3 reload keeps global entries, toggling CR4.PGE drops them too.
+  if(global_pages)
+    __asm__ __volatile__ ("mov %%eax, %%cr4\n mov %%edx, %%eax\n and %%edx, 0xFFFFFF7F\n"
+			  "mov %%cr4, %%edx\n mov %%cr4, %%eax" ::: "%eax", "%edx", "memory");
+  else
+    __asm__ __volatile__ ("mov %%eax, %%cr3\n mov %%cr3, %%eax" ::: "%eax", "memory");
+}
+
+static inline void tlb_batch_add(tlb_batch* batch, unsigned long virt_addr) {
+  if(batch->count < TLB_BATCH_SIZE)
+    batch->pages[batch->count] = virt_addr;
+  ++batch->count;
+}
+
+static void tlb_batch_invalidate(tlb_batch* batch) {
+  if(batch->count > TLB_BATCH_SIZE)
+    flush_tlb();
+  else {
+    for(unsigned int i = 0; i < batch->count; ++i)
+      invlpg(batch->pages[i]);
+    stat_add(&tlb_pages_invalidated, batch->count);
+  }
+}
+
+static bool tlb_batch_local(tlb_batch* batch) {
+  if(batch->count > TLB_BATCH_SIZE)
+    return false;
+
+  for(unsigned int i = 0; i < batch->count; ++i)
+    if(batch->pages[i] < SCRATCH_BASE || batch->pages[i] >= PAGE_TABLES_BASE)
+      return false;
+
+  return true;
+}
+
+void tlb_shootdown_poll() {
+  unsigned int self = 1 << cpu_id();
+
+  if(!(shootdown_pending & self))
+    return;
+
+  tlb_batch_invalidate(&shootdown_batch);
+  __sync_fetch_and_and(&shootdown_pending, ~self);
+}
+
+static void tlb_shootdown_handler(regs* r __attribute__ ((unused))) {
+  tlb_shootdown_poll();
+  lapic_eoi();
+}
+
+static void tlb_shootdown(tlb_batch* batch) {
+  unsigned int others = smp_online_mask() & ~(1 << cpu_id());
+
+  if(!others)
+    return;
+
+  // Whoever holds the lock may be waiting for this processor.
+  while(!spin_trylock(&shootdown_lock))
+    tlb_shootdown_poll();
 
-unsigned int page_allocation_tables[1024*1024] = {[0 ... (1024*1024 - 1)] = (NO_MEM << 30)};
+  shootdown_batch = *batch;
+  __sync_synchronize();
+  shootdown_pending = others;
+
+  for(unsigned int cpu = 0; others >> cpu; ++cpu)
+    if(others & (1 << cpu))
+      smp_send_ipi(cpu, TLB_SHOOTDOWN_VECTOR);
+
+  while(shootdown_pending)
+    __asm__ __volatile__ ("pause" ::: "memory");
+
+  stat_inc(&tlb_shootdowns);
+  spin_unlock(&shootdown_lock);
+}
+
+static void tlb_batch_flush(tlb_batch* batch) {
+  if(!paging_enabled || !batch->count) {
+    batch->count = 0;
+    return;
+  }
+
+  unsigned int flags = irq_save();
+  tlb_batch_invalidate(batch);
+  if(!tlb_batch_local(batch))
+    tlb_shootdown(batch);
+  irq_restore(flags);
+
+  batch->count = 0;
+}
+
+static unsigned int* page_entry(unsigned long virt_addr)
+{
+  unsigned int table = page_directory[virt_addr >> 22];
+
+  if(!(table & 1) || (table & PAGE_LARGE))
+    return NULL;
+
+  if(!paging_enabled)
+    return (unsigned int*)(table & ~0xFFF) + ((virt_addr >> 12) & 1023);
+
+  return (unsigned int*)PAGE_TABLES_BASE + (virt_addr >> 12);
+}
+
+static bool split_large_page(unsigned int index)
+{
+  unsigned int large = page_directory[index];
+  unsigned long table = frame_alloc(0);
+
+  if(!table)
+    return false;
+
+  // Fill the new table before it replaces the large entry, since the
+  // region may hold the code that is running.
+  unsigned int flags = irq_save();
+  unsigned long scratch = SCRATCH_BASE + (cpu_id() << 12);
+  unsigned int* entries = (unsigned int*)table;
+
+  if(paging_enabled) {
+    map_page(scratch, table, 3);
+    entries = (unsigned int*)scratch;
+  }
+
+  for(unsigned int i = 0; i < 1024; ++i)
+    entries[i] = ((large & ~LARGE_PAGE_MASK) + (i << 12)) | (large & (PAGE_GLOBAL | 0x1F));
+
+  if(paging_enabled)
+    unmap_page(scratch);
+
+  spin_lock(&page_directory_lock);
+  if(page_directory[index] == large) {
+    page_directory[index] = table | 3;
+    ++page_table_count;
+    table = 0;
+  }
+  spin_unlock(&page_directory_lock);
+
+  // Other processors may keep the large entry, which translates the same;
+  // the invlpg sent for whatever changes next drops it there too.
+  if(paging_enabled)
+    flush_tlb();
+  irq_restore(flags);
+
+  if(table)
+    frame_free(table, 0);
+
+  return true;
+}
+
+static unsigned int* page_entry_alloc(unsigned long virt_addr)
+{
+  unsigned int* entry = page_entry(virt_addr);
+  unsigned int index = virt_addr >> 22;
+
+  if(entry || index == PAGE_DIRECTORY_SELF)
+    return entry;
+
+  if(page_directory[index] & PAGE_LARGE) {
+    if(!split_large_page(index))
+      return NULL;
+    return page_entry(virt_addr);
+  }
+
+  unsigned long table = frame_alloc_zeroed();
+  if(!table)
+    return NULL;
+
+  unsigned int flags = spin_lock_irqsave(&page_directory_lock);
+  if(page_directory[index] & 1) {
+    spin_unlock_irqrestore(&page_directory_lock, flags);
+    frame_free(table, 0);
+    return page_entry(virt_addr);
+  }
+
+  page_directory[index] = table | 3;
+  ++page_table_count;
+  spin_unlock_irqrestore(&page_directory_lock, flags);
+
+  return page_entry(virt_addr);
+}
 
 void setup_page_dir()
 {
-  
-  for(unsigned int i  = 0; i < 1024; ++i)
-      page_directory[i] = ((unsigned int)&page_tables[i]) | 3;
-  
+  page_directory[PAGE_DIRECTORY_SELF] = ((unsigned int)page_directory) | 3;
+
+  // The scratch window is used to zero new page tables once paging is on,
+  // so its own table has to exist beforehand.
+  page_entry_alloc(SCRATCH_BASE);
+
   return;
 }
 
-void map_kernel()
+static bool map_large_page(unsigned long virt_addr, unsigned long phys_addr, unsigned short config)
 {
+  unsigned int index = virt_addr >> 22;
+  bool mapped = false;
 
-  for(unsigned int i = (stext >> 12); i < (srodata >> 12); ++i)
-    page_tables[i/1024][i%1024] = (i << 12) | 1;
+  if(!large_pages || (virt_addr & LARGE_PAGE_MASK) || (phys_addr & LARGE_PAGE_MASK) || index == PAGE_DIRECTORY_SELF)
+    return false;
 
-  for(unsigned int i = (srodata >> 12); i < (sdata >> 12); ++i)
-    page_tables[i/1024][i%1024] = (i << 12) | 1;
+  unsigned int flags = spin_lock_irqsave(&page_directory_lock);
+  if(!(page_directory[index] & 1)) {
+    page_directory[index] = phys_addr | config | PAGE_LARGE | (global_pages ? PAGE_GLOBAL : 0);
+    mapped = true;
+  }
+  spin_unlock_irqrestore(&page_directory_lock, flags);
 
-  for(unsigned int i = (sdata >> 12); i < (sbss >> 12); ++i)
-    page_tables[i/1024][i%1024] = (i << 12) | 3;
+  return mapped;
+}
 
-  for(unsigned int i = (sbss >> 12); i < (end >> 12); ++i)
-    page_tables[i/1024][i%1024] = (i << 12) | 3;
+static void map_identity(unsigned long begin_addr, unsigned long end_addr, unsigned short config)
+{
+  for(unsigned long addr = begin_addr & ~0xFFF; addr < end_addr; ) {
+    if(end_addr - addr >= LARGE_PAGE_SIZE && map_large_page(addr, addr, config)) {
+      addr += LARGE_PAGE_SIZE;
+    }
+    else {
+      map_page(addr, addr, config);
+      addr += 4096;
+    }
+  }
+}
+
+// Code and read-only data are mapped read-only, and nothing below the
+// kernel is mapped, so page 0 stays absent to catch null pointers. Only
+// 4 MiB runs lying wholly inside one of the two regions get large pages;
+// the rest, including the first 4 MiB, is mapped page by page.
+void map_kernel()
+{
+  map_identity(stext, sdata, 1);
+  map_identity(sdata, end, 3);
 
   return;
 }
 
+// CR0.WP makes read-only pages read-only in ring 0 too, and NE reports
+// x87 errors as exceptions; trampoline.asm sets the same on the others.
 void enable_paging()
 {
-    __asm__ __volatile__ ("mov %%eax, (%0);\n mov %%cr3, %%eax;\n mov %%eax, %%cr0;\n or %%eax, 0x80000000;\n mov %%cr0, %%eax" :: "g" (page_directory) : "%eax");
+    __asm__ __volatile__ ("mov %%eax, (%0);\n mov %%cr3, %%eax;\n mov %%eax, %%cr0;\n or %%eax, 0x80010020;\n mov %%cr0, %%eax" :: "g" (page_directory) : "%eax");
+  paging_enabled = true;
   return;
 }
 
-bool map_page(unsigned int virt_addr, unsigned int phys_addr, unsigned short config)
+static bool map_one(unsigned long virt_addr, unsigned long phys_addr, unsigned short config, tlb_batch* batch)
 {
+  // Already covered by a large page that is at least as permissive.
+  unsigned int large = page_directory[virt_addr >> 22];
+  if((large & PAGE_LARGE) && (large & ~LARGE_PAGE_MASK) + (virt_addr & LARGE_PAGE_MASK) == phys_addr
+     && !(config & ~large & 3)) {
+    return true;
+  }
 
-  if((virt_addr & 0xFFF) && (phys_addr & 0xFFF) && (config & 3)) {
+  unsigned int* entry = page_entry_alloc(virt_addr);
+  if(!entry) {
     return false;
   }
-  
-  int page_num = (virt_addr >> 12);
-  page_tables[page_num/1024][page_num%1024] = phys_addr | config;
+
+  // Page tables are made for the kernel. A user page needs the directory
+  // entry to allow ring 3 too; the table entries still decide per page.
+  if((config & 4) && !(page_directory[virt_addr >> 22] & 4)) {
+    unsigned int flags = spin_lock_irqsave(&page_directory_lock);
+    page_directory[virt_addr >> 22] |= 4;
+    spin_unlock_irqrestore(&page_directory_lock, flags);
+    tlb_batch_add(batch, virt_addr);
+  }
+
+  if(global_pages && (config & 1)) {
+    config |= PAGE_GLOBAL;
+  }
+
+  // Entries that were not present cannot be cached.
+  if(*entry & 1) {
+    tlb_batch_add(batch, virt_addr);
+  }
+  *entry = phys_addr | config;
 
   return true;
 }
 
+static void unmap_pages(unsigned long virt_addr, int num_pages, bool release_frames)
+{
+  tlb_batch batch = {.count = 0};
 
-bool unmap_page(unsigned int virt_addr)
+  // Entries whose frames go back only lose the present bit here, and are
+  // cleared once no processor can still reach the frames through its TLB.
+  for(int i = 0; i < num_pages; ++i) {
+    unsigned long page = virt_addr + (i << 12);
+
+    if(page_directory[page >> 22] & PAGE_LARGE) {
+      split_large_page(page >> 22);
+    }
+
+    unsigned int* entry = page_entry(page);
+    if(!entry || !(*entry & 1)) {
+      continue;
+    }
+
+    *entry = release_frames ? *entry & ~1 : 0;
+    tlb_batch_add(&batch, page);
+  }
+
+  tlb_batch_flush(&batch);
+
+  for(int i = 0; release_frames && i < num_pages; ++i) {
+    unsigned int* entry = page_entry(virt_addr + (i << 12));
+    if(!entry || !*entry || (*entry & 1)) {
+      continue;
+    }
+
+    frame_free(*entry & ~0xFFF, 0);
+    *entry = 0;
+  }
+}
+
+bool map_range(unsigned long virt_addr, unsigned long phys_addr, int num_pages, unsigned short config)
 {
+  tlb_batch batch = {.count = 0};
+  bool mapped = true;
 
+  if((virt_addr & 0xFFF) || (phys_addr & 0xFFF)) {
+    return false;
+  }
+
+  for(int i = 0; mapped && i < num_pages; ++i) {
+    mapped = map_one(virt_addr + (i << 12), phys_addr + (i << 12), config, &batch);
+  }
+
+  tlb_batch_flush(&batch);
+
+  return mapped;
+}
+
+bool unmap_range(unsigned long virt_addr, int num_pages)
+{
   if(virt_addr & 0xFFF) {
     return false;
   }
-  
-  int page_num = (virt_addr >> 12);
-  page_tables[page_num/1024][page_num%1024] = 0;
+
+  unmap_pages(virt_addr, num_pages, false);
 
   return true;
 }
 
-bool setup_paging(multiboot_info_t* multi_data)
+bool map_page(unsigned int virt_addr, unsigned int phys_addr, unsigned short config)
 {
-  if (!(multi_data -> flags | 32)) {
-    print("Error: Multiboot data does not contain memory map.");
+
+  if((virt_addr & 0xFFF) && (phys_addr & 0xFFF) && (config & 3)) {
     return false;
   }
-  
-  unsigned long mmap_length = multi_data->mmap_length;
-  char* mmap_base_addr = (char*)multi_data->mmap_addr;
-  memory_map_t* mmap_curr;
 
-  
-  for(char* mmap_curr_addr = mmap_base_addr;
-      ((unsigned long)(mmap_curr_addr - mmap_base_addr)) < mmap_length;
-      mmap_curr_addr += (mmap_curr->size + sizeof(unsigned long))) {
-
-    mmap_curr = (memory_map_t*)mmap_curr_addr;
-
-    /* print("mmap info:\n"); */
-    /* print("- size: %ul\n- base_addr_low: %ul\n- base_addr_high: %ul\n- length_low: %ul\n- length_high: %ul\n- type: %ul\n", */
-    /* 	  mmap_curr->size, */
-    /* 	  mmap_curr->base_addr_low, */
-    /* 	  mmap_curr->base_addr_high, */
-    /* 	  mmap_curr->length_low, */
-    /* 	  mmap_curr->length_high, */
-    /* 	  mmap_curr->type); */
-    
-    if(mmap_curr->base_addr_high == 0) {
-      
-      unsigned long begin_addr = mmap_curr->base_addr_low;
-      unsigned long end_addr;
-      
-      if(mmap_curr->length_high != 0
-	 || __builtin_uaddl_overflow(
-				      mmap_curr->base_addr_low,
-				      mmap_curr->length_low,
-				      &end_addr))
-	{
-	  end_addr = 0xFFFFFFFF;
-	}
-
-      unsigned long begin_page = (begin_addr >> 12) + ((begin_addr & 0xFFF)?1:0);
-      unsigned long end_page = end_addr >> 12;
-
-      for(unsigned long i = begin_page; i < end_page; ++i) {
-	page_allocation_tables[i] = ((mmap_curr->type == 1)?UNALLOCATED:HARDWARE) << 30;
-      }
-      
-      // print("- begin address: %ul, end_address: %ul, begin page: %ul, end page: %ul, type: %s.\n", begin_addr, end_addr, begin_page, end_page, (mmap_curr->type == 1)?"UNALLOCATED":"HARDWARE");
-      
-    }
-      
+  tlb_batch batch = {.count = 0};
+  bool mapped = map_one(virt_addr, phys_addr, config, &batch);
+  tlb_batch_flush(&batch);
+
+  return mapped;
+}
+
+
+bool unmap_page(unsigned int virt_addr)
+{
+  return unmap_range(virt_addr, 1);
+}
+
+static bool back_lazy_page(unsigned long page) {
+  unsigned long frame = frame_alloc_zeroed();
+  bool mapped = true;
+
+  if(!frame) {
+    return false;
   }
-  
-  for(unsigned long kernel_page = begin >> 12;
-      kernel_page < (end >> 12) + ((end & 0xFFF)?1:0);
-      ++kernel_page) {
-    page_allocation_tables[kernel_page] = ALLOCATED << 30;
+
+  // Another processor may have faulted on the same page meanwhile.
+  unsigned int flags = spin_lock_irqsave(&demand_lock);
+  if(virt_to_phys(page)) {
+    frame_free(frame, 0);
+  }
+  else if(!map_page(page, frame, 3)) {
+    frame_free(frame, 0);
+    mapped = false;
   }
+  spin_unlock_irqrestore(&demand_lock, flags);
 
-  page_allocation_tables[0xb8] = ALLOCATED << 30;
+  return mapped;
+}
+
+static void page_fault_handler(regs* r) {
+  unsigned long fault_addr;
+  __asm__ __volatile__ ("mov %0, %%cr2" : "=r"(fault_addr));
+
+  if(!(r->err_code & FAULT_PRESENT) && vmm_lazy_page(fault_addr) && back_lazy_page(fault_addr & ~0xFFF)) {
+    stat_inc(&minor_faults);
+    return;
+  }
+
+  print("\nPage Fault Exception\n");
+  print("%s of %h in %s mode, %s.\n", (r->err_code & FAULT_WRITE) ? "Write" : "Read", fault_addr,
+	(r->err_code & FAULT_USER) ? "user" : "kernel",
+	(r->err_code & FAULT_PRESENT) ? "protection violation" : "page not present");
+  print("eip: %h\n", r->eip);
+  print("System Halting!!!\n");
+  kill();
+}
+
+bool setup_paging(multiboot_info_t* multi_data)
+{
+  if(!init_frames(multi_data))
+    return false;
+
+  // Application processors start in real mode from this frame.
+  frame_reserve(SMP_TRAMPOLINE, SMP_TRAMPOLINE + FRAME_SIZE);
+
+  if(cpu_has(CPU_FEATURE_PSE)) {
+    __asm__ __volatile__ ("mov %%eax, %%cr4\n or %%eax, 0x10\n mov %%cr4, %%eax" ::: "%eax");
+    large_pages = true;
+    print("- 4 MiB pages enabled (PSE).\n");
+  }
+  else
+    print("- No PSE, using 4 KiB pages only.\n");
+
+  if(cpu_has(CPU_FEATURE_PGE)) {
+    __asm__ __volatile__ ("mov %%eax, %%cr4\n or %%eax, 0x80\n mov %%cr4, %%eax" ::: "%eax");
+    global_pages = true;
+    print("- Global kernel pages enabled (PGE).\n");
+  }
 
-  print("- Memory mapped and page allocation tables setup\n");
-  
   setup_page_dir();
   print("- Page directory setup\n");
 
   map_kernel();
   print("- Kernel pages mapped (id).\n");
 
+  unsigned long meta_begin, meta_end;
+  frame_metadata(&meta_begin, &meta_end);
+  map_identity(meta_begin, meta_end, 3);
+  print("- Page frame tables mapped (id).\n");
+
   map_page(0xb8000, 0xb8000, 3);
   print("- Video memory pages mapped (id).\n");
   
   enable_paging();
-  print("- Paging enabled\n\n");
+  print("- Paging enabled\n");
+
+  print("- Resident at boot: %u KiB (kernel image %u KiB, frame tables %u KiB, %u page tables).\n",
+	((end - begin) + (meta_end - meta_begin) + ((page_table_count + 1) << 12)) >> 10,
+	(end - begin) >> 10, (meta_end - meta_begin) >> 10, page_table_count);
+
+  install_stat(&allocation_lock_contention);
+  install_stat(&zero_pool_hits);
+  install_stat(&zero_pool_misses);
+  install_stat(&zero_pool_refills);
+  install_stat(&tlb_pages_invalidated);
+  install_stat(&tlb_full_flushes);
+  install_stat(&tlb_shootdowns);
+  install_stat(&minor_faults);
+
+  init_vmm();
+  print("- Page allocations placed in %h-%h.\n", VMM_BASE, VMM_END);
+
+  install_isr_handler(14, page_fault_handler);
+  int_routines[TLB_SHOOTDOWN_VECTOR] = tlb_shootdown_handler;
+  print("- Page fault handler installed, reserved ranges backed on demand.\n");
+
+  install_idle_handler(refill_zero_pool);
+  print("- Zeroed page pool registered with idle loop.\n\n");
   
   return true;
 }
 
-unsigned long palloc(int num_pages) {
+void zero_frame(unsigned long phys_addr) {
+  if(!paging_enabled) {
+    memset((void*)phys_addr, 0, 4096);
+    return;
+  }
 
-  unsigned long allocated_page = 1;
-  
-  for(; (allocated_page < 1024*1024); ++allocated_page)
-    if((page_allocation_tables[allocated_page] >> 30) != UNALLOCATED) {
-      int i = 1;
-      for(; (i < num_pages) && (allocated_page + i < 1024*1024); ++i) {
-	if((page_allocation_tables[allocated_page + i] >> 30) != UNALLOCATED) {
-	  break;
-	}
-      }
-      if(i == num_pages) {
-	break;
-      } else if (allocated_page + i == 1024 * 1024) {
-	allocated_page = 1024 * 1024;
-	break;
-      } else {
-	allocated_page += i;
+  unsigned int flags = irq_save();
+  unsigned long scratch = SCRATCH_BASE + (cpu_id() << 12);
+
+  map_page(scratch, phys_addr, 3);
+  memset((void*)scratch, 0, 4096);
+  unmap_page(scratch);
+
+  irq_restore(flags);
+}
+
+static unsigned long zero_pool_pop() {
+  unsigned long frame = 0;
+  unsigned int flags = spin_lock_irqsave(&zero_pool_lock);
+
+  if(zero_pool_count) {
+    frame = zero_pool[--zero_pool_count];
+  }
+
+  spin_unlock_irqrestore(&zero_pool_lock, flags);
+
+  return frame;
+}
+
+unsigned long frame_alloc_zeroed() {
+  unsigned long frame = zero_pool_pop();
+
+  if(frame) {
+    stat_inc(&zero_pool_hits);
+    return frame;
+  }
+
+  stat_inc(&zero_pool_misses);
+  frame = frame_alloc(0);
+  if(frame) {
+    zero_frame(frame);
+  }
+
+  return frame;
+}
+
+bool refill_zero_pool() {
+  for(int i = 0; i < ZERO_POOL_BATCH; ++i) {
+    if(zero_pool_count >= ZERO_POOL_SIZE) {
+      return false;
+    }
+
+    unsigned long frame = frame_alloc(0);
+    if(!frame) {
+      return false;
+    }
+
+    zero_frame(frame);
+    stat_inc(&zero_pool_refills);
+
+    unsigned int flags = spin_lock_irqsave(&zero_pool_lock);
+    if(zero_pool_count < ZERO_POOL_SIZE) {
+      zero_pool[zero_pool_count++] = frame;
+      frame = 0;
+    }
+    spin_unlock_irqrestore(&zero_pool_lock, flags);
+
+    if(frame) {
+      frame_free(frame, 0);
+    }
+  }
+
+  return zero_pool_count < ZERO_POOL_SIZE;
+}
+
+static bool back_range(unsigned long virt_addr, int num_pages, bool zeroed) {
+  for(int i = 0; i < num_pages; ++i) {
+    unsigned long frame = zeroed ? frame_alloc_zeroed() : frame_alloc(0);
+
+    if(!frame && !zeroed) {
+      frame = zero_pool_pop();
+    }
+
+    if(!frame || !map_page(virt_addr + (i << 12), frame, 3)) {
+      if(frame) {
+	frame_free(frame, 0);
       }
+      unmap_pages(virt_addr, i, true);
+      return false;
     }
-  
-  if(allocated_page == 1024*1024) {
+  }
+
+  return true;
+}
+
+static unsigned long palloc_virtual(int num_pages, bool zeroed) {
+  unsigned long virt_addr = vmm_alloc(num_pages);
+
+  if(!virt_addr) {
+    return 0;
+  }
+
+  if(!back_range(virt_addr, num_pages, zeroed)) {
+    vmm_free(virt_addr, num_pages);
+    return 0;
+  }
+
+  return virt_addr;
+}
+
+unsigned long palloc(int num_pages) {
+  if(num_pages <= 0) {
     return 0;
-  } else {
-    for(int i = 0; i < num_pages; ++i) { 
-      map_page((allocated_page + i) << 12, (allocated_page + i) << 12, 3);
-      page_allocation_tables[allocated_page + i] = ALLOCATED << 30;
+  }
+
+  // Runs long enough for 4 MiB pages are still taken physically
+  // contiguous and identity mapped when memory allows.
+  if(large_pages && num_pages >= 1024) {
+    unsigned long allocated_page = frame_alloc_pages(num_pages);
+    if(allocated_page) {
+      map_identity(allocated_page, allocated_page + (num_pages << 12), 3);
+      return allocated_page;
     }
-    return allocated_page << 12;
   }
+
+  return palloc_virtual(num_pages, false);
+}
+
+unsigned long palloc_zeroed(int num_pages) {
+  if(num_pages <= 0) {
+    return 0;
+  }
+
+  return palloc_virtual(num_pages, true);
+}
+
+// Only reserves address space, pages are backed with zeroed frames by the
+// page fault handler when first touched. pfree() releases it as usual.
+unsigned long palloc_lazy(int num_pages) {
+  if(num_pages <= 0) {
+    return 0;
+  }
+
+  return vmm_reserve(num_pages);
 }
 
 bool pfree(unsigned long page_address, int num_pages) {
@@ -201,30 +733,113 @@ bool pfree(unsigned long page_address, int num_pages) {
     return false;
   }
 
-  unsigned long page_index = page_address >> 12;
-
-  for(int i = 0; i < num_pages; ++i) {
-    if((page_allocation_tables[page_index + i] >> 30) != ALLOCATED) {
+  // Nothing is unmapped for a run that was never handed out.
+  if(vmm_owns(page_address)) {
+    if(!vmm_allocated(page_address, num_pages)) {
       return false;
     }
+    unmap_pages(page_address, num_pages, true);
+    return vmm_free(page_address, num_pages);
   }
 
-  for(int i = 0; i < num_pages; ++i) {
-    page_allocation_tables[page_index + i] = UNALLOCATED << 30;
+  if(!frames_allocated(page_address, num_pages)) {
+    return false;
   }
-  
+
+  // Large pages covering only this allocation go away with it, so the
+  // frames can later be mapped and tagged one by one. The 4 KiB pages at
+  // either end are unmapped after them.
+  tlb_batch batch = {.count = 0};
+  unsigned long end_addr = page_address + (num_pages << 12);
+  for(unsigned long addr = (page_address + LARGE_PAGE_MASK) & ~LARGE_PAGE_MASK;
+      addr + LARGE_PAGE_SIZE <= end_addr; addr += LARGE_PAGE_SIZE) {
+    unsigned int flags = spin_lock_irqsave(&page_directory_lock);
+    if(page_directory[addr >> 22] & PAGE_LARGE) {
+      page_directory[addr >> 22] = 0;
+      tlb_batch_add(&batch, addr);
+    }
+    spin_unlock_irqrestore(&page_directory_lock, flags);
+  }
+  tlb_batch_flush(&batch);
+  unmap_pages(page_address, num_pages, false);
+
+  return frame_free_pages(page_address, num_pages);
+}
+
+unsigned long map_physical(unsigned long phys_addr, unsigned long size, unsigned short config) {
+  unsigned long offset = phys_addr & 0xFFF;
+  int num_pages = (offset + size + 0xFFF) >> 12;
+  unsigned long virt_addr = vmm_alloc(num_pages);
+
+  if(!virt_addr) {
+    return 0;
+  }
+
+  if(!map_range(virt_addr, phys_addr - offset, num_pages, config)) {
+    unmap_range(virt_addr, num_pages);
+    vmm_free(virt_addr, num_pages);
+    return 0;
+  }
+
+  return virt_addr + offset;
+}
+
+void unmap_physical(unsigned long virt_addr, unsigned long size) {
+  unsigned long offset = virt_addr & 0xFFF;
+  int num_pages = (offset + size + 0xFFF) >> 12;
+
+  unmap_range(virt_addr - offset, num_pages);
+  vmm_free(virt_addr - offset, num_pages);
+}
+
+unsigned long virt_to_phys(unsigned long virt_addr) {
+  unsigned int large = page_directory[virt_addr >> 22];
+
+  if((large & 1) && (large & PAGE_LARGE)) {
+    return (large & ~LARGE_PAGE_MASK) + (virt_addr & LARGE_PAGE_MASK);
+  }
+
+  unsigned int* entry = page_entry(virt_addr);
+  if(!entry || !(*entry & 1)) {
+    return 0;
+  }
+
+  return (*entry & ~0xFFF) | (virt_addr & 0xFFF);
+}
+
+bool set_page_tag(unsigned long virt_addr, unsigned int tag) {
+  if(tag > 7) {
+    return false;
+  }
+
+  unsigned int* entry = (tag == PAGE_TAG_NONE) ? page_entry(virt_addr) : page_entry_alloc(virt_addr);
+
+  if(!entry || !(*entry & 1)) {
+    return tag == PAGE_TAG_NONE;
+  }
+
+  *entry = (*entry & ~0xE00) | (tag << 9);
+
   return true;
 }
 
-void lock_allocation() {
-  bool b = false;
-  while(!b) {
-    b = __sync_bool_compare_and_swap(&page_allocation_lock, 0, 1);
+unsigned int get_page_tag(unsigned long virt_addr) {
+  unsigned int* entry = page_entry(virt_addr);
+
+  if(!entry || !(*entry & 1)) {
+    return PAGE_TAG_NONE;
   }
+
+  return (*entry >> 9) & 7;
+}
+
+void lock_allocation() {
+  unsigned int flags = spin_lock_irqsave(&page_allocation_lock);
+  page_allocation_flags = flags;
   return;
 }
 
 void unlock_allocation() {
-  page_allocation_lock = 0;
+  spin_unlock_irqrestore(&page_allocation_lock, page_allocation_flags);
   return;
 }
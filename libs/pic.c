@@ -8,25 +8,53 @@ void pic_remap()
   unsigned char b = inb(0xA1);
   
   outb(0x20, 0x11);
-  for(int i = 0; i < 100000; i++);
+  io_wait();
   outb(0xA0, 0x11);
-  for(int i = 0; i < 100000; i++);
+  io_wait();
   outb(0x21, PIC_BASE);
-  for(int i = 0; i < 100000; i++);
+  io_wait();
   outb(0xA1, PIC_BASE + 7);
-  for(int i = 0; i < 100000; i++);
+  io_wait();
   outb(0x21, 4);
-  for(int i = 0; i < 100000; i++);
+  io_wait();
   outb(0xA1, 2);
-  for(int i = 0; i < 100000; i++);
+  io_wait();
   
   outb(0x21, 0x01);
-  for(int i = 0; i < 100000; i++);
+  io_wait();
   outb(0xA1, 0x01);
-  for(int i = 0; i < 100000; i++);
+  io_wait();
 
   outb(0x21, a);
   outb(0xA1, b);
   
   return;
 }
+
+void pic_unmask(unsigned char irq)
+{
+  unsigned short port = (irq < 8) ? 0x21 : 0xA1;
+
+  outb(port, inb(port) & ~(1 << (irq & 7)));
+  if(irq >= 8)
+    outb(0x21, inb(0x21) & ~(1 << 2));
+
+  return;
+}
+
+void pic_mask(unsigned char irq)
+{
+  unsigned short port = (irq < 8) ? 0x21 : 0xA1;
+
+  outb(port, inb(port) | (1 << (irq & 7)));
+  return;
+}
+
+void pic_eoi(unsigned char irq)
+{
+  if(irq >= 8)
+    outb(0xA0, 0x20);
+
+  outb(0x20, 0x20);
+  return;
+}
@@ -0,0 +1,151 @@
+#include <clock.h>
+#include <cpu.h>
+#include <ksyms.h>
+#include <liballoc.h>
+#include <regs.h>
+#include <smp.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdsymbols.h>
+#include <profile.h>
+
+/* Sampling profiler.
+ *
+ * The bootstrap processor samples from its timer tick, and the other
+ * processors from the scheduler IPI that tick forwards to them. A sample
+ * is the interrupted eip stored in a per-processor ring, so sampling can
+ * stay on while other code is measured. The rings keep the latest
+ * PROFILE_SAMPLES samples each. They are only symbolised, against the
+ * table linked in from ksyms_table.c, when a profile is printed.
+ */
+
+typedef struct profile_ring profile_ring;
+
+struct profile_ring
+{
+  unsigned int head;
+  unsigned long eips[PROFILE_SAMPLES];
+};
+
+static profile_ring rings[MAX_CPUS];
+static volatile bool profiling = false;
+
+void profile_sample(regs* r)
+{
+  if(!profiling)
+    return;
+
+  profile_ring* ring = &rings[cpu_id()];
+  ring->eips[ring->head++ & (PROFILE_SAMPLES - 1)] = r->eip;
+
+  return;
+}
+
+static void profile_tick(regs* r)
+{
+  profile_sample(r);
+  return;
+}
+
+void profile_start()
+{
+  profiling = true;
+  return;
+}
+
+void profile_stop()
+{
+  profiling = false;
+  return;
+}
+
+void profile_reset()
+{
+  bool was_profiling = profiling;
+
+  profiling = false;
+  for(unsigned int cpu = 0; cpu < MAX_CPUS; cpu++)
+    rings[cpu].head = 0;
+  profiling = was_profiling;
+
+  return;
+}
+
+bool init_profile()
+{
+  if(!install_tick_handler(profile_tick))
+    return false;
+
+  profile_start();
+  return true;
+}
+
+void print_profile(unsigned int entries)
+{
+  unsigned int symbols = ksym_count();
+  unsigned int total = 0, unknown = 0;
+
+  print("Profile:\n");
+
+  if(!symbols)
+    {
+      print("- No symbol table linked in.\n");
+      return;
+    }
+
+  unsigned int* hits = calloc(symbols, sizeof(unsigned int));
+  if(!hits)
+    {
+      print("- Not enough memory to aggregate samples.\n");
+      return;
+    }
+
+  bool was_profiling = profiling;
+  profiling = false;
+
+  for(unsigned int cpu = 0; cpu < smp_cpu_count(); cpu++)
+    {
+      unsigned int samples = rings[cpu].head < PROFILE_SAMPLES ? rings[cpu].head : PROFILE_SAMPLES;
+
+      for(unsigned int i = 0; i < samples; i++)
+	{
+	  int index = ksym_find(rings[cpu].eips[i]);
+	  if(index < 0)
+	    unknown++;
+	  else
+	    hits[index]++;
+	}
+      total += samples;
+    }
+
+  profiling = was_profiling;
+
+  if(!total)
+    {
+      print("- No samples.\n");
+      free(hits);
+      return;
+    }
+
+  print("- %u samples.\n", total);
+
+  for(unsigned int n = 0; n < entries; n++)
+    {
+      unsigned int best = 0;
+      for(unsigned int i = 1; i < symbols; i++)
+	if(hits[i] > hits[best])
+	  best = i;
+
+      if(!hits[best])
+	break;
+
+      print("- %u% %s (%u)\n", hits[best] * 100 / total, ksym_name(best), hits[best]);
+      hits[best] = 0;
+    }
+
+  if(unknown)
+    print("- %u% outside the kernel (%u)\n", unknown * 100 / total, unknown);
+
+  free(hits);
+  return;
+}
@@ -0,0 +1,741 @@
+#include <apic.h>
+#include <clock.h>
+#include <cpu.h>
+#include <interrupt_handler.h>
+#include <paging.h>
+#include <profile.h>
+#include <regs.h>
+#include <slab.h>
+#include <smp.h>
+#include <spinlock.h>
+#include <stats.h>
+#include <stdbool.h>
+#include <stdsymbols.h>
+#include <string.h>
+#include <system.h>
+#include <sched.h>
+
+/* Preemptive kernel threads.
+ *
+ * Every interrupt ends in sched_switch(), which may hand int_common the
+ * saved regs frame of another thread to resume, so a context switch is
+ * only a change of stack pointer. Each processor has a run queue with one
+ * FIFO per priority and a bitmap of the non-empty ones. A processor with
+ * nothing queued steals from the others before falling back to its idle
+ * thread, the context that was running idle() when the scheduler started.
+ *
+ * The PIT tick drives the bootstrap processor, which forwards a reschedule
+ * IPI to the others every SCHED_SLICE_TICKS. A thread stays on_cpu until
+ * int_common has left its stack, and is not resumed elsewhere before then.
+ *
+ * A thread only ever sits on the run queue of a processor in its affinity
+ * mask, and stealing skips the ones the thief may not run.
+ *
+ * Threads may use the x87 and SSE registers, so each keeps their contents
+ * in its fpu area while switched out. The area is written with fxsave
+ * when the processor has SSE enabled and with fnsave otherwise, and new
+ * threads start from a copy of the state fninit leaves.
+ */
+
+typedef struct runqueue runqueue;
+
+struct runqueue
+{
+  spinlock lock;
+  thread* head[THREAD_PRIORITIES];
+  thread* tail[THREAD_PRIORITIES];
+  unsigned int ready;
+  volatile unsigned int count;
+  thread* current;
+  thread* idle;
+  thread* prev;
+  thread* sleepers;
+  unsigned long long next_wake;
+  thread* zombies;
+  volatile bool need_resched;
+  volatile bool running;
+  unsigned int slice;
+};
+
+stat_counter context_switches = STAT_COUNTER("context switches");
+stat_counter threads_stolen = STAT_COUNTER("threads stolen");
+
+static runqueue runqueues[MAX_CPUS];
+static thread idle_threads[MAX_CPUS];
+
+static unsigned char fpu_initial[THREAD_FPU_SIZE] __attribute__ ((aligned(16)));
+
+static kmem_cache* thread_cache = NULL;
+static unsigned int next_thread_id = 0;
+static volatile unsigned int runnable_threads = 0;
+
+static inline void fpu_save(unsigned char* area)
+{
+  if(sse_enabled)
+    __asm__ __volatile__ ("fxsave [%0]" :: "r"(area) : "memory");
+  else
+    __asm__ __volatile__ ("fnsave [%0]" :: "r"(area) : "memory");
+  return;
+}
+
+static inline void fpu_restore(unsigned char* area)
+{
+  if(sse_enabled)
+    __asm__ __volatile__ ("fxrstor [%0]" :: "r"(area) : "memory");
+  else
+    __asm__ __volatile__ ("frstor [%0]" :: "r"(area) : "memory");
+  return;
+}
+
+static void enqueue(runqueue* rq, thread* t)
+{
+  t->next = NULL;
+
+  if(rq->tail[t->priority])
+    rq->tail[t->priority]->next = t;
+  else
+    rq->head[t->priority] = t;
+
+  rq->tail[t->priority] = t;
+  rq->ready |= 1 << t->priority;
+  rq->count++;
+  __sync_fetch_and_add(&runnable_threads, 1);
+
+  return;
+}
+
+// Takes the first of the highest priority threads that may run on cpu.
+static thread* dequeue(runqueue* rq, unsigned int cpu)
+{
+  unsigned int ready = rq->ready;
+
+  while(ready)
+    {
+      unsigned int priority = 31 - __builtin_clz(ready);
+      thread* prev = NULL;
+
+      for(thread* t = rq->head[priority]; t; prev = t, t = t->next)
+	{
+	  if(!(t->affinity & (1U << cpu)))
+	    continue;
+
+	  if(prev)
+	    prev->next = t->next;
+	  else
+	    rq->head[priority] = t->next;
+	  if(rq->tail[priority] == t)
+	    rq->tail[priority] = prev;
+	  if(!rq->head[priority])
+	    rq->ready &= ~(1 << priority);
+
+	  rq->count--;
+	  __sync_fetch_and_sub(&runnable_threads, 1);
+	  t->next = NULL;
+
+	  return t;
+	}
+
+      ready &= ~(1 << priority);
+    }
+
+  return NULL;
+}
+
+static thread* steal(unsigned int cpu)
+{
+  unsigned int cpus = smp_cpu_count();
+
+  for(unsigned int i = 1; i < cpus; i++)
+    {
+      runqueue* victim = &runqueues[(cpu + i) % cpus];
+
+      // Only trylock, the victim may be stealing from us at the same time.
+      if(!victim->running || !victim->count || !spin_trylock(&victim->lock))
+	continue;
+
+      thread* t = dequeue(victim, cpu);
+      spin_unlock(&victim->lock);
+
+      if(t)
+	{
+	  stat_inc(&threads_stolen);
+	  return t;
+	}
+    }
+
+  return NULL;
+}
+
+static void wake_sleepers(runqueue* rq)
+{
+  unsigned long long now = ktime_ns();
+  thread** link = &rq->sleepers;
+
+  rq->next_wake = ~0ULL;
+  while(*link)
+    {
+      thread* t = *link;
+      if(t->wake_time <= now)
+	{
+	  *link = t->next;
+	  t->state = THREAD_RUNNABLE;
+	  enqueue(rq, t);
+	}
+      else
+	{
+	  if(t->wake_time < rq->next_wake)
+	    rq->next_wake = t->wake_time;
+	  link = &t->next;
+	}
+    }
+
+  return;
+}
+
+static void reap_zombies(runqueue* rq)
+{
+  while(rq->zombies)
+    {
+      thread* t = rq->zombies;
+      rq->zombies = t->next;
+      pfree(t->stack, KERNEL_STACK_PAGES);
+      kmem_cache_free(thread_cache, t);
+    }
+
+  return;
+}
+
+// Files the outgoing thread according to the state it left itself in.
+static void park(runqueue* rq, thread* cur)
+{
+  switch(cur->state)
+    {
+    case THREAD_RUNNING:
+      if(cur != rq->idle)
+	{
+	  cur->state = THREAD_RUNNABLE;
+	  enqueue(rq, cur);
+	}
+      break;
+
+    case THREAD_BLOCKED:
+      spin_lock(&cur->wait->lock);
+      cur->next = NULL;
+      if(cur->wait->tail)
+	cur->wait->tail->next = cur;
+      else
+	cur->wait->head = cur;
+      cur->wait->tail = cur;
+      spin_unlock(&cur->wait->lock);
+
+      if(cur->wait_lock)
+	spin_unlock(cur->wait_lock);
+      break;
+
+    case THREAD_SLEEPING:
+      cur->next = rq->sleepers;
+      rq->sleepers = cur;
+      if(cur->wake_time < rq->next_wake)
+	rq->next_wake = cur->wake_time;
+      break;
+
+    case THREAD_EXITED:
+      cur->next = rq->zombies;
+      rq->zombies = cur;
+      break;
+
+    default:
+      break;
+    }
+
+  return;
+}
+
+static void resched(unsigned int cpu)
+{
+  runqueues[cpu].need_resched = true;
+
+  if(cpu != cpu_id())
+    smp_send_ipi(cpu, SCHED_IPI_VECTOR);
+
+  return;
+}
+
+// The least loaded running processor in mask, preferring this one.
+static unsigned int pick_cpu(unsigned int mask)
+{
+  unsigned int best = MAX_CPUS;
+
+  for(unsigned int cpu = 0; cpu < smp_cpu_count(); cpu++)
+    {
+      runqueue* rq = &runqueues[cpu];
+
+      if(!rq->running || !(mask & (1U << cpu)))
+	continue;
+
+      if(best == MAX_CPUS || rq->count < runqueues[best].count
+	 || (rq->count == runqueues[best].count && cpu == cpu_id()))
+	best = cpu;
+    }
+
+  return best < MAX_CPUS ? best : cpu_id();
+}
+
+static void make_runnable(thread* t)
+{
+  bool preempt;
+
+  if(!(t->affinity & (1U << t->cpu)))
+    t->cpu = pick_cpu(t->affinity);
+
+  runqueue* rq = &runqueues[t->cpu];
+
+  unsigned int flags = spin_lock_irqsave(&rq->lock);
+  t->state = THREAD_RUNNABLE;
+  enqueue(rq, t);
+  preempt = rq->current == rq->idle || t->priority > rq->current->priority;
+  spin_unlock_irqrestore(&rq->lock, flags);
+
+  if(preempt)
+    resched(t->cpu);
+
+  return;
+}
+
+regs* sched_switch(regs* r)
+{
+  unsigned int cpu = cpu_id();
+  runqueue* rq = &runqueues[cpu];
+
+  if(!rq->running || !rq->need_resched)
+    return r;
+
+  // Interrupted with interrupts masked, such as a fault taken under a
+  // spinlock: only an explicit yield switches away from there.
+  if(!(r->eflags & 0x200) && r->int_no != SCHED_YIELD_VECTOR)
+    return r;
+
+  rq->need_resched = false;
+  reap_zombies(rq);
+
+  thread* cur = rq->current;
+  cur->frame = r;
+
+  spin_lock(&rq->lock);
+
+  if(rq->sleepers)
+    wake_sleepers(rq);
+
+  // A thread that has just left this processor's affinity mask moves away.
+  bool migrate = cur->state == THREAD_RUNNING && !(cur->affinity & (1U << cpu));
+  if(!migrate)
+    park(rq, cur);
+
+  thread* next = dequeue(rq, cpu);
+  if(!next)
+    next = steal(cpu);
+  if(!next)
+    next = rq->idle;
+
+  next->state = THREAD_RUNNING;
+  next->cpu = cpu;
+  rq->current = next;
+  rq->slice = 0;
+
+  spin_unlock(&rq->lock);
+
+  if(migrate)
+    make_runnable(cur);
+
+  if(next == cur)
+    return r;
+
+  // cur stays on_cpu until sched_finish(), so nobody reads its area before this.
+  fpu_save(cur->fpu);
+
+  // The processor that last ran next may not have left its stack yet.
+  while(next->on_cpu)
+    __asm__ __volatile__ ("pause");
+  next->on_cpu = true;
+  rq->prev = cur;
+
+  fpu_restore(next->fpu);
+
+  // A kernel frame may have been saved on another processor, a user
+  // frame's gs is the user's own.
+  cpu_data* local = cpu_local();
+  if(!(next->frame->cs & 3))
+    next->frame->gs = local->gs_selector;
+  if(next->stack)
+    local->tss.esp0 = next->stack + (KERNEL_STACK_PAGES << 12);
+
+  stat_inc(&context_switches);
+
+  return next->frame;
+}
+
+void sched_finish()
+{
+  runqueue* rq = &runqueues[cpu_id()];
+
+  if(rq->prev)
+    {
+      __sync_synchronize();
+      rq->prev->on_cpu = false;
+      rq->prev = NULL;
+    }
+
+  return;
+}
+
+static void local_tick(unsigned int ticks)
+{
+  runqueue* rq = &runqueues[cpu_id()];
+
+  if(!rq->running)
+    return;
+
+  rq->slice += ticks;
+
+  if(rq->count && (rq->slice >= SCHED_SLICE_TICKS || rq->current == rq->idle))
+    rq->need_resched = true;
+
+  // An idle processor goes looking for work queued elsewhere.
+  else if(rq->current == rq->idle && runnable_threads)
+    rq->need_resched = true;
+
+  if(rq->sleepers && ktime_ns() >= rq->next_wake)
+    rq->need_resched = true;
+
+  return;
+}
+
+static void sched_tick(regs* r __attribute__ ((unused)))
+{
+  local_tick(1);
+
+  if(clock_ticks % SCHED_SLICE_TICKS)
+    return;
+
+  for(unsigned int cpu = 1; cpu < smp_cpu_count(); cpu++)
+    if(runqueues[cpu].running)
+      smp_send_ipi(cpu, SCHED_IPI_VECTOR);
+
+  return;
+}
+
+static void sched_ipi_handler(regs* r)
+{
+  lapic_eoi();
+
+  if(cpu_id())
+    {
+      local_tick(SCHED_SLICE_TICKS);
+      profile_sample(r);
+    }
+
+  return;
+}
+
+static void yield_handler(regs* r __attribute__ ((unused)))
+{
+  runqueues[cpu_id()].need_resched = true;
+  return;
+}
+
+static void thread_start()
+{
+  thread* t = thread_current();
+
+  t->entry(t->arg);
+  thread_exit();
+}
+
+static void sched_cpu_start(void* arg __attribute__ ((unused)))
+{
+  unsigned int cpu = cpu_id();
+  runqueue* rq = &runqueues[cpu];
+  thread* idle = &idle_threads[cpu];
+
+  idle->id = __sync_fetch_and_add(&next_thread_id, 1);
+  idle->priority = THREAD_PRIORITY_LOW;
+  idle->state = THREAD_RUNNING;
+  idle->on_cpu = true;
+  idle->cpu = cpu;
+  idle->affinity = 1U << cpu;
+
+  rq->current = idle;
+  rq->idle = idle;
+  rq->next_wake = ~0ULL;
+  __sync_synchronize();
+  rq->running = true;
+
+  return;
+}
+
+bool init_sched()
+{
+  thread_cache = kmem_cache_create("thread", sizeof(thread), 16, NULL);
+  if(!thread_cache)
+    return false;
+
+  install_stat(&context_switches);
+  install_stat(&threads_stolen);
+
+  // Nothing has used the FPU yet, so resetting it here loses no state.
+  __asm__ __volatile__ ("fninit");
+  fpu_save(fpu_initial);
+
+  int_routines[SCHED_YIELD_VECTOR] = yield_handler;
+  int_routines[SCHED_IPI_VECTOR] = sched_ipi_handler;
+
+  sched_cpu_start(NULL);
+  for(unsigned int cpu = 1; cpu < smp_cpu_count(); cpu++)
+    smp_run_on(cpu, sched_cpu_start, NULL);
+
+  return install_tick_handler(sched_tick);
+}
+
+thread* thread_create(void (*entry)(void* arg), void* arg, unsigned int priority)
+{
+  if(priority >= THREAD_PRIORITIES)
+    return NULL;
+
+  thread* t = kmem_cache_alloc(thread_cache);
+  if(!t)
+    return NULL;
+
+  t->stack = palloc(KERNEL_STACK_PAGES);
+  if(!t->stack)
+    {
+      kmem_cache_free(thread_cache, t);
+      return NULL;
+    }
+
+  // The first switch to the thread "returns" from this frame into thread_start.
+  regs* frame = (regs*)(t->stack + (KERNEL_STACK_PAGES << 12) - sizeof(regs));
+  memset(frame, 0, sizeof(regs));
+  frame->ds = frame->es = frame->fs = 0x10;
+  frame->eip = (unsigned int)thread_start;
+  frame->cs = 0x08;
+  frame->eflags = 0x202;
+
+  t->frame = frame;
+  t->id = __sync_fetch_and_add(&next_thread_id, 1);
+  t->priority = priority;
+  t->on_cpu = false;
+  t->entry = entry;
+  t->arg = arg;
+  t->wait = NULL;
+  t->wait_lock = NULL;
+  t->wait_key = 0;
+  t->affinity = THREAD_ANY_CPU;
+  memset(t->tls, 0, sizeof(t->tls));
+  memcpy(t->fpu, fpu_initial, THREAD_FPU_SIZE);
+  t->next = NULL;
+
+  // Start on the least loaded processor, stealing evens things out later.
+  t->cpu = pick_cpu(t->affinity);
+
+  make_runnable(t);
+
+  return t;
+}
+
+thread* thread_current()
+{
+  unsigned int flags = irq_save();
+  thread* cur = runqueues[cpu_id()].current;
+  irq_restore(flags);
+
+  return cur;
+}
+
+// The idle threads, and processors without a scheduler, have nothing to switch to.
+static bool can_block()
+{
+  runqueue* rq = &runqueues[cpu_id()];
+  return rq->running && rq->current != rq->idle;
+}
+
+void thread_yield()
+{
+  __asm__ __volatile__ ("int %0" :: "i"(SCHED_YIELD_VECTOR));
+  return;
+}
+
+void thread_exit()
+{
+  irq_save();
+  thread_current()->state = THREAD_EXITED;
+  thread_yield();
+
+  while(true)
+    __asm__ __volatile__ ("hlt");
+}
+
+void thread_sleep_ns(unsigned long long ns)
+{
+  unsigned long long wake_time = ktime_ns() + ns;
+  unsigned int flags = irq_save();
+
+  if(!can_block())
+    {
+      irq_restore(flags);
+      while(ktime_ns() < wake_time)
+	__asm__ __volatile__ ("pause");
+      return;
+    }
+
+  thread* cur = thread_current();
+
+  cur->wake_time = wake_time;
+  cur->state = THREAD_SLEEPING;
+  thread_yield();
+
+  irq_restore(flags);
+  return;
+}
+
+/* Restricts the current thread to the processors in mask, moving it off
+ * this one if needed. Fails if none of them is running the scheduler.
+ */
+bool thread_set_affinity(unsigned int mask)
+{
+  unsigned int usable = 0;
+
+  for(unsigned int cpu = 0; cpu < smp_cpu_count(); cpu++)
+    if(runqueues[cpu].running)
+      usable |= 1U << cpu;
+
+  if(!(mask & usable))
+    return false;
+
+  unsigned int flags = irq_save();
+  thread* cur = thread_current();
+
+  if(cur == runqueues[cpu_id()].idle)
+    {
+      irq_restore(flags);
+      return false;
+    }
+
+  cur->affinity = mask;
+  if(!(mask & (1U << cpu_id())))
+    thread_yield();
+
+  irq_restore(flags);
+  return true;
+}
+
+/* Blocks the current thread on queue. If lock is given it must be held
+ * with interrupts disabled, and is released once the thread is queued so
+ * a wake_up() issued under lock cannot be missed. Where the current
+ * context cannot block, lock is released all the same and false returned
+ * at once, leaving the caller to poll.
+ */
+bool sleep_on(wait_queue* queue, spinlock* lock)
+{
+  return sleep_on_key(queue, lock, 0);
+}
+
+// As sleep_on(), tagging the waiter so wake_up_key() can pick it out.
+bool sleep_on_key(wait_queue* queue, spinlock* lock, unsigned long key)
+{
+  unsigned int flags = irq_save();
+
+  if(!can_block())
+    {
+      if(lock)
+	spin_unlock(lock);
+      irq_restore(flags);
+      return false;
+    }
+
+  thread* cur = thread_current();
+
+  cur->wait = queue;
+  cur->wait_lock = lock;
+  cur->wait_key = key;
+  cur->state = THREAD_BLOCKED;
+  thread_yield();
+
+  irq_restore(flags);
+  return true;
+}
+
+bool wake_up(wait_queue* queue)
+{
+  unsigned int flags = spin_lock_irqsave(&queue->lock);
+  thread* t = queue->head;
+
+  if(t)
+    {
+      queue->head = t->next;
+      if(!queue->head)
+	queue->tail = NULL;
+    }
+  spin_unlock_irqrestore(&queue->lock, flags);
+
+  if(!t)
+    return false;
+
+  t->wait = NULL;
+  t->wait_lock = NULL;
+  make_runnable(t);
+
+  return true;
+}
+
+void wake_up_all(wait_queue* queue)
+{
+  while(wake_up(queue));
+  return;
+}
+
+// Wakes up to count waiters on queue that slept with key, oldest first.
+unsigned int wake_up_key(wait_queue* queue, unsigned long key, unsigned int count)
+{
+  thread* woken = NULL;
+  thread** last = &woken;
+  unsigned int n = 0;
+
+  unsigned int flags = spin_lock_irqsave(&queue->lock);
+  thread* prev = NULL;
+  thread* t = queue->head;
+  while(t && n < count)
+    {
+      thread* next = t->next;
+
+      if(t->wait_key == key)
+	{
+	  if(prev)
+	    prev->next = next;
+	  else
+	    queue->head = next;
+	  if(queue->tail == t)
+	    queue->tail = prev;
+
+	  t->next = NULL;
+	  *last = t;
+	  last = &t->next;
+	  n++;
+	}
+      else
+	prev = t;
+
+      t = next;
+    }
+  spin_unlock_irqrestore(&queue->lock, flags);
+
+  while(woken)
+    {
+      t = woken;
+      woken = t->next;
+      t->wait = NULL;
+      t->wait_lock = NULL;
+      make_runnable(t);
+    }
+
+  return n;
+}
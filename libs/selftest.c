@@ -0,0 +1,1136 @@
+#ifdef SELFTEST
+
+#include <clock.h>
+#include <cpu.h>
+#include <frame.h>
+#include <futex.h>
+#include <liballoc.h>
+#include <linker_symbols.h>
+#include <paging.h>
+#include <sched.h>
+#include <slab.h>
+#include <smp.h>
+#include <stats.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <systemcall.h>
+#include <vmm.h>
+#include <selftest.h>
+
+/* Boot-time self tests and benchmarks.
+ *
+ * Only built with make SELFTEST=1, and run by k_main once every
+ * subsystem is up, so they exercise the real thing on real hardware
+ * rather than a model of it. Each test checks its subsystem and returns
+ * whether it behaved; the ones that time something print the cost per
+ * operation in TSC cycles first, indented under the test they belong to.
+ */
+
+#define BENCH_ROUNDS 1000
+
+typedef struct selftest selftest;
+
+struct selftest
+{
+  char* name;
+  bool (*run)();
+};
+
+static unsigned long long bench_start;
+
+static void bench_begin()
+{
+  if(tsc_khz)
+    bench_start = rdtsc();
+  return;
+}
+
+static void bench_end(char* what, unsigned int ops)
+{
+  if(!tsc_khz)
+    return;
+
+  unsigned long long cycles = rdtsc() - bench_start;
+  if(!(cycles >> 32))
+    print("  %s: %u cycles\n", what, (unsigned int)cycles / ops);
+
+  return;
+}
+
+// Prints the throughput of moving bytes bytes since bench_begin().
+static void bench_bytes(char* what, unsigned int bytes)
+{
+  if(!tsc_khz)
+    return;
+
+  unsigned long long cycles = rdtsc() - bench_start;
+  if(cycles >> 32 || cycles < 1000)
+    return;
+
+  unsigned int per_kcycle = bytes / ((unsigned int)cycles / 1000);
+  print("  %s: %u MiB/s\n", what, per_kcycle * (tsc_khz / 1024) / 1024);
+
+  return;
+}
+
+// 64 by 32 bit division, there being no libgcc to do it.
+static unsigned long long bench_div(unsigned long long n, unsigned int d)
+{
+  unsigned int high = n >> 32;
+  unsigned int low = n;
+  unsigned int rem;
+
+  __asm__ ("div %4" : "=a"(low), "=d"(rem) : "a"(low), "d"(high % d), "rm"(d));
+  return ((unsigned long long)(high / d) << 32) | low;
+}
+
+// Prints the time per operation since bench_begin() in nanoseconds.
+static void bench_ns(char* what, unsigned int ops)
+{
+  if(!tsc_khz)
+    return;
+
+  unsigned long long cycles = rdtsc() - bench_start;
+  if(!(cycles >> 40))
+    print("  %s: %u ns\n", what, (unsigned int)bench_div(bench_div(cycles * 1000000, tsc_khz), ops));
+
+  return;
+}
+
+static unsigned int bench_seed = 1;
+
+static unsigned int bench_random()
+{
+  bench_seed = bench_seed * 1103515245 + 12345;
+  return bench_seed >> 16;
+}
+
+static unsigned long frames[BENCH_ROUNDS];
+
+// Order 0 comes from this CPU's magazine, order 5 from the buddy lists.
+static bool bench_frame_order(unsigned int order, char* alloc_name, char* free_name)
+{
+  unsigned int count = 0;
+
+  bench_begin();
+  for(; count < BENCH_ROUNDS; count++)
+    if(!(frames[count] = frame_alloc(order)))
+      break;
+  bench_end(alloc_name, BENCH_ROUNDS);
+
+  bool ok = count == BENCH_ROUNDS;
+  for(unsigned int i = 0; i < count; i++)
+    if(frames[i] & ((FRAME_SIZE << order) - 1))
+      ok = false;
+
+  bench_begin();
+  for(unsigned int i = 0; i < count; i++)
+    if(!frame_free(frames[i], order))
+      ok = false;
+  bench_end(free_name, BENCH_ROUNDS);
+
+  return ok;
+}
+
+#define FRAME_TEST_RUNS 256
+#define FRAME_TEST_RUN_MAX 16
+#define FRAME_TEST_STRIDE 97
+
+static unsigned int run_pages[FRAME_TEST_RUNS];
+
+/* Runs of random length, power of two or not, freed in a scattered
+ * order so they coalesce out of sequence. Runs that are not a power of
+ * two take the lock and split their block.
+ */
+static bool bench_frame_runs()
+{
+  unsigned int count = 0;
+  bool ok = true;
+
+  for(unsigned int i = 0; i < FRAME_TEST_RUNS; i++)
+    run_pages[i] = 1 + bench_random() % FRAME_TEST_RUN_MAX;
+
+  bench_begin();
+  for(; count < FRAME_TEST_RUNS; count++)
+    if(!(frames[count] = frame_alloc_pages(run_pages[count])))
+      break;
+  bench_ns("frame_alloc_pages of 1-16 pages", FRAME_TEST_RUNS);
+
+  // The stride visits every slot only when all of them were filled.
+  unsigned int stride = FRAME_TEST_STRIDE;
+  if(count < FRAME_TEST_RUNS)
+    {
+      stride = 1;
+      ok = false;
+    }
+
+  bench_begin();
+  for(unsigned int i = 0, slot = 0; i < count; i++, slot = (slot + stride) % count)
+    if(!frame_free_pages(frames[slot], run_pages[slot]))
+      ok = false;
+  bench_ns("frame_free_pages of 1-16 pages", FRAME_TEST_RUNS);
+
+  return ok;
+}
+
+static bool test_frames()
+{
+  bool ok = bench_frame_order(0, "frame_alloc(0)", "frame_free(0)");
+  ok = bench_frame_order(5, "frame_alloc(5)", "frame_free(5)") && ok;
+  ok = bench_frame_runs() && ok;
+
+  unsigned long frame = frame_alloc(0);
+  if(!frame || !frame_free(frame, 0) || frame_free(frame, 0) || frame_free(frame + 0x800, 0))
+    ok = false;
+
+  return ok;
+}
+
+#define SLAB_TEST_OBJECTS 300
+#define SLAB_TEST_MAGIC 0xC0FFEE
+
+typedef struct slab_test_object slab_test_object;
+
+struct slab_test_object
+{
+  unsigned int magic;
+  unsigned int owner;
+  char pad[32];
+};
+
+static void* objects[SLAB_TEST_OBJECTS];
+
+static void slab_test_ctor(void* obj)
+{
+  ((slab_test_object*)obj)->magic = SLAB_TEST_MAGIC;
+  ((slab_test_object*)obj)->owner = 0;
+  return;
+}
+
+// Objects are handed out aligned, constructed and never twice, over several slabs.
+static bool test_slab_cache()
+{
+  kmem_cache* cache = kmem_cache_create("selftest", sizeof(slab_test_object), 16, slab_test_ctor);
+  if(!cache)
+    return false;
+
+  bool ok = true;
+  unsigned int count = 0;
+
+  bench_begin();
+  for(; count < SLAB_TEST_OBJECTS; count++)
+    if(!(objects[count] = kmem_cache_alloc(cache)))
+      break;
+  bench_end("kmem_cache_alloc", SLAB_TEST_OBJECTS);
+
+  for(unsigned int i = 0; i < count; i++)
+    {
+      slab_test_object* obj = objects[i];
+      if(((unsigned long)obj & 15) || obj->magic != SLAB_TEST_MAGIC || obj->owner)
+	ok = false;
+      obj->owner = i + 1;
+    }
+
+  for(unsigned int i = 0; i < count; i++)
+    if(((slab_test_object*)objects[i])->owner != i + 1)
+      ok = false;
+
+  if(count != SLAB_TEST_OBJECTS || kmem_cache_destroy(cache))
+    ok = false;
+
+  // Hand them back in constructed state, odd ones first.
+  for(unsigned int i = 0; i < count; i++)
+    ((slab_test_object*)objects[i])->owner = 0;
+
+  bench_begin();
+  for(unsigned int start = 0; start < 2; start++)
+    for(unsigned int i = 1 - start; i < count; i += 2)
+      kmem_cache_free(cache, objects[i]);
+  bench_end("kmem_cache_free", SLAB_TEST_OBJECTS);
+
+  // Reused objects must come back constructed.
+  slab_test_object* obj = kmem_cache_alloc(cache);
+  if(!obj || obj->magic != SLAB_TEST_MAGIC || obj->owner)
+    ok = false;
+  kmem_cache_free(cache, obj);
+
+  return kmem_cache_destroy(cache) && ok;
+}
+
+// kmem_alloc picks the smallest size class that fits.
+static bool test_slab_sizes()
+{
+  unsigned int sizes[] = {1, 16, 17, 48, 49, 100, 200, 384, 511, 512};
+  unsigned int fits[] = {16, 16, 32, 48, 64, 128, 256, 384, 512, 512};
+  bool ok = !kmem_alloc(0) && !kmem_alloc(SLAB_MAX_SIZE + 1);
+
+  for(unsigned int i = 0; i < sizeof(sizes) / sizeof(unsigned int); i++)
+    {
+      void* obj = kmem_alloc(sizes[i]);
+      if(!obj || kmem_size(obj) != fits[i])
+	ok = false;
+      kmem_free(obj);
+    }
+
+  bench_begin();
+  for(unsigned int i = 0; i < BENCH_ROUNDS; i++)
+    kmem_free(kmem_alloc(64));
+  bench_end("kmem_alloc and kmem_free of 64 bytes", BENCH_ROUNDS);
+
+  return ok;
+}
+
+#define SMALL_TEST_OBJECTS 1024
+
+extern int l_smallClasses;
+
+static void* small_objects[SMALL_TEST_OBJECTS];
+
+/* Allocates SMALL_TEST_OBJECTS objects of one size through malloc(),
+ * from the size classes or, with them switched off, from liballoc's
+ * boundary tags, and frees them again. Reports the cycles per malloc
+ * and free pair and the pages the objects took, per object.
+ */
+static bool bench_small_objects(unsigned int size, bool classes, unsigned int* cycles, unsigned int* bytes)
+{
+  unsigned int pages = vmm_pages_used();
+  unsigned int count = 0;
+  bool ok = true;
+
+  l_smallClasses = classes;
+  unsigned long long start = rdtsc();
+  for(; count < SMALL_TEST_OBJECTS; count++)
+    if(!(small_objects[count] = malloc(size)))
+      break;
+  unsigned int held = vmm_pages_used() - pages;
+  for(unsigned int i = 0; i < count; i++)
+    {
+      if((get_page_tag((unsigned long)small_objects[i]) == PAGE_TAG_SLAB) != classes)
+	ok = false;
+      free(small_objects[i]);
+    }
+  unsigned long long elapsed = rdtsc() - start;
+  l_smallClasses = 1;
+
+  if((int)held < 0)
+    held = 0;
+  *cycles = (elapsed >> 32) ? 0 : (unsigned int)elapsed / SMALL_TEST_OBJECTS;
+  *bytes = held * FRAME_SIZE / SMALL_TEST_OBJECTS;
+
+  return ok && count == SMALL_TEST_OBJECTS;
+}
+
+// The size classes against the boundary tags they replace, 16 to 512 bytes.
+static bool test_small_objects()
+{
+  bool ok = true;
+
+  for(unsigned int size = 16; size <= LIBALLOC_SMALL_MAX; size <<= 1)
+    {
+      unsigned int slab_cycles, slab_bytes, tag_cycles, tag_bytes;
+
+      ok = bench_small_objects(size, true, &slab_cycles, &slab_bytes) && ok;
+      ok = bench_small_objects(size, false, &tag_cycles, &tag_bytes) && ok;
+
+      if(tsc_khz)
+	print("  %u bytes: slab %u cycles, %u bytes each; boundary tags %u cycles, %u bytes each\n",
+	      size, slab_cycles, slab_bytes, tag_cycles, tag_bytes);
+    }
+
+  return ok;
+}
+
+#define TRACE_OPS 16384
+#define TRACE_SLOTS 512
+
+typedef struct trace_op trace_op;
+
+struct trace_op
+{
+  unsigned short slot;
+  unsigned short size;
+};
+
+static trace_op trace[TRACE_OPS];
+static void* trace_live[TRACE_SLOTS];
+static unsigned int trace_sizes[TRACE_SLOTS];
+
+// Mostly small objects with one in eight up to a page, the mix the kernel makes.
+static void make_trace()
+{
+  bench_seed = 1;
+
+  for(unsigned int i = 0; i < TRACE_OPS; i++)
+    {
+      unsigned int r = bench_random();
+      trace[i].slot = bench_random() % TRACE_SLOTS;
+      trace[i].size = (r & 7) ? 8 + (r >> 3) % (LIBALLOC_SMALL_MAX - 7) : LIBALLOC_SMALL_MAX + 1 + (r >> 3) % 3584;
+    }
+
+  return;
+}
+
+/* Replays the trace: an op on an empty slot mallocs its size, one on a
+ * live slot frees it. Reports operations per second, the pages held
+ * against the bytes live at the end, and the pages still held once the
+ * rest is freed.
+ */
+static bool replay_trace(char* what, bool classes)
+{
+  unsigned int pages = vmm_pages_used();
+  unsigned int live = 0;
+  bool ok = true;
+
+  l_smallClasses = classes;
+  unsigned long long start = rdtsc();
+  for(unsigned int i = 0; i < TRACE_OPS; i++)
+    {
+      unsigned int slot = trace[i].slot;
+
+      if(trace_live[slot])
+	{
+	  free(trace_live[slot]);
+	  trace_live[slot] = NULL;
+	  live -= trace_sizes[slot];
+	}
+      else if((trace_live[slot] = malloc(trace[i].size)))
+	{
+	  trace_sizes[slot] = trace[i].size;
+	  live += trace[i].size;
+	}
+      else
+	ok = false;
+    }
+  unsigned long long cycles = rdtsc() - start;
+
+  unsigned int held = vmm_pages_used() - pages;
+  for(unsigned int slot = 0; slot < TRACE_SLOTS; slot++)
+    {
+      free(trace_live[slot]);
+      trace_live[slot] = NULL;
+    }
+  unsigned int kept = vmm_pages_used() - pages;
+  l_smallClasses = 1;
+
+  if((int)held < 0)
+    held = 0;
+  if((int)kept < 0)
+    kept = 0;
+
+  if(tsc_khz && !(cycles >> 32))
+    print("  %s: %u ops/s, %u KiB held for %u KiB live, %u KiB kept after freeing\n", what,
+	  (unsigned int)bench_div((unsigned long long)TRACE_OPS * tsc_khz * 1000, cycles),
+	  held * (FRAME_SIZE / 1024), live / 1024, kept * (FRAME_SIZE / 1024));
+
+  return ok;
+}
+
+// The same trace through the boundary tags alone, then with the size classes in front.
+static bool test_malloc_trace()
+{
+  make_trace();
+
+  bool ok = replay_trace("boundary tags only", false);
+  return replay_trace("size classes in front", true) && ok;
+}
+
+// Small mallocs come from the size classes, and realloc moves data across the boundary.
+static bool test_malloc_sizes()
+{
+  bool ok = true;
+
+  unsigned char* small = malloc(24);
+  if(!small || get_page_tag((unsigned long)small) != PAGE_TAG_SLAB || liballoc_small_size(small) != 32)
+    ok = false;
+
+  for(unsigned int i = 0; small && i < 24; i++)
+    small[i] = i;
+
+  unsigned char* large = realloc(small, LIBALLOC_SMALL_MAX + 100);
+  if(!large || get_page_tag((unsigned long)large) == PAGE_TAG_SLAB || liballoc_small_size(large))
+    ok = false;
+
+  for(unsigned int i = 0; large && i < 24; i++)
+    if(large[i] != i)
+      ok = false;
+
+  small = realloc(large, 40);
+  if(!small || liballoc_small_size(small) != 48)
+    ok = false;
+
+  for(unsigned int i = 0; small && i < 24; i++)
+    if(small[i] != i)
+      ok = false;
+  free(small);
+
+  // Zeroed memory skips the size classes, whose objects are not cleared.
+  unsigned int* zeroed = calloc(4, sizeof(unsigned int));
+  if(!zeroed || get_page_tag((unsigned long)zeroed) == PAGE_TAG_SLAB)
+    ok = false;
+  for(unsigned int i = 0; zeroed && i < 4; i++)
+    if(zeroed[i])
+      ok = false;
+  free(zeroed);
+
+  bench_begin();
+  for(unsigned int i = 0; i < BENCH_ROUNDS; i++)
+    free(malloc(64));
+  bench_end("malloc and free of 64 bytes", BENCH_ROUNDS);
+
+  bench_begin();
+  for(unsigned int i = 0; i < BENCH_ROUNDS; i++)
+    free(malloc(LIBALLOC_SMALL_MAX + 100));
+  bench_end("malloc and free of 612 bytes", BENCH_ROUNDS);
+
+  return ok;
+}
+
+#define STRING_TEST_PAGES 256
+#define STRING_TEST_ROUNDS 16
+
+// Times the copy and fill paths, from the byte loops to the non-temporal SSE stores.
+static bool test_string()
+{
+  unsigned char* a = (unsigned char*)palloc(STRING_TEST_PAGES);
+  unsigned char* b = (unsigned char*)palloc(STRING_TEST_PAGES);
+  unsigned int sizes[] = {64, 4096, 64 * 1024, STRING_TEST_PAGES * FRAME_SIZE};
+  char* names[] = {"64 B", "4 KiB", "64 KiB", "1 MiB"};
+  bool ok = a && b;
+
+  for(unsigned int i = 0; ok && i < sizeof(sizes) / sizeof(unsigned int); i++)
+    {
+      unsigned int rounds = STRING_TEST_ROUNDS * (STRING_TEST_PAGES * FRAME_SIZE / sizes[i]);
+
+      print("  %s:\n", names[i]);
+
+      bench_begin();
+      for(unsigned int r = 0; r < STRING_TEST_ROUNDS; r++)
+	for(unsigned int at = 0; at < STRING_TEST_PAGES * FRAME_SIZE; at += sizes[i])
+	  memset(a + at, r, sizes[i]);
+      bench_bytes("memset", rounds * sizes[i]);
+
+      bench_begin();
+      for(unsigned int r = 0; r < STRING_TEST_ROUNDS; r++)
+	for(unsigned int at = 0; at < STRING_TEST_PAGES * FRAME_SIZE; at += sizes[i])
+	  memcpy(b + at, a + at, sizes[i]);
+      bench_bytes("memcpy", rounds * sizes[i]);
+
+      if(a[sizes[i] - 1] != STRING_TEST_ROUNDS - 1 || memcmp(a, b, STRING_TEST_PAGES * FRAME_SIZE))
+	ok = false;
+    }
+
+  // A downward overlapping move large enough to be split into masked chunks.
+  if(ok)
+    {
+      for(unsigned int i = 0; i < STRING_TEST_PAGES * FRAME_SIZE; i++)
+	a[i] = i;
+      memmove(a + 5, a, STRING_TEST_PAGES * FRAME_SIZE - 5);
+      for(unsigned int i = 5; i < STRING_TEST_PAGES * FRAME_SIZE; i++)
+	if(a[i] != (unsigned char)(i - 5))
+	  ok = false;
+    }
+
+  if(a)
+    pfree((unsigned long)a, STRING_TEST_PAGES);
+  if(b)
+    pfree((unsigned long)b, STRING_TEST_PAGES);
+
+  return ok;
+}
+
+#define TLB_TEST_PAGES 2048
+#define TLB_TEST_ROUNDS 8
+
+// Touches one word in every page of a region, returning cycles per page.
+static unsigned int page_walk_cycles(volatile unsigned int* region, unsigned int pages)
+{
+  unsigned long long start = rdtsc();
+
+  for(unsigned int r = 0; r < TLB_TEST_ROUNDS; r++)
+    for(unsigned int i = 0; i < pages; i++)
+      region[i * (FRAME_SIZE / sizeof(unsigned int))]++;
+
+  unsigned long long cycles = rdtsc() - start;
+  return cycles >> 32 ? 0 : (unsigned int)cycles / (pages * TLB_TEST_ROUNDS);
+}
+
+// The kernel is identity mapped with nothing below it, and long runs get
+// 4 MiB pages, which need far fewer TLB entries to walk.
+static bool test_kernel_mappings()
+{
+  bool ok = virt_to_phys(stext) == stext && virt_to_phys(sdata) == sdata && !virt_to_phys(FRAME_SIZE);
+
+  unsigned long large = palloc(TLB_TEST_PAGES);
+  unsigned long small = palloc_zeroed(TLB_TEST_PAGES);
+
+  if(!large || !small)
+    ok = false;
+  else if(tsc_khz)
+    {
+      page_walk_cycles((unsigned int*)large, TLB_TEST_PAGES);
+      page_walk_cycles((unsigned int*)small, TLB_TEST_PAGES);
+      print("  palloc, %s: %u cycles per page\n", virt_to_phys(large) == large ? "4 MiB pages" : "4 KiB pages",
+	    page_walk_cycles((unsigned int*)large, TLB_TEST_PAGES));
+      print("  palloc_zeroed, 4 KiB pages: %u cycles per page\n",
+	    page_walk_cycles((unsigned int*)small, TLB_TEST_PAGES));
+    }
+
+  if(large)
+    pfree(large, TLB_TEST_PAGES);
+  if(small)
+    pfree(small, TLB_TEST_PAGES);
+
+  return ok;
+}
+
+// Only runs that were handed out can be freed, and freeing one leaves nothing mapped.
+static bool test_pfree()
+{
+  unsigned int used = vmm_pages_used();
+  unsigned long run = palloc(9);
+  bool ok = run && vmm_pages_used() == used + 9;
+
+  if(run)
+    {
+      if(!pfree(run + 8 * FRAME_SIZE, 1) || pfree(run, 9) || pfree(run + 1, 1))
+	ok = false;
+      if(!pfree(run, 8) || pfree(run, 8) || virt_to_phys(run))
+	ok = false;
+    }
+  if(vmm_pages_used() != used)
+    ok = false;
+
+  // Long runs may be identity mapped, with 4 KiB pages after the 4 MiB ones.
+  unsigned long identity = palloc(1024 + 3);
+  if(!identity)
+    return false;
+
+  if(!pfree(identity, 1024 + 3) || pfree(identity, 1024 + 3))
+    ok = false;
+  if(virt_to_phys(identity) || virt_to_phys(identity + 1024 * FRAME_SIZE))
+    ok = false;
+
+  return ok;
+}
+
+#define LAZY_TEST_PAGES 16
+
+extern stat_counter minor_faults;
+
+static bool lazy_touch(unsigned long run, unsigned int first, unsigned int step)
+{
+  bool ok = true;
+
+  for(unsigned int i = first; i < LAZY_TEST_PAGES; i += step)
+    {
+      volatile unsigned int* word = (unsigned int*)(run + i * FRAME_SIZE);
+      if(*word)
+	ok = false;
+      *word = i + 1;
+    }
+
+  return ok;
+}
+
+// Counts the pages of run backed by a frame of their own.
+static unsigned int lazy_backed(unsigned long run)
+{
+  unsigned int backed = 0;
+
+  for(unsigned int i = 0; i < LAZY_TEST_PAGES; i++)
+    {
+      unsigned long phys = virt_to_phys(run + i * FRAME_SIZE);
+      if(!phys)
+	continue;
+
+      backed++;
+      for(unsigned int j = 0; j < i; j++)
+	if(virt_to_phys(run + j * FRAME_SIZE) == phys)
+	  return ~0U;
+    }
+
+  return backed;
+}
+
+/* A lazy run is backed one zeroed frame and one minor fault per page on
+ * first touch, and nothing more after that. It may be freed with some of
+ * its pages never touched.
+ */
+static bool test_lazy()
+{
+  unsigned long run = palloc_lazy(LAZY_TEST_PAGES);
+  if(!run)
+    return false;
+
+  bool ok = lazy_backed(run) == 0;
+  unsigned int faults = stat_total(&minor_faults);
+
+  bench_begin();
+  ok = lazy_touch(run, 0, 1) && ok;
+  bench_end("first touch of a page", LAZY_TEST_PAGES);
+
+  ok = ok && stat_total(&minor_faults) == faults + LAZY_TEST_PAGES && lazy_backed(run) == LAZY_TEST_PAGES;
+
+  faults = stat_total(&minor_faults);
+  for(unsigned int i = 0; i < LAZY_TEST_PAGES; i++)
+    if(*(volatile unsigned int*)(run + i * FRAME_SIZE) != i + 1)
+      ok = false;
+  ok = ok && stat_total(&minor_faults) == faults;
+
+  if(!pfree(run, LAZY_TEST_PAGES) || virt_to_phys(run))
+    ok = false;
+
+  run = palloc_lazy(LAZY_TEST_PAGES);
+  if(!run)
+    return false;
+
+  ok = lazy_touch(run, 0, 2) && ok;
+  ok = ok && lazy_backed(run) == LAZY_TEST_PAGES / 2 && !virt_to_phys(run + FRAME_SIZE);
+
+  if(!pfree(run, LAZY_TEST_PAGES) || lazy_backed(run))
+    ok = false;
+
+  return ok;
+}
+
+#define CONSOLE_TEST_CHARS 40
+#define CONSOLE_TEST_LINES 10000
+
+/* Prints CONSOLE_TEST_LINES lines, each scrolling the screen and going
+ * out through the serial ring, then compares one flush for a whole
+ * print() with one flush per character.
+ */
+static bool test_console()
+{
+  if(!tsc_khz)
+    return true;
+
+  unsigned long long lines_start = rdtsc();
+  for(unsigned int i = 0; i < CONSOLE_TEST_LINES; i++)
+    print("  console line %u\n", i);
+  unsigned long long lines = rdtsc() - lines_start;
+  print("  print of %u lines: %u thousand cycles, %u cycles per line (%u ms)\n", CONSOLE_TEST_LINES,
+	(unsigned int)bench_div(lines, 1000), (unsigned int)bench_div(lines, CONSOLE_TEST_LINES),
+	(unsigned int)bench_div(lines, tsc_khz));
+
+  unsigned long long start = rdtsc();
+  print("  print of %u characters: ........................................", CONSOLE_TEST_CHARS);
+  unsigned long long cycles = rdtsc() - start;
+  print(" %u cycles\n", (unsigned int)cycles);
+
+  print("  putch of %u characters: ", CONSOLE_TEST_CHARS);
+  start = rdtsc();
+  for(unsigned int i = 0; i < CONSOLE_TEST_CHARS; i++)
+    putch('.');
+  cycles = rdtsc() - start;
+  print(" %u cycles\n", (unsigned int)cycles);
+
+  start = rdtsc();
+  flush_console();
+  cycles = rdtsc() - start;
+  print("  flush with nothing to copy: %u cycles\n", (unsigned int)cycles);
+
+  return true;
+}
+
+#define SCHED_TEST_MAX_THREADS 33
+#define SCHED_TEST_RUN_NS 50000000ULL
+#define SCHED_TEST_WAIT_NS 5000000000ULL
+
+typedef struct sched_worker sched_worker;
+
+struct sched_worker
+{
+  unsigned int value;
+  volatile bool done;
+  volatile bool fpu_ok;
+  volatile unsigned int cpus;
+  volatile unsigned long long started;
+  volatile unsigned long long finished;
+};
+
+static sched_worker sched_workers[SCHED_TEST_MAX_THREADS];
+
+/* Spins without ever yielding, keeping a value of its own in xmm0, or on
+ * top of the x87 stack without SSE, so that only preemption lets the
+ * other workers run and a lost FPU context shows up as a changed value.
+ */
+static void sched_spin(void* arg)
+{
+  sched_worker* w = arg;
+  unsigned int value = 0;
+  bool ok = true;
+
+  w->started = ktime_ns();
+  unsigned long long until = w->started + SCHED_TEST_RUN_NS;
+
+  if(sse_enabled)
+    __asm__ __volatile__ ("movd %%xmm0, %0" :: "r"(w->value));
+  else
+    __asm__ __volatile__ ("fild dword ptr [%0]" :: "r"(&w->value) : "memory");
+
+  while(ktime_ns() < until)
+    {
+      w->cpus |= 1U << cpu_id();
+
+      if(sse_enabled)
+	__asm__ __volatile__ ("movd %0, %%xmm0" : "=r"(value));
+      else
+	__asm__ __volatile__ ("fist dword ptr [%0]" :: "r"(&value) : "memory");
+      if(value != w->value)
+	ok = false;
+    }
+
+  if(!sse_enabled)
+    __asm__ __volatile__ ("fstp st(0)");
+
+  w->finished = ktime_ns();
+  w->fpu_ok = ok;
+  __sync_synchronize();
+  w->done = true;
+
+  return;
+}
+
+/* Runs more spinning workers than there are processors. Each must start
+ * before the first one is done, which takes time slicing, and with more
+ * than one processor the work has to spread beyond the one that queued it.
+ */
+static bool test_sched()
+{
+  unsigned int count = 2 * smp_cpu_count() + 1;
+  if(count > SCHED_TEST_MAX_THREADS)
+    count = SCHED_TEST_MAX_THREADS;
+
+  memset(sched_workers, 0, sizeof(sched_workers));
+  for(unsigned int i = 0; i < count; i++)
+    {
+      sched_workers[i].value = 0x5EED0000 + i;
+      if(!thread_create(sched_spin, &sched_workers[i], THREAD_PRIORITY_NORMAL))
+	return false;
+    }
+
+  // This is the idle thread, so it only gets back here once a processor has nothing else to run.
+  unsigned long long deadline = ktime_ns() + SCHED_TEST_WAIT_NS;
+  unsigned int done = 0;
+  while(done < count && ktime_ns() < deadline)
+    {
+      thread_yield();
+      for(done = 0; done < count && sched_workers[done].done; done++);
+    }
+
+  if(done < count)
+    {
+      print("  only %u of %u workers finished\n", done, count);
+      return false;
+    }
+
+  unsigned long long first_finish = ~0ULL;
+  unsigned int cpus = 0;
+  unsigned int migrated = 0;
+  bool ok = true;
+
+  for(unsigned int i = 0; i < count; i++)
+    {
+      sched_worker* w = &sched_workers[i];
+      if(w->finished < first_finish)
+	first_finish = w->finished;
+      cpus |= w->cpus;
+      if(w->cpus & (w->cpus - 1))
+	migrated++;
+      if(!w->fpu_ok)
+	ok = false;
+    }
+
+  for(unsigned int i = 0; i < count; i++)
+    if(sched_workers[i].started > first_finish)
+      ok = false;
+
+  unsigned int used = 0;
+  for(; cpus; cpus &= cpus - 1)
+    used++;
+
+  print("  %u workers ran on %u processors, %u moved between them\n", count, used, migrated);
+
+  return ok && (smp_cpu_count() == 1 || used > 1);
+}
+
+static volatile unsigned int futex_word = 0;
+static volatile unsigned int futex_woken = 0;
+
+static void futex_waiter(void* arg __attribute__ ((unused)))
+{
+  while(!futex_word)
+    futex_wait(&futex_word, 0);
+
+  futex_woken = 1;
+  return;
+}
+
+/* The boot context is an idle thread, which must not block: its waits
+ * return at once. A real thread sleeps until woken.
+ */
+static bool test_futex()
+{
+  bool ok = !futex_wait(&futex_word, 0);
+
+  futex_word = 0;
+  futex_woken = 0;
+  if(!thread_create(futex_waiter, NULL, THREAD_PRIORITY_NORMAL))
+    return false;
+
+  // Give it time to go to sleep, though waking it early must work too.
+  // This context cannot sleep itself, only yield.
+  unsigned long long until = ktime_ns() + 10000000ULL;
+  while(ktime_ns() < until)
+    thread_yield();
+
+  futex_word = 1;
+  unsigned long long deadline = ktime_ns() + SCHED_TEST_WAIT_NS;
+  while(!futex_woken && ktime_ns() < deadline)
+    {
+      futex_wake(&futex_word, FUTEX_WAKE_ALL);
+      thread_yield();
+    }
+
+  return ok && futex_woken;
+}
+
+#define PINGPONG_ROUNDS 10000
+
+static volatile unsigned int pingpong_turn;
+static volatile unsigned int pingpong_done;
+static volatile unsigned long long pingpong_cycles;
+
+// Waits for its turn, then passes the token on; player 0 times the rounds.
+static void pingpong_player(void* arg)
+{
+  unsigned int self = (unsigned int)arg;
+
+  if(!thread_set_affinity(1U << (smp_cpu_count() - 1)))
+    return;
+
+  unsigned long long start = rdtsc();
+  for(unsigned int i = 0; i < PINGPONG_ROUNDS; i++)
+    {
+      while(pingpong_turn != self)
+	futex_wait(&pingpong_turn, 1 - self);
+      pingpong_turn = 1 - self;
+      futex_wake(&pingpong_turn, 1);
+    }
+
+  if(!self)
+    pingpong_cycles = rdtsc() - start;
+  __sync_fetch_and_add(&pingpong_done, 1);
+
+  return;
+}
+
+/* Two threads on one processor hand a token back and forth through a
+ * futex, so every handoff is a wake followed by a sleep and a switch.
+ */
+static bool test_pingpong()
+{
+  pingpong_turn = 0;
+  pingpong_done = 0;
+  pingpong_cycles = 0;
+
+  if(!thread_create(pingpong_player, (void*)0, THREAD_PRIORITY_NORMAL)
+     || !thread_create(pingpong_player, (void*)1, THREAD_PRIORITY_NORMAL))
+    return false;
+
+  unsigned long long deadline = ktime_ns() + SCHED_TEST_WAIT_NS;
+  while(pingpong_done < 2 && ktime_ns() < deadline)
+    thread_yield();
+
+  if(pingpong_done < 2)
+    {
+      print("  only %u of 2 players finished\n", pingpong_done);
+      return false;
+    }
+
+  if(tsc_khz && !(pingpong_cycles >> 32))
+    print("  futex ping-pong: %u cycles per switch\n", (unsigned int)pingpong_cycles / (2 * PINGPONG_ROUNDS));
+
+  return true;
+}
+
+#define SYSCALL_BENCH_ROUNDS 10000
+#define SYS_SELFTEST_DONE (SYSCALL_COUNT - 1)
+
+#define ASM_STRING(x) #x
+#define ASM_NUMBER(x) ASM_STRING(x)
+
+/* Ring 3 half of the system call benchmark, copied to a user page and
+ * entered with the rounds in esi and the result page in edi. It times
+ * SYSCALL_BENCH_ROUNDS null calls through sysenter and then through
+ * int 0x80, noting gs after each run to check the kernel gave it back,
+ * and ends its thread with SYS_SELFTEST_DONE.
+ */
+__asm__ (".pushsection .text\n"
+	 "user_bench:\n"
+	 " call .Lub_base\n"
+	 ".Lub_base:\n"
+	 " pop ebp\n"
+	 " rdtsc\n"
+	 " mov [edi], eax\n"
+	 " mov [edi + 4], edx\n"
+	 " mov ebx, esi\n"
+	 ".Lub_sysenter:\n"
+	 " xor eax, eax\n"
+	 " mov ecx, esp\n"
+	 " lea edx, [ebp + .Lub_back - .Lub_base]\n"
+	 " sysenter\n"
+	 ".Lub_back:\n"
+	 " dec ebx\n"
+	 " jnz .Lub_sysenter\n"
+	 " mov word ptr [edi + 24], gs\n"
+	 " rdtsc\n"
+	 " mov [edi + 8], eax\n"
+	 " mov [edi + 12], edx\n"
+	 " mov ebx, esi\n"
+	 ".Lub_int:\n"
+	 " xor eax, eax\n"
+	 " int 0x80\n"
+	 " dec ebx\n"
+	 " jnz .Lub_int\n"
+	 " mov word ptr [edi + 28], gs\n"
+	 " rdtsc\n"
+	 " mov [edi + 16], eax\n"
+	 " mov [edi + 20], edx\n"
+	 " mov eax, " ASM_NUMBER(SYS_SELFTEST_DONE) "\n"
+	 " int 0x80\n"
+	 ".Lub_hang:\n"
+	 " jmp .Lub_hang\n"
+	 "user_bench_end:\n"
+	 ".popsection\n");
+
+extern char user_bench[];
+extern char user_bench_end[];
+
+typedef struct user_bench_result user_bench_result;
+
+struct user_bench_result
+{
+  unsigned long long start;
+  unsigned long long sysenter_done;
+  unsigned long long int_done;
+  unsigned int sysenter_gs;
+  unsigned int int_gs;
+};
+
+static unsigned long user_pages = 0;
+static volatile bool user_bench_running = false;
+
+static unsigned int sys_selftest_done(unsigned int a __attribute__ ((unused)), unsigned int b __attribute__ ((unused)),
+				      unsigned int c __attribute__ ((unused)), unsigned int d __attribute__ ((unused)))
+{
+  if(!user_bench_running)
+    return SYSCALL_ERROR;
+
+  user_bench_running = false;
+  thread_exit();
+}
+
+// Drops to ring 3 at the copied stub, with interrupts off until the iret.
+static void user_bench_thread(void* arg __attribute__ ((unused)))
+{
+  unsigned int user_cs = (sysenter_cs + 16) | 3;
+  unsigned int user_ds = (sysenter_cs + 24) | 3;
+
+  __asm__ __volatile__ ("cli\n mov ds, %0\n mov es, %0\n mov fs, %0\n mov gs, %0\n"
+			"push %0\n push %1\n push 0x202\n push %2\n push %3\n iret"
+			:: "r"(user_ds), "r"(user_pages + 0x2000), "r"(user_cs), "r"(user_pages),
+			 "S"(SYSCALL_BENCH_ROUNDS), "D"(user_pages + 0x1000));
+  __builtin_unreachable();
+}
+
+// Null system calls from ring 3, where they come from, and with the user's gs kept.
+static bool test_syscalls()
+{
+  if(!sysenter_enabled)
+    {
+      print("  no sysenter, nothing to compare\n");
+      return true;
+    }
+
+  if(!register_syscall(SYS_SELFTEST_DONE, sys_selftest_done) || !(user_pages = palloc(2)))
+    return false;
+
+  memcpy((void*)user_pages, user_bench, user_bench_end - user_bench);
+  memset((void*)(user_pages + 0x1000), 0, 0x1000);
+
+  bool mapped = true;
+  for(unsigned long page = user_pages; page < user_pages + 0x2000; page += 0x1000)
+    mapped = mapped && map_range(page, virt_to_phys(page), 1, 7);
+
+  user_bench_running = mapped;
+  if(!mapped || !thread_create(user_bench_thread, NULL, THREAD_PRIORITY_NORMAL))
+    {
+      user_bench_running = false;
+      pfree(user_pages, 2);
+      return false;
+    }
+
+  unsigned long long deadline = ktime_ns() + SCHED_TEST_WAIT_NS;
+  while(user_bench_running && ktime_ns() < deadline)
+    thread_yield();
+
+  if(user_bench_running)
+    {
+      print("  the ring 3 thread did not finish\n");
+      return false;
+    }
+
+  user_bench_result* result = (user_bench_result*)(user_pages + 0x1000);
+  unsigned int user_ds = (sysenter_cs + 24) | 3;
+  bool ok = (result->sysenter_gs & 0xFFFF) == user_ds && (result->int_gs & 0xFFFF) == user_ds;
+
+  if(tsc_khz && ok)
+    {
+      print("  sysenter: %u cycles\n", (unsigned int)(result->sysenter_done - result->start) / SYSCALL_BENCH_ROUNDS);
+      print("  int 0x80: %u cycles\n", (unsigned int)(result->int_done - result->sysenter_done) / SYSCALL_BENCH_ROUNDS);
+    }
+
+  // The stub never runs again once it has made its last call.
+  pfree(user_pages, 2);
+  return ok;
+}
+
+static selftest selftests[] = {
+  {"frame allocator", test_frames},
+  {"slab object cache", test_slab_cache},
+  {"slab size classes", test_slab_sizes},
+  {"malloc size classes", test_malloc_sizes},
+  {"small objects against boundary tags", test_small_objects},
+  {"malloc trace replay", test_malloc_trace},
+  {"string routines", test_string},
+  {"kernel mappings and TLB reach", test_kernel_mappings},
+  {"page allocation frees", test_pfree},
+  {"lazily backed pages", test_lazy},
+  {"console output", test_console},
+  {"preemption and work stealing", test_sched},
+  {"futex waits", test_futex},
+  {"context switch ping-pong", test_pingpong},
+  {"system calls from ring 3", test_syscalls},
+};
+
+void run_selftests()
+{
+  unsigned int count = sizeof(selftests) / sizeof(selftest);
+  unsigned int passed = 0;
+
+  for(unsigned int i = 0; i < count; i++)
+    {
+      bool ok = selftests[i].run();
+      print("- %s: %s\n", selftests[i].name, ok ? "ok" : "FAILED");
+      if(ok)
+	passed++;
+    }
+
+  print("- %u of %u self tests passed.\n\n", passed, count);
+  return;
+}
+
+#endif
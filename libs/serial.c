@@ -0,0 +1,182 @@
+#include <cpu.h>
+#include <irq.h>
+#include <pic.h>
+#include <regs.h>
+#include <spinlock.h>
+#include <stats.h>
+#include <stdbool.h>
+#include <stdsymbols.h>
+#include <system.h>
+#include <serial.h>
+
+/* COM1 log sink.
+ *
+ * print() appends to a ring buffer and the UART drains it 16 bytes (one
+ * FIFO load) at a time from its transmitter-empty interrupt.
+ * serial_flush() only starts the transmitter when it is idle, so the line
+ * status register is read once per print() rather than once per byte.
+ * Until interrupts are enabled, or if the ring fills, the producer feeds
+ * the FIFO itself.
+ *
+ * There is only ever one producer, since print() holds console_lock
+ * across its output, so the producer takes no lock: it fills the slot and
+ * publishes it with a release store of ring_head. The interrupt may be
+ * taken on any processor, so draining, from the handler, serial_flush()
+ * or a producer facing a full ring, is done under serial_lock. An
+ * exception handler printing over an interrupted producer, or over a
+ * drain on its own processor, writes its bytes straight to the UART.
+ */
+
+#define COM1 0x3F8
+#define SERIAL_IRQ 4
+
+#define UART_DATA 0
+#define UART_IER 1
+#define UART_FCR 2
+#define UART_LCR 3
+#define UART_MCR 4
+#define UART_LSR 5
+#define UART_SCRATCH 7
+
+#define IER_THRE 0x02
+#define LSR_THRE 0x20
+
+#define SERIAL_FIFO 16
+#define SERIAL_RING_SIZE 4096
+
+stat_counter serial_ring_full = STAT_COUNTER("serial ring full waits");
+
+static char serial_ring[SERIAL_RING_SIZE];
+static volatile unsigned int ring_head = 0;
+static volatile unsigned int ring_tail = 0;
+
+#define NO_CPU 0xFFFFFFFF
+
+static spinlock serial_lock = SPINLOCK_INIT(NULL);
+static volatile unsigned int serial_owner = NO_CPU;
+static volatile unsigned int serial_producer = NO_CPU;
+
+static bool serial_ready = false;
+
+static unsigned int serial_acquire()
+{
+  unsigned int flags = spin_lock_irqsave(&serial_lock);
+  serial_owner = cpu_id();
+  return flags;
+}
+
+static void serial_release(unsigned int flags)
+{
+  serial_owner = NO_CPU;
+  spin_unlock_irqrestore(&serial_lock, flags);
+  return;
+}
+
+// Called with serial_lock held. A slot is only handed back to the
+// producer once its byte is out.
+static void fill_fifo()
+{
+  unsigned int head = __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE);
+  unsigned int tail = ring_tail;
+
+  for(int i = 0; i < SERIAL_FIFO && tail != head; i++, tail++)
+    outb(COM1 + UART_DATA, serial_ring[tail % SERIAL_RING_SIZE]);
+
+  __atomic_store_n(&ring_tail, tail, __ATOMIC_RELEASE);
+  outb(COM1 + UART_IER, (tail != head) ? IER_THRE : 0);
+  return;
+}
+
+static void drain()
+{
+  unsigned int flags = serial_acquire();
+  if(inb(COM1 + UART_LSR) & LSR_THRE)
+    fill_fifo();
+  serial_release(flags);
+  return;
+}
+
+static void write_through(char c)
+{
+  while(!(inb(COM1 + UART_LSR) & LSR_THRE))
+    __asm__ __volatile__ ("pause");
+  outb(COM1 + UART_DATA, c);
+  return;
+}
+
+static void serial_handler(regs* r __attribute__ ((unused)))
+{
+  drain();
+  return;
+}
+
+bool init_serial()
+{
+  outb(COM1 + UART_IER, 0);
+
+  outb(COM1 + UART_SCRATCH, 0xAE);
+  if(inb(COM1 + UART_SCRATCH) != 0xAE)
+    return false;
+
+  // 115200 baud, 8N1, FIFOs enabled and cleared, OUT2 set to route the
+  // interrupt to the PIC.
+  outb(COM1 + UART_LCR, 0x80);
+  outb(COM1 + UART_DATA, 0x01);
+  outb(COM1 + UART_IER, 0x00);
+  outb(COM1 + UART_LCR, 0x03);
+  outb(COM1 + UART_FCR, 0xC7);
+  outb(COM1 + UART_MCR, 0x0B);
+
+  install_irq_handler(PIC_BASE + SERIAL_IRQ, serial_handler);
+  irq_unmask(SERIAL_IRQ);
+
+  install_stat(&serial_ring_full);
+  serial_ready = true;
+
+  return true;
+}
+
+void serial_putch(char c)
+{
+  if(!serial_ready)
+    return;
+
+  unsigned int cpu = cpu_id();
+
+  if(serial_producer == cpu)
+    {
+      write_through(c);
+      return;
+    }
+
+  serial_producer = cpu;
+  unsigned int head = ring_head;
+
+  while(head - __atomic_load_n(&ring_tail, __ATOMIC_ACQUIRE) >= SERIAL_RING_SIZE)
+    {
+      stat_inc(&serial_ring_full);
+      if(serial_owner == cpu)
+	{
+	  write_through(c);
+	  serial_producer = NO_CPU;
+	  return;
+	}
+      drain();
+      __asm__ __volatile__ ("pause");
+    }
+
+  serial_ring[head % SERIAL_RING_SIZE] = c;
+  __atomic_store_n(&ring_head, head + 1, __ATOMIC_RELEASE);
+  serial_producer = NO_CPU;
+
+  return;
+}
+
+void serial_flush()
+{
+  if(!serial_ready || ring_tail == ring_head || serial_owner == cpu_id())
+    return;
+
+  drain();
+  return;
+}
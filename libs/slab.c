@@ -0,0 +1,333 @@
+#include <paging.h>
+#include <spinlock.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdsymbols.h>
+#include <slab.h>
+
+/* Object caches in the style of Bonwick's slab allocator.
+ *
+ * Each slab is a single page obtained from palloc(). The slab header sits
+ * at the start of the page and the objects follow it back to back, so an
+ * object's slab is found by masking off the low bits of its address and
+ * no per-object header is needed. Free objects are kept on a singly
+ * linked list threaded through the objects themselves; caches with a
+ * constructor keep that link just past the object instead, so freed
+ * objects stay in their constructed state.
+ */
+
+#define SLAB_MAGIC 0x51AB51AB
+#define SLAB_MAX_EMPTY 2
+#define PAGE_SIZE 4096
+
+typedef struct slab slab;
+
+struct slab
+{
+  unsigned int magic;
+  kmem_cache* cache;
+  slab* next;
+  slab* prev;
+  void* free;
+  unsigned int inuse;
+};
+
+struct kmem_cache
+{
+  const char* name;
+  unsigned int size;
+  unsigned int stride;
+  unsigned int link;
+  unsigned int offset;
+  unsigned int per_slab;
+  void (*ctor)(void* obj);
+  slab* partial;
+  slab* full;
+  slab* empty;
+  unsigned int slabs;
+  unsigned int empty_slabs;
+  spinlock lock;
+  kmem_cache* next;
+};
+
+static kmem_cache cache_cache;
+static kmem_cache* caches = NULL;
+static spinlock caches_lock = SPINLOCK_INIT(NULL);
+
+#define SIZE_CLASSES 10
+
+static const unsigned int size_class_sizes[SIZE_CLASSES] = {16, 32, 48, 64, 96, 128, 192, 256, 384, 512};
+static const char* size_class_names[SIZE_CLASSES] = {"size-16", "size-32", "size-48", "size-64", "size-96",
+						     "size-128", "size-192", "size-256", "size-384", "size-512"};
+
+static kmem_cache* size_caches[SIZE_CLASSES];
+static unsigned char size_index[SLAB_MAX_SIZE / SLAB_MIN_SIZE];
+
+static inline void** free_link(kmem_cache* cache, void* obj)
+{
+  return (void**)((unsigned long)obj + cache->link);
+}
+
+static void list_remove(slab** list, slab* s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    *list = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+  s->next = NULL;
+  s->prev = NULL;
+}
+
+static void list_push(slab** list, slab* s)
+{
+  s->prev = NULL;
+  s->next = *list;
+  if(*list)
+    (*list)->prev = s;
+  *list = s;
+}
+
+static void setup_cache(kmem_cache* cache, const char* name, unsigned int size, unsigned int align, void (*ctor)(void* obj))
+{
+  if(align < sizeof(void*))
+    align = sizeof(void*);
+
+  cache->name = name;
+  cache->size = size;
+  cache->ctor = ctor;
+  cache->link = ctor ? ((size + sizeof(void*) - 1) & ~(sizeof(void*) - 1)) : 0;
+  cache->stride = cache->link + (ctor ? sizeof(void*) : 0);
+  if(cache->stride < size)
+    cache->stride = size;
+  cache->stride = (cache->stride + align - 1) & ~(align - 1);
+  cache->offset = (sizeof(slab) + align - 1) & ~(align - 1);
+  cache->per_slab = (PAGE_SIZE - cache->offset) / cache->stride;
+  cache->partial = NULL;
+  cache->full = NULL;
+  cache->empty = NULL;
+  cache->slabs = 0;
+  cache->empty_slabs = 0;
+  cache->lock = (spinlock)SPINLOCK_INIT(NULL);
+  cache->next = NULL;
+}
+
+static slab* grow_cache(kmem_cache* cache)
+{
+  slab* s = (slab*)palloc(1);
+
+  if(!s)
+    return NULL;
+
+  set_page_tag((unsigned long)s, PAGE_TAG_SLAB);
+
+  s->magic = SLAB_MAGIC;
+  s->cache = cache;
+  s->next = NULL;
+  s->prev = NULL;
+  s->inuse = 0;
+  s->free = NULL;
+
+  for(unsigned int i = cache->per_slab; i > 0; --i) {
+    void* obj = (void*)((unsigned long)s + cache->offset + (i - 1) * cache->stride);
+    if(cache->ctor)
+      cache->ctor(obj);
+    *free_link(cache, obj) = s->free;
+    s->free = obj;
+  }
+
+  cache->slabs++;
+
+  return s;
+}
+
+static void release_slab(kmem_cache* cache, slab* s)
+{
+  s->magic = 0;
+  cache->slabs--;
+  set_page_tag((unsigned long)s, PAGE_TAG_NONE);
+  pfree((unsigned long)s, 1);
+}
+
+static void link_cache(kmem_cache* cache)
+{
+  unsigned int flags = spin_lock_irqsave(&caches_lock);
+  cache->next = caches;
+  caches = cache;
+  spin_unlock_irqrestore(&caches_lock, flags);
+}
+
+bool init_slab()
+{
+  setup_cache(&cache_cache, "kmem_cache", sizeof(kmem_cache), 0, NULL);
+  link_cache(&cache_cache);
+
+  for(unsigned int i = 0, index = 0; i < SIZE_CLASSES; i++) {
+    size_caches[i] = kmem_cache_create(size_class_names[i], size_class_sizes[i], 0, NULL);
+    if(!size_caches[i])
+      return false;
+    for(; index < size_class_sizes[i] / SLAB_MIN_SIZE; index++)
+      size_index[index] = i;
+  }
+
+  return true;
+}
+
+kmem_cache* kmem_cache_create(const char* name, unsigned int size, unsigned int align, void (*ctor)(void* obj))
+{
+  if(!size || (align & (align - 1)))
+    return NULL;
+
+  kmem_cache* cache = kmem_cache_alloc(&cache_cache);
+
+  if(!cache)
+    return NULL;
+
+  setup_cache(cache, name, size, align, ctor);
+
+  if(!cache->per_slab) {
+    kmem_cache_free(&cache_cache, cache);
+    return NULL;
+  }
+
+  link_cache(cache);
+
+  return cache;
+}
+
+bool kmem_cache_destroy(kmem_cache* cache)
+{
+  unsigned int flags = spin_lock_irqsave(&cache->lock);
+
+  if(cache->partial || cache->full) {
+    spin_unlock_irqrestore(&cache->lock, flags);
+    return false;
+  }
+
+  while(cache->empty) {
+    slab* s = cache->empty;
+    list_remove(&cache->empty, s);
+    release_slab(cache, s);
+  }
+  spin_unlock_irqrestore(&cache->lock, flags);
+
+  flags = spin_lock_irqsave(&caches_lock);
+  for(kmem_cache** curr = &caches; *curr; curr = &(*curr)->next)
+    if(*curr == cache) {
+      *curr = cache->next;
+      break;
+    }
+  spin_unlock_irqrestore(&caches_lock, flags);
+
+  kmem_cache_free(&cache_cache, cache);
+
+  return true;
+}
+
+void* kmem_cache_alloc(kmem_cache* cache)
+{
+  unsigned int flags = spin_lock_irqsave(&cache->lock);
+  slab* s = cache->partial;
+
+  if(!s) {
+    if(cache->empty) {
+      s = cache->empty;
+      list_remove(&cache->empty, s);
+      cache->empty_slabs--;
+    } else if(!(s = grow_cache(cache))) {
+      spin_unlock_irqrestore(&cache->lock, flags);
+      return NULL;
+    }
+    list_push(&cache->partial, s);
+  }
+
+  void* obj = s->free;
+  s->free = *free_link(cache, obj);
+  s->inuse++;
+
+  if(!s->free) {
+    list_remove(&cache->partial, s);
+    list_push(&cache->full, s);
+  }
+
+  spin_unlock_irqrestore(&cache->lock, flags);
+
+  return obj;
+}
+
+void kmem_cache_free(kmem_cache* cache, void* obj)
+{
+  slab* s = (slab*)((unsigned long)obj & ~(PAGE_SIZE - 1));
+
+  if(!obj || s->magic != SLAB_MAGIC || s->cache != cache)
+    return;
+
+  unsigned int flags = spin_lock_irqsave(&cache->lock);
+
+  if(!s->free) {
+    list_remove(&cache->full, s);
+    list_push(&cache->partial, s);
+  }
+
+  *free_link(cache, obj) = s->free;
+  s->free = obj;
+
+  if(!--s->inuse) {
+    list_remove(&cache->partial, s);
+    if(cache->empty_slabs >= SLAB_MAX_EMPTY) {
+      release_slab(cache, s);
+    } else {
+      list_push(&cache->empty, s);
+      cache->empty_slabs++;
+    }
+  }
+
+  spin_unlock_irqrestore(&cache->lock, flags);
+}
+
+void* kmem_alloc(unsigned int size)
+{
+  if(!size || size > SLAB_MAX_SIZE)
+    return NULL;
+
+  kmem_cache* cache = size_caches[size_index[(size - 1) / SLAB_MIN_SIZE]];
+
+  if(!cache)
+    return NULL;
+
+  return kmem_cache_alloc(cache);
+}
+
+void kmem_free(void* obj)
+{
+  slab* s = (slab*)((unsigned long)obj & ~(PAGE_SIZE - 1));
+
+  if(!obj || s->magic != SLAB_MAGIC)
+    return;
+
+  kmem_cache_free(s->cache, obj);
+}
+
+unsigned int kmem_size(void* obj)
+{
+  slab* s = (slab*)((unsigned long)obj & ~(PAGE_SIZE - 1));
+
+  if(!obj || s->magic != SLAB_MAGIC)
+    return 0;
+
+  return s->cache->size;
+}
+
+void print_slab_info()
+{
+  print("Object caches:\n");
+
+  unsigned int flags = spin_lock_irqsave(&caches_lock);
+  for(kmem_cache* curr = caches; curr; curr = curr->next)
+    print("- %s: %u byte objects, %u per slab, %u bytes each, %u slabs\n",
+	  curr->name, curr->size, curr->per_slab, PAGE_SIZE / curr->per_slab, curr->slabs);
+  spin_unlock_irqrestore(&caches_lock, flags);
+
+  return;
+}
@@ -0,0 +1,301 @@
+#include <access.h>
+#include <apic.h>
+#include <clock.h>
+#include <cpu.h>
+#include <gdt.h>
+#include <idle.h>
+#include <idt.h>
+#include <interrupt_handler.h>
+#include <paging.h>
+#include <regs.h>
+#include <spinlock.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdsymbols.h>
+#include <string.h>
+#include <system.h>
+#include <systemcall.h>
+#include <smp.h>
+
+/* Multiprocessor start-up.
+ *
+ * Every processor gets a cpu_data area, reached through a GS segment whose
+ * base is that area, and its own TSS. Both are appended to the shared GDT.
+ * Application processors are started one at a time with INIT-SIPI-SIPI
+ * through the real mode trampoline in trampoline.asm, each on a freshly
+ * allocated kernel stack. Once up they enter the idle loop, where
+ * run_cpu_work() picks up functions posted with smp_run_on().
+ *
+ * A start the AP has not claimed by the deadline is withdrawn by taking
+ * the trampoline ticket back, so a late AP halts without using the stack,
+ * which can be freed, and the slot, with its GDT descriptors, goes to the
+ * next processor. An AP that claimed its start but never came online may
+ * still be running on its stack and slot, so both are left to it and no
+ * further processors are started.
+ */
+
+#define ICR_DELIVERY_PENDING (1 << 12)
+#define ICR_INIT 0x00004500
+#define ICR_STARTUP 0x00004600
+
+typedef struct trampoline_params trampoline_params;
+
+struct trampoline_params
+{
+  unsigned int cr3;
+  unsigned int cr4;
+  unsigned int stack;
+  unsigned int entry;
+  unsigned int cpu;
+  volatile unsigned int ticket;
+};
+
+extern unsigned char smp_trampoline[], smp_trampoline_params[], smp_trampoline_end[];
+extern unsigned char boot_stack_top[];
+
+bool cpu_data_ready = false;
+
+static cpu_data cpus[MAX_CPUS];
+static unsigned int cpu_count = 1;
+
+static spinlock work_lock = SPINLOCK_INIT(NULL);
+
+unsigned int smp_cpu_count()
+{
+  return cpu_count;
+}
+
+unsigned int smp_online_mask()
+{
+  unsigned int mask = 0;
+
+  for(unsigned int i = 0; i < cpu_count; i++)
+    if(cpus[i].online)
+      mask |= 1 << i;
+
+  return mask;
+}
+
+cpu_data* cpu_local()
+{
+  cpu_data* cpu;
+
+  if(!cpu_data_ready)
+    return &cpus[0];
+
+  __asm__ __volatile__ ("mov %0, %%gs:[8]" : "=r"(cpu));
+  return cpu;
+}
+
+static bool setup_cpu_data(unsigned int index, unsigned int apic_id, unsigned long stack_top)
+{
+  cpu_data* cpu = &cpus[index];
+
+  cpu->id = index;
+  cpu->apic_id = apic_id;
+  cpu->self = cpu;
+  cpu->stack = stack_top;
+  cpu->online = false;
+  cpu->work = NULL;
+
+  memset(&cpu->tss, 0, sizeof(tss_entry));
+  cpu->tss.ss0 = (k_data + 1) << 3;
+  cpu->tss.esp0 = stack_top;
+  cpu->tss.iomap_base = sizeof(tss_entry);
+
+  if(!cpu->gs_selector)
+    cpu->gs_selector = add_gdt_system_entry((unsigned int)cpu, sizeof(cpu_data) - 1, 0x92, 0x40);
+  if(!cpu->tss_selector)
+    cpu->tss_selector = add_gdt_system_entry((unsigned int)&cpu->tss, sizeof(tss_entry) - 1, 0x89, 0x00);
+
+  // Where load_cpu_gs finds the per-CPU segment on entries from ring 3.
+  cpu->tss.gs = cpu->gs_selector;
+
+  return cpu->gs_selector && cpu->tss_selector;
+}
+
+static void load_cpu_segments(cpu_data* cpu)
+{
+  lgdt();
+  __asm__ __volatile__ ("mov %%gs, %0" :: "r"((unsigned int)cpu->gs_selector));
+  __asm__ __volatile__ ("ltr %0" :: "r"(cpu->tss_selector));
+  return;
+}
+
+static void wait_icr()
+{
+  while(lapic_read(LAPIC_ICR_LOW) & ICR_DELIVERY_PENDING)
+    __asm__ __volatile__ ("pause");
+  return;
+}
+
+static void send_icr(unsigned int apic_id, unsigned int command)
+{
+  unsigned int flags = irq_save();
+
+  lapic_write(LAPIC_ICR_HIGH, apic_id << 24);
+  lapic_write(LAPIC_ICR_LOW, command);
+  wait_icr();
+
+  irq_restore(flags);
+  return;
+}
+
+void smp_send_ipi(unsigned int cpu, unsigned char vector)
+{
+  if(apic_enabled && cpu < cpu_count)
+    send_icr(cpus[cpu].apic_id, vector);
+  return;
+}
+
+static void wake_handler(regs* r __attribute__ ((unused)))
+{
+  lapic_eoi();
+  return;
+}
+
+static bool run_cpu_work()
+{
+  cpu_data* cpu = cpu_local();
+  void (*work)(void* arg) = cpu->work;
+
+  if(!work)
+    return false;
+
+  void* arg = cpu->work_arg;
+  __sync_synchronize();
+  cpu->work = NULL;
+
+  work(arg);
+
+  return true;
+}
+
+bool smp_run_on(unsigned int cpu, void (*work)(void* arg), void* arg)
+{
+  bool posted = false;
+
+  if(cpu >= cpu_count || !cpus[cpu].online)
+    return false;
+
+  unsigned int flags = spin_lock_irqsave(&work_lock);
+  if(!cpus[cpu].work)
+    {
+      cpus[cpu].work_arg = arg;
+      __sync_synchronize();
+      cpus[cpu].work = work;
+      posted = true;
+    }
+  spin_unlock_irqrestore(&work_lock, flags);
+
+  if(posted && cpu != cpu_id())
+    smp_send_ipi(cpu, SMP_WAKE_VECTOR);
+
+  return posted;
+}
+
+static void ap_main(unsigned int index)
+{
+  cpu_data* cpu = &cpus[index];
+
+  lgdt();
+  set_segment_registers(k_text, k_data);
+  load_cpu_segments(cpu);
+  lidt();
+
+  init_cpu();
+  syscall_cpu_init();
+  lapic_write(LAPIC_TPR, 0);
+  lapic_write(LAPIC_SVR, 0x100 | APIC_SPURIOUS_VECTOR);
+
+  // A processor that missed its own start may have claimed this one.
+  cpu->apic_id = lapic_id();
+  cpu->online = true;
+
+  idle();
+}
+
+static bool ap_stuck = false;
+
+static bool start_ap(unsigned int apic_id, trampoline_params* params)
+{
+  unsigned int index = cpu_count;
+  unsigned long stack = palloc(KERNEL_STACK_PAGES);
+
+  if(!stack)
+    return false;
+
+  if(!setup_cpu_data(index, apic_id, stack + (KERNEL_STACK_PAGES << 12)))
+    {
+      pfree(stack, KERNEL_STACK_PAGES);
+      return false;
+    }
+
+  params->stack = cpus[index].stack;
+  params->entry = (unsigned int)ap_main;
+  params->cpu = index;
+  __sync_synchronize();
+  params->ticket = 1;
+
+  send_icr(apic_id, ICR_INIT);
+  udelay(10000);
+
+  // The second start-up IPI is only needed if the first was missed.
+  for(int attempt = 0; attempt < 2 && !cpus[index].online; attempt++)
+    {
+      send_icr(apic_id, ICR_STARTUP | (SMP_TRAMPOLINE >> 12));
+      for(unsigned int waited = 0; waited < (attempt ? 100000 : 200) && !cpus[index].online; waited += 10)
+	udelay(10);
+    }
+
+  if(!cpus[index].online && __sync_lock_test_and_set(&params->ticket, 0))
+    {
+      pfree(stack, KERNEL_STACK_PAGES);
+      return false;
+    }
+
+  // Claimed, so it is on its way; give it as long again to arrive.
+  for(unsigned int waited = 0; waited < 100000 && !cpus[index].online; waited += 10)
+    udelay(10);
+
+  if(!cpus[index].online)
+    {
+      ap_stuck = true;
+      return false;
+    }
+
+  cpu_count++;
+  return true;
+}
+
+bool init_smp()
+{
+  unsigned int bsp_apic_id = apic_enabled ? lapic_id() : 0;
+
+  if(!setup_cpu_data(0, bsp_apic_id, (unsigned long)boot_stack_top))
+    return false;
+
+  load_cpu_segments(&cpus[0]);
+  cpus[0].online = true;
+  cpu_data_ready = true;
+
+  int_routines[SMP_WAKE_VECTOR] = wake_handler;
+  install_idle_handler(run_cpu_work);
+
+  if(!apic_enabled || apic_cpu_count < 2)
+    return true;
+
+  if(!map_range(SMP_TRAMPOLINE, SMP_TRAMPOLINE, 1, 3))
+    return false;
+  memcpy((void*)SMP_TRAMPOLINE, smp_trampoline, smp_trampoline_end - smp_trampoline);
+
+  trampoline_params* params = (trampoline_params*)(SMP_TRAMPOLINE + (smp_trampoline_params - smp_trampoline));
+  __asm__ __volatile__ ("mov %0, %%cr3" : "=r"(params->cr3));
+  __asm__ __volatile__ ("mov %0, %%cr4" : "=r"(params->cr4));
+
+  for(unsigned int i = 0; i < apic_cpu_count && cpu_count < MAX_CPUS && !ap_stuck; i++)
+    if(apic_cpu_ids[i] != bsp_apic_id && !start_ap(apic_cpu_ids[i], params))
+      print("- Processor with APIC id %u did not start.\n", apic_cpu_ids[i]);
+
+  return true;
+}
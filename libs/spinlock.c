@@ -0,0 +1,67 @@
+#include <paging.h>
+#include <stats.h>
+#include <stdbool.h>
+#include <system.h>
+#include <spinlock.h>
+
+/* Ticket lock: each waiter takes the next ticket and spins until the
+ * owner field reaches it. Waiters back off in proportion to how many
+ * tickets are ahead of them, capped at SPIN_BACKOFF_MAX pauses, so the
+ * lock line is not hammered while the queue drains. Waiters answer TLB
+ * shootdowns as they go, since they may have interrupts masked while the
+ * holder waits for them to.
+ */
+
+#define SPIN_BACKOFF_UNIT 16
+#define SPIN_BACKOFF_MAX 1024
+
+void spin_lock(spinlock* lock)
+{
+  unsigned short ticket = __sync_fetch_and_add(&lock->next, 1);
+  unsigned short ahead = (unsigned short)(ticket - lock->owner);
+
+  if(!ahead)
+    return;
+
+  if(lock->contention)
+    stat_inc(lock->contention);
+
+  while(ahead) {
+    unsigned int delay = ahead * SPIN_BACKOFF_UNIT;
+    if(delay > SPIN_BACKOFF_MAX)
+      delay = SPIN_BACKOFF_MAX;
+    while(delay--)
+      __asm__ __volatile__ ("pause" ::: "memory");
+    tlb_shootdown_poll();
+    ahead = (unsigned short)(ticket - lock->owner);
+  }
+
+  return;
+}
+
+bool spin_trylock(spinlock* lock)
+{
+  unsigned short owner = lock->owner;
+  return __sync_bool_compare_and_swap(&lock->next, owner, (unsigned short)(owner + 1));
+}
+
+void spin_unlock(spinlock* lock)
+{
+  __asm__ __volatile__ ("" ::: "memory");
+  lock->owner = lock->owner + 1;
+  return;
+}
+
+unsigned int spin_lock_irqsave(spinlock* lock)
+{
+  unsigned int flags = irq_save();
+  spin_lock(lock);
+  return flags;
+}
+
+void spin_unlock_irqrestore(spinlock* lock, unsigned int flags)
+{
+  spin_unlock(lock);
+  irq_restore(flags);
+  return;
+}
@@ -0,0 +1,38 @@
+#include <cpu.h>
+#include <stdio.h>
+#include <stats.h>
+
+stat_counter* stats = 0;
+
+void install_stat(stat_counter* counter)
+{
+  stat_counter** curr = &stats;
+
+  while(*curr && *curr != counter)
+    curr = &(*curr)->next;
+
+  if(!*curr)
+    *curr = counter;
+
+  return;
+}
+
+unsigned int stat_total(stat_counter* counter)
+{
+  unsigned int total = 0;
+
+  for(int i = 0; i < MAX_CPUS; i++)
+    total += counter->values[i];
+
+  return total;
+}
+
+void print_stats()
+{
+  print("Statistics:\n");
+
+  for(stat_counter* curr = stats; curr; curr = curr->next)
+    print("- %s: %u\n", curr->name, stat_total(curr));
+
+  return;
+}
@@ -1,28 +1,118 @@
+#include <cpu.h>
+#include <serial.h>
+#include <spinlock.h>
 #include <stdarg.h>
+#include <stdbool.h>
+#include <stdsymbols.h>
+#include <string.h>
 #include <system.h>
 #include <stdio.h>
 
+#define CONSOLE_WIDTH 80
+#define CONSOLE_HEIGHT 25
+#define ALL_LINES ((1u << CONSOLE_HEIGHT) - 1)
+
 unsigned short *restrict videoram = (unsigned short*)0xb8000;
 unsigned short cursor = 0;
 unsigned short attributes = (0x07 << 8);
 
-void print(char* string, ...)
+// Output is written to a shadow copy of the screen. Lines that changed are
+// copied to video memory, and the hardware cursor moved, once per print()
+// rather than once per character.
+unsigned short console[CONSOLE_WIDTH * CONSOLE_HEIGHT];
+unsigned int dirty_lines = 0;
+unsigned short shown_cursor = 0xFFFF;
+
+// console_lock covers the shadow screen and the cursor, and is held
+// across a whole print() so lines from different processors do not mix.
+// console_owner is the processor holding it. If that processor asks for
+// it again, an exception has interrupted console output and its handler
+// is printing, so rather than deadlocking the handler writes straight
+// through, over whatever state the interrupted call left.
+#define NO_CPU 0xFFFFFFFF
+
+spinlock console_lock = SPINLOCK_INIT(NULL);
+volatile unsigned int console_owner = NO_CPU;
+
+static void put_char(char c);
+static void scroll_lines(unsigned char lines);
+
+static bool console_acquire(unsigned int* flags)
+{
+  unsigned int cpu = cpu_id();
+
+  if(console_owner == cpu)
+    return false;
+
+  *flags = spin_lock_irqsave(&console_lock);
+  console_owner = cpu;
+  return true;
+}
+
+static void console_release(bool locked, unsigned int flags)
+{
+  if(!locked)
+    return;
+
+  console_owner = NO_CPU;
+  spin_unlock_irqrestore(&console_lock, flags);
+  return;
+}
+
+static void flush_locked()
+{
+  while(dirty_lines)
+    {
+      unsigned int first = __builtin_ctz(dirty_lines);
+      unsigned int count = __builtin_ctz(~(dirty_lines >> first));
+
+      memcpy(videoram + first * CONSOLE_WIDTH, console + first * CONSOLE_WIDTH,
+	     count * CONSOLE_WIDTH * sizeof(unsigned short));
+      dirty_lines &= ~(((1u << count) - 1) << first);
+    }
+
+  if(cursor != shown_cursor)
+    {
+      set_cursor(cursor);
+      shown_cursor = cursor;
+    }
+
+  serial_flush();
+  return;
+}
+
+void flush_console()
+{
+  unsigned int flags = 0;
+  bool locked = console_acquire(&flags);
+
+  flush_locked();
+  console_release(locked, flags);
+  return;
+}
+
+static void put_string(char* string)
+{
+  for(; *string; string++)
+    put_char(*string);
+  return;
+}
+
+static void format(char* string, va_list list)
 {
-  va_list list;
-  va_start(list, string);
   for(int i = 0; string[i]; i++)
     {
       if(string[i] == '%' && string[i + 1]) {
 	if(string[i + 1] == 'i') {
 	  int num = va_arg(list, int);
 	  if(num < 0) {
-	    putch('-');
+	    put_char('-');
 	    num *= -1;
 	  }
 	  int pow = 1;
 	  for(int temp = num; temp >= 10; temp /= 10, pow *= 10);
 	  for(; pow != 0; pow /= 10)  {
-	    putch((char)((num / pow) + '0'));
+	    put_char((char)((num / pow) + '0'));
 	    num -= ((num / pow) * pow);
 	  }	    
 	}
@@ -31,7 +121,7 @@ void print(char* string, ...)
 	  unsigned long pow = 1;
 	  for(unsigned long temp = num; temp >= 10; temp /= 10, pow *= 10);
 	  for(; pow != 0; pow /= 10)  {
-	    putch((char)((num / pow) + '0'));
+	    put_char((char)((num / pow) + '0'));
 	    num -= ((num / pow) * pow);
 	  }	  
 	  i++;
@@ -43,121 +133,167 @@ void print(char* string, ...)
 	    for(unsigned int temp = num; temp >= 10; temp /= 10, pow *= 10);
 	    for(; pow != 0; pow /= 10)
 	      {
-		putch((char)((num / pow) + '0'));
+		put_char((char)((num / pow) + '0'));
 		num -= ((num / pow) * pow);
 	      }	    
 	  }
 	else if(string[i + 1] == 'h')
 	  {
-	    print("0x");
+	    put_string("0x");
 	    unsigned int num = va_arg(list, unsigned int);
 	    for(int digit, counter = 28; counter != -4; counter -= 4)
 	      {
 		digit = (num >> counter) & 0xF;
 		if(digit <= 9)
-		  putch((char)(digit + '0'));
+		  put_char((char)(digit + '0'));
 		else
-		  putch((char)((digit - 10) + 'A'));
+		  put_char((char)((digit - 10) + 'A'));
 	      }	    
 	  }
 	else if(string[i + 1] == 'x')
 	  {
-	    print("0x");
+	    put_string("0x");
 	    unsigned short num = (unsigned short)va_arg(list, unsigned int);
 	    if(num ==0)
-	      putch('0');
+	      put_char('0');
 	    else
 	      for(int digit, counter = 12; counter != -4; counter -= 4)
 		{
 		  digit = (num >> counter) & 0xF;
 		  if(digit <= 9)
-		    putch((char)(digit + '0'));
+		    put_char((char)(digit + '0'));
 		  else
-		    putch((char)((digit - 10) + 'A'));
+		    put_char((char)((digit - 10) + 'A'));
 		}	    
 	  }
 	else if(string[i + 1] == 'k')
 	  {
-	    print("0x");
+	    put_string("0x");
 	    unsigned char num = (unsigned char)va_arg(list, unsigned int);
 	    if(num ==0)
-	      putch('0');
+	      put_char('0');
 	    else
 	      for(int digit, counter = 4; counter != -4; counter -= 4)
 		{
 		  digit = (num >> counter) & 0xF;
 		  if(digit <= 9)
-		    putch((char)(digit + '0'));
+		    put_char((char)(digit + '0'));
 		  else
-		    putch((char)((digit - 10) + 'A'));
+		    put_char((char)((digit - 10) + 'A'));
 		}	    
 	  }
 	else if(string[i + 1] == 'c')
 	  {
 	    char c = (char)va_arg(list, int);
-	    putch(c);
+	    put_char(c);
 	  }
 	else if(string[i + 1] == 's')
 	  {
 	    char* s = va_arg(list, char*);
-	    print(s);
+	    put_string(s);
 	  }
 	else
 	  {
-	    putch('%');
+	    put_char('%');
 	    i--;
 	  }
 	i++;
 	continue;
       } else {
-	putch(string[i]);
+	put_char(string[i]);
       }
     }
   return;
 }
 
+void print(char* string, ...)
+{
+  unsigned int flags = 0;
+  bool locked = console_acquire(&flags);
+  va_list list;
+
+  va_start(list, string);
+  format(string, list);
+  va_end(list);
+
+  flush_locked();
+  console_release(locked, flags);
+  return;
+}
+
 void putch(char c)
+{
+  unsigned int flags = 0;
+  bool locked = console_acquire(&flags);
+
+  put_char(c);
+  flush_locked();
+  console_release(locked, flags);
+  return;
+}
+
+static void put_char(char c)
 {
   if(c == '\n')
+    serial_putch('\r');
+  serial_putch(c);
+
+  if(c == '\n')
+    cursor = cursor + CONSOLE_WIDTH - (cursor % CONSOLE_WIDTH);
+  else
     {
-      cursor = cursor + 80 - (cursor % 80);
-      
-      if(cursor >= (80*25))
-	scroll(1);
-      
-      return;
+      console[cursor] = (unsigned short)(c) | attributes;
+      dirty_lines |= 1u << (cursor / CONSOLE_WIDTH);
+      cursor++;
     }
-  videoram[cursor++] = (unsigned short)(c) | attributes;
-  if(cursor >= 80*25)
-    scroll(1);
-  set_cursor(cursor);
+
+  if(cursor >= CONSOLE_WIDTH * CONSOLE_HEIGHT)
+    scroll_lines(1);
+
   return;
 }
 
-void scroll(unsigned char lines)
+static void clear_locked()
+{
+  memset(console, 0, sizeof(console));
+  dirty_lines = ALL_LINES;
+  cursor = 0;
+  return;
+}
+
+static void scroll_lines(unsigned char lines)
 {
-  if(lines > 25)
+  if(lines > CONSOLE_HEIGHT)
     {
-      clear_screen();
-      cursor = 0;
-      set_cursor(cursor);
+      clear_locked();
       return;
     }
 
-  for(int i = 0; i < ((25 - lines)*80); i++)
-    videoram[i] = videoram[i + (80 * lines)];
-
-  for(int i = 80*(25-lines); i < 25*80; i++)
-    videoram[i] = (unsigned short)0;
+  memmove(console, console + (CONSOLE_WIDTH * lines),
+	  (CONSOLE_HEIGHT - lines) * CONSOLE_WIDTH * sizeof(unsigned short));
+  memset(console + CONSOLE_WIDTH * (CONSOLE_HEIGHT - lines), 0,
+	 lines * CONSOLE_WIDTH * sizeof(unsigned short));
+  dirty_lines = ALL_LINES;
 
-  if(cursor < 80*lines)
+  if(cursor < CONSOLE_WIDTH * lines)
     cursor = 0;
   else
-    cursor -= (80*lines);
+    cursor -= (CONSOLE_WIDTH * lines);
 
   return;
 }
 
+void scroll(unsigned char lines)
+{
+  unsigned int flags = 0;
+  bool locked = console_acquire(&flags);
+
+  scroll_lines(lines);
+  flush_locked();
+  console_release(locked, flags);
+  return;
+}
+
 void set_attributes(char attribs)
 {
   attributes = (((unsigned short)(attribs)) << 8);
@@ -177,16 +313,22 @@ void set_cursor(unsigned short pos)
 
 void gotoxy(unsigned short x, unsigned short y)
 {
-  cursor = 80*y + x;
-  set_cursor(cursor);
+  unsigned int flags = 0;
+  bool locked = console_acquire(&flags);
+
+  cursor = CONSOLE_WIDTH * y + x;
+  flush_locked();
+  console_release(locked, flags);
   return;
 }
 
 void clear_screen()
 {
-  for(int i = 0; i < 2000; i++)
-    videoram[i] = 0;
-  cursor = 0;
-  set_cursor(0);
+  unsigned int flags = 0;
+  bool locked = console_acquire(&flags);
+
+  clear_locked();
+  flush_locked();
+  console_release(locked, flags);
   return;
 }
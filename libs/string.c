@@ -0,0 +1,238 @@
+#include <cpu.h>
+#include <system.h>
+#include <string.h>
+
+/* Kernel string routines.
+ *
+ * Short operations use byte loops, where the start-up cost of a string
+ * instruction dominates. Longer ones align the destination and move
+ * dwords with rep movsd/stosd. Once SSE2 has been enabled, copies and
+ * fills of at least STRING_SSE_MIN bytes go through xmm0-xmm3 64 bytes
+ * at a time, switching to non-temporal stores past STRING_NT_MIN so a
+ * large copy does not evict the whole cache. The xmm registers are saved
+ * on the stack and restored around the loop, so code that also uses them
+ * is left intact. Nothing else may run on this CPU while they hold our
+ * data, or while memmove copies downwards with DF set, so those loops
+ * run with interrupts masked, STRING_IRQ_BLOCK bytes at a time to bound
+ * the latency.
+ */
+
+#define STRING_REP_MIN 16
+#define STRING_SSE_MIN 1024
+#define STRING_NT_MIN (256 * 1024)
+#define STRING_IRQ_BLOCK (16 * 1024)
+
+static inline void save_xmm(unsigned char* area)
+{
+  __asm__ __volatile__ ("movdqu [%0], %%xmm0\n movdqu [%0 + 16], %%xmm1\n"
+			"movdqu [%0 + 32], %%xmm2\n movdqu [%0 + 48], %%xmm3"
+			:: "r"(area) : "memory");
+}
+
+static inline void restore_xmm(unsigned char* area)
+{
+  __asm__ __volatile__ ("movdqu %%xmm0, [%0]\n movdqu %%xmm1, [%0 + 16]\n"
+			"movdqu %%xmm2, [%0 + 32]\n movdqu %%xmm3, [%0 + 48]"
+			:: "r"(area) : "memory");
+}
+
+static inline void copy_forward(unsigned char* dest, const unsigned char* src, size_t n)
+{
+  if(n < STRING_REP_MIN) {
+    while(n--)
+      *dest++ = *src++;
+    return;
+  }
+
+  size_t head = (-(unsigned long)dest) & 3;
+  size_t words = (n - head) >> 2;
+  size_t tail = (n - head) & 3;
+
+  __asm__ __volatile__ ("rep movsb" : "+D"(dest), "+S"(src), "+c"(head) :: "memory");
+  __asm__ __volatile__ ("rep movsd" : "+D"(dest), "+S"(src), "+c"(words) :: "memory");
+  __asm__ __volatile__ ("rep movsb" : "+D"(dest), "+S"(src), "+c"(tail) :: "memory");
+}
+
+static void sse_copy_blocks(unsigned char* dest, const unsigned char* src, size_t blocks, bool nt)
+{
+  unsigned char saved[64];
+  unsigned int flags = irq_save();
+
+  save_xmm(saved);
+  if(nt) {
+    __asm__ __volatile__ ("1:\n"
+			  "movdqu %%xmm0, [%1]\n movdqu %%xmm1, [%1 + 16]\n"
+			  "movdqu %%xmm2, [%1 + 32]\n movdqu %%xmm3, [%1 + 48]\n"
+			  "movntdq [%0], %%xmm0\n movntdq [%0 + 16], %%xmm1\n"
+			  "movntdq [%0 + 32], %%xmm2\n movntdq [%0 + 48], %%xmm3\n"
+			  "add %0, 64\n add %1, 64\n dec %2\n jnz 1b\n"
+			  "sfence"
+			  : "+r"(dest), "+r"(src), "+r"(blocks) :: "memory", "cc");
+  } else {
+    __asm__ __volatile__ ("1:\n"
+			  "movdqu %%xmm0, [%1]\n movdqu %%xmm1, [%1 + 16]\n"
+			  "movdqu %%xmm2, [%1 + 32]\n movdqu %%xmm3, [%1 + 48]\n"
+			  "movdqa [%0], %%xmm0\n movdqa [%0 + 16], %%xmm1\n"
+			  "movdqa [%0 + 32], %%xmm2\n movdqa [%0 + 48], %%xmm3\n"
+			  "add %0, 64\n add %1, 64\n dec %2\n jnz 1b"
+			  : "+r"(dest), "+r"(src), "+r"(blocks) :: "memory", "cc");
+  }
+  restore_xmm(saved);
+
+  irq_restore(flags);
+}
+
+static void sse_copy(unsigned char* dest, const unsigned char* src, size_t n)
+{
+  size_t head = (-(unsigned long)dest) & 15;
+  bool nt = n >= STRING_NT_MIN;
+
+  copy_forward(dest, src, head);
+  dest += head;
+  src += head;
+  n -= head;
+
+  for(size_t chunk; n >= 64; dest += chunk, src += chunk, n -= chunk) {
+    chunk = (n < STRING_IRQ_BLOCK ? n : STRING_IRQ_BLOCK) & ~63;
+    sse_copy_blocks(dest, src, chunk >> 6, nt);
+  }
+
+  copy_forward(dest, src, n);
+}
+
+static void sse_fill_blocks(unsigned char* dest, unsigned int pattern, size_t blocks, bool nt)
+{
+  unsigned char saved[64];
+  unsigned int flags = irq_save();
+
+  save_xmm(saved);
+  __asm__ __volatile__ ("movd %%xmm0, %0\n pshufd %%xmm0, %%xmm0, 0" :: "r"(pattern));
+  if(nt) {
+    __asm__ __volatile__ ("1:\n"
+			  "movntdq [%0], %%xmm0\n movntdq [%0 + 16], %%xmm0\n"
+			  "movntdq [%0 + 32], %%xmm0\n movntdq [%0 + 48], %%xmm0\n"
+			  "add %0, 64\n dec %1\n jnz 1b\n"
+			  "sfence"
+			  : "+r"(dest), "+r"(blocks) :: "memory", "cc");
+  } else {
+    __asm__ __volatile__ ("1:\n"
+			  "movdqa [%0], %%xmm0\n movdqa [%0 + 16], %%xmm0\n"
+			  "movdqa [%0 + 32], %%xmm0\n movdqa [%0 + 48], %%xmm0\n"
+			  "add %0, 64\n dec %1\n jnz 1b"
+			  : "+r"(dest), "+r"(blocks) :: "memory", "cc");
+  }
+  restore_xmm(saved);
+
+  irq_restore(flags);
+}
+
+static void sse_fill(unsigned char* dest, unsigned int pattern, size_t n)
+{
+  bool nt = n >= STRING_NT_MIN;
+
+  for(size_t chunk; n >= 64; dest += chunk, n -= chunk) {
+    chunk = (n < STRING_IRQ_BLOCK ? n : STRING_IRQ_BLOCK) & ~63;
+    sse_fill_blocks(dest, pattern, chunk >> 6, nt);
+  }
+}
+
+void* memset(void* dest, int c, size_t n)
+{
+  unsigned char* d = (unsigned char*)dest;
+  unsigned int pattern = (unsigned char)c * 0x01010101;
+
+  if(n < STRING_REP_MIN) {
+    while(n--)
+      *d++ = (unsigned char)c;
+    return dest;
+  }
+
+  size_t head = (-(unsigned long)d) & (sse_enabled && n >= STRING_SSE_MIN ? 15 : 3);
+  n -= head;
+  __asm__ __volatile__ ("rep stosb" : "+D"(d), "+c"(head) : "a"(pattern) : "memory");
+
+  if(sse_enabled && n >= STRING_SSE_MIN) {
+    sse_fill(d, pattern, n);
+    d += n & ~63;
+    n &= 63;
+  }
+
+  size_t words = n >> 2;
+  size_t tail = n & 3;
+  __asm__ __volatile__ ("rep stosd" : "+D"(d), "+c"(words) : "a"(pattern) : "memory");
+  __asm__ __volatile__ ("rep stosb" : "+D"(d), "+c"(tail) : "a"(pattern) : "memory");
+
+  return dest;
+}
+
+void* memcpy(void* dest, const void* src, size_t n)
+{
+  if(sse_enabled && n >= STRING_SSE_MIN)
+    sse_copy((unsigned char*)dest, (const unsigned char*)src, n);
+  else
+    copy_forward((unsigned char*)dest, (const unsigned char*)src, n);
+
+  return dest;
+}
+
+void* memmove(void* dest, const void* src, size_t n)
+{
+  unsigned char* d = (unsigned char*)dest;
+  const unsigned char* s = (const unsigned char*)src;
+
+  if(d <= s || d >= s + n)
+    return memcpy(dest, src, n);
+
+  d += n;
+  s += n;
+
+  for(size_t tail = n & 3; tail; --tail)
+    *--d = *--s;
+
+  size_t words = n >> 2;
+  if(words) {
+    d -= 4;
+    s -= 4;
+  }
+
+  while(words) {
+    size_t chunk = words < STRING_IRQ_BLOCK / 4 ? words : STRING_IRQ_BLOCK / 4;
+    unsigned int flags = irq_save();
+    words -= chunk;
+    __asm__ __volatile__ ("std\n rep movsd\n cld" : "+D"(d), "+S"(s), "+c"(chunk) :: "memory", "cc");
+    irq_restore(flags);
+  }
+
+  return dest;
+}
+
+int memcmp(const void* s1, const void* s2, size_t n)
+{
+  const unsigned char* a = (const unsigned char*)s1;
+  const unsigned char* b = (const unsigned char*)s2;
+
+  for(; n >= 4 && *(const unsigned int*)a == *(const unsigned int*)b; n -= 4, a += 4, b += 4);
+
+  for(; n; --n, ++a, ++b)
+    if(*a != *b)
+      return *a - *b;
+
+  return 0;
+}
+
+size_t strlen(const char* s)
+{
+  size_t len = 0;
+
+  while(s[len])
+    ++len;
+
+  return len;
+}
+
+int strcmp(const char* s1, const char* s2)
+{
+  for(; *s1 && *s1 == *s2; ++s1, ++s2);
+
+  return *(const unsigned char*)s1 - *(const unsigned char*)s2;
+}
@@ -14,6 +14,14 @@ void outb(unsigned short port, unsigned char val)
   return;
 }
 
+// A write to the unused POST port takes about a microsecond on the ISA
+// bus, which is enough for old PICs to settle between commands.
+void io_wait()
+{
+  outb(0x80, 0);
+  return;
+}
+
 void cli()
 {
   __asm__ __volatile__ ("cli");
@@ -25,3 +33,16 @@ void sti()
   __asm__ __volatile__ ("sti");
   return;
 }
+
+unsigned int irq_save()
+{
+  unsigned int flags;
+  __asm__ __volatile__ ("pushfd\n pop %0\n cli" : "=r"(flags) :: "memory");
+  return flags;
+}
+
+void irq_restore(unsigned int flags)
+{
+  __asm__ __volatile__ ("push %0\n popfd" :: "r"(flags) : "memory", "cc");
+  return;
+}
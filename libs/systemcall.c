@@ -1,5 +1,134 @@
-void install_syscalls()
+#include <cpu.h>
+#include <gdt.h>
+#include <idt.h>
+#include <interrupt_handler.h>
+#include <interrupt_stubs.h>
+#include <regs.h>
+#include <sched.h>
+#include <smp.h>
+#include <stats.h>
+#include <stdbool.h>
+#include <stdsymbols.h>
+#include <systemcall.h>
+
+/* System call entry.
+ *
+ * Calls are dispatched through syscall_table by number. sysenter is the
+ * fast path where the processor has it: the entry stub saves only what
+ * sysexit needs and calls syscall_dispatch() directly, bypassing
+ * int_common. int 0x80 stays available everywhere and goes through the
+ * usual regs frame.
+ *
+ * sysenter derives every selector from MSR_SYSENTER_CS: kernel code and
+ * stack at +0 and +8, user code and stack at +16 and +24. The boot GDT
+ * has no such run, so a group of four flat descriptors is appended.
+ */
+
+extern void sysenter_entry();
+
+bool sysenter_enabled = false;
+unsigned short sysenter_cs = 0;
+
+stat_counter syscalls_made = STAT_COUNTER("system calls");
+
+static syscall_handler syscall_table[SYSCALL_COUNT] = {[0 ... SYSCALL_COUNT - 1] = NULL};
+
+static unsigned int sys_null(unsigned int a __attribute__ ((unused)), unsigned int b __attribute__ ((unused)),
+			     unsigned int c __attribute__ ((unused)), unsigned int d __attribute__ ((unused)))
 {
-  
+  return 0;
+}
+
+static unsigned int sys_yield(unsigned int a __attribute__ ((unused)), unsigned int b __attribute__ ((unused)),
+			      unsigned int c __attribute__ ((unused)), unsigned int d __attribute__ ((unused)))
+{
+  thread_yield();
+  return 0;
+}
+
+static unsigned int sys_thread_id(unsigned int a __attribute__ ((unused)), unsigned int b __attribute__ ((unused)),
+				  unsigned int c __attribute__ ((unused)), unsigned int d __attribute__ ((unused)))
+{
+  thread* cur = thread_current();
+  return cur ? cur->id : SYSCALL_ERROR;
+}
+
+unsigned int syscall_dispatch(unsigned int number, unsigned int a, unsigned int b, unsigned int c, unsigned int d)
+{
+  stat_inc(&syscalls_made);
+
+  if(number >= SYSCALL_COUNT || !syscall_table[number])
+    return SYSCALL_ERROR;
+
+  return syscall_table[number](a, b, c, d);
+}
+
+static void syscall_int_handler(regs* r)
+{
+  r->eax = syscall_dispatch(r->eax, r->ebx, r->esi, r->edi, r->ebp);
   return;
 }
+
+bool register_syscall(unsigned int number, syscall_handler handler)
+{
+  if(number >= SYSCALL_COUNT || syscall_table[number])
+    return false;
+
+  syscall_table[number] = handler;
+  return true;
+}
+
+// Early Pentium Pro parts report SEP without implementing it.
+static bool sysenter_usable()
+{
+  unsigned int eax, ebx, ecx, edx;
+
+  if(!cpu_has(CPU_FEATURE_SEP | CPU_FEATURE_MSR))
+    return false;
+
+  cpuid(1, &eax, &ebx, &ecx, &edx);
+  unsigned int family = (eax >> 8) & 0xF, model = (eax >> 4) & 0xF, stepping = eax & 0xF;
+
+  return !(family == 6 && model < 3 && stepping < 3);
+}
+
+// Run on every processor, the stack MSR points into its own TSS.
+void syscall_cpu_init()
+{
+  if(!sysenter_enabled)
+    return;
+
+  wrmsr(MSR_SYSENTER_CS, sysenter_cs);
+  wrmsr(MSR_SYSENTER_ESP, (unsigned int)&cpu_local()->tss.esp0);
+  wrmsr(MSR_SYSENTER_EIP, (unsigned int)sysenter_entry);
+
+  return;
+}
+
+bool install_syscalls()
+{
+  register_syscall(SYS_NULL, sys_null);
+  register_syscall(SYS_YIELD, sys_yield);
+  register_syscall(SYS_THREAD_ID, sys_thread_id);
+
+  install_stat(&syscalls_made);
+
+  int_routines[SYSCALL_VECTOR] = syscall_int_handler;
+  install_uint(SYSCALL_VECTOR, (unsigned int)int128, 0x08);
+
+  if(!sysenter_usable())
+    return true;
+
+  sysenter_cs = add_gdt_system_entry(0, 0xFFFFF, 0x9A, 0xC0);
+  if(!sysenter_cs
+     || !add_gdt_system_entry(0, 0xFFFFF, 0x92, 0xC0)
+     || !add_gdt_system_entry(0, 0xFFFFF, 0xFA, 0xC0)
+     || !add_gdt_system_entry(0, 0xFFFFF, 0xF2, 0xC0))
+    return false;
+  lgdt();
+
+  sysenter_enabled = true;
+  syscall_cpu_init();
+
+  return true;
+}
@@ -0,0 +1,48 @@
+[BITS 32]
+
+global sysenter_entry
+
+extern syscall_dispatch
+extern load_cpu_gs
+
+section .text
+
+; MSR_SYSENTER_ESP points at this processor's tss.esp0, so the first load
+; picks up the kernel stack of whichever thread is running. gs still
+; holds the user's segment, so it is saved and replaced with the per-CPU
+; one before any C code runs. sysenter leaves DF as the caller had it,
+; and the C code expects it clear.
+sysenter_entry:
+	mov esp, [esp]
+	push ecx
+	push edx
+	push ds
+	push es
+	push gs
+	push ebp
+	push edi
+	push esi
+	push ebx
+	push eax
+	mov bx, 0x10
+	mov ds, bx
+	mov es, bx
+	cld
+	call load_cpu_gs
+	sti
+	call syscall_dispatch
+	cli
+	add esp, 4
+	pop ebx
+	pop esi
+	pop edi
+	pop ebp
+	pop gs
+	pop es
+	pop ds
+	pop edx
+	pop ecx
+	; sti only takes effect after the next instruction, so no interrupt
+	; can arrive between it and sysexit.
+	sti
+	sysexit
@@ -0,0 +1,80 @@
+[BITS 16]
+
+global smp_trampoline
+global smp_trampoline_params
+global smp_trampoline_end
+
+; Application processor start-up code. smp.c copies it to SMP_TRAMPOLINE
+; (0x8000) before sending the start-up IPI, so every address below is
+; taken relative to that copy. The AP switches to protected mode on a
+; temporary flat GDT, turns paging on with the bootstrap processor's CR3
+; and CR4, and calls the entry point from the parameter block on its own
+; stack, passing its logical CPU number. Each start is claimed by swapping
+; param_ticket to zero; an AP that arrives after smp.c gave up on it finds
+; the ticket taken and halts before touching any stack.
+
+TRAMPOLINE equ 0x8000
+%define TR(label) (TRAMPOLINE + (label - smp_trampoline))
+
+section .text
+
+smp_trampoline:
+	cli
+	cld
+	xor ax, ax
+	mov ds, ax
+	lgdt [TR(trampoline_gdtr)]
+	mov eax, cr0
+	or eax, 1
+	mov cr0, eax
+	jmp dword 0x08:TR(protected)
+
+[BITS 32]
+
+protected:
+	mov ax, 0x10
+	mov ds, ax
+	mov es, ax
+	mov ss, ax
+	mov fs, ax
+	mov gs, ax
+	xor eax, eax
+	xchg eax, [TR(param_ticket)]
+	test eax, eax
+	jz hang
+	mov eax, [TR(param_cr4)]
+	mov cr4, eax
+	mov eax, [TR(param_cr3)]
+	mov cr3, eax
+	mov eax, cr0
+	and eax, 0x9FFFFFFF		; INIT leaves CD and NW set, caches on
+	or eax, 0x80010020		; PG, WP and NE, as on the boot processor
+	mov cr0, eax
+	mov esp, [TR(param_stack)]
+	mov ebp, esp
+	push dword [TR(param_cpu)]
+	mov eax, [TR(param_entry)]
+	call eax
+	cli
+hang:
+	hlt
+	jmp hang
+
+align 8
+trampoline_gdt:
+	dq 0
+	dq 0x00CF9A000000FFFF
+	dq 0x00CF92000000FFFF
+trampoline_gdtr:
+	dw 23
+	dd TR(trampoline_gdt)
+
+align 4
+smp_trampoline_params:
+param_cr3:	dd 0
+param_cr4:	dd 0
+param_stack:	dd 0
+param_entry:	dd 0
+param_cpu:	dd 0
+param_ticket:	dd 0
+smp_trampoline_end:
@@ -0,0 +1,187 @@
+#include <spinlock.h>
+#include <stats.h>
+#include <stdbool.h>
+#include <stdsymbols.h>
+#include <vmm.h>
+
+/* Kernel virtual address allocator.
+ *
+ * Page allocations are placed in the window [VMM_BASE, VMM_END) and backed
+ * by whatever frames the frame allocator returns, so a contiguous virtual
+ * run no longer needs contiguous physical memory. The window is tracked by
+ * a bitmap with one bit per page (set = reserved). Searches start where
+ * the last allocation ended and skip full words, wrapping around once.
+ * Runs from vmm_reserve() are also flagged in a second bitmap, so the page
+ * fault handler can tell them apart and back them on first touch.
+ */
+
+#define VMM_PAGES ((VMM_END - VMM_BASE) >> 12)
+#define NO_PAGE 0xFFFFFFFF
+
+stat_counter vmm_lock_contention = STAT_COUNTER("virtual range lock contention");
+
+static spinlock vmm_lock = SPINLOCK_INIT(&vmm_lock_contention);
+
+static unsigned int vmm_bitmap[VMM_PAGES / 32];
+static unsigned int vmm_lazy[VMM_PAGES / 32];
+static unsigned int vmm_hint = 0;
+static unsigned int vmm_used = 0;
+
+static inline bool page_reserved(unsigned int page)
+{
+  return (vmm_bitmap[page >> 5] >> (page & 31)) & 1;
+}
+
+static bool pages_reserved(unsigned int first, unsigned int count)
+{
+  for(unsigned int page = first; page < first + count; ++page)
+    if(!page_reserved(page))
+      return false;
+  return true;
+}
+
+static unsigned int find_run(unsigned int from, unsigned int to, unsigned int count)
+{
+  unsigned int run = 0;
+
+  for(unsigned int page = from; page < to; ) {
+    if(!(page & 31) && page + 32 <= to) {
+      if(vmm_bitmap[page >> 5] == 0xFFFFFFFF) {
+	run = 0;
+	page += 32;
+	continue;
+      }
+      if(!vmm_bitmap[page >> 5]) {
+	run += 32;
+	page += 32;
+	if(run >= count)
+	  return page - run;
+	continue;
+      }
+    }
+
+    if(page_reserved(page))
+      run = 0;
+    else if(++run == count)
+      return page + 1 - count;
+
+    ++page;
+  }
+
+  return NO_PAGE;
+}
+
+static void mark_pages(unsigned int* bitmap, unsigned int first, unsigned int count, bool set)
+{
+  for(unsigned int page = first; page < first + count; ++page) {
+    if(set)
+      bitmap[page >> 5] |= (1u << (page & 31));
+    else
+      bitmap[page >> 5] &= ~(1u << (page & 31));
+  }
+}
+
+void init_vmm()
+{
+  install_stat(&vmm_lock_contention);
+  return;
+}
+
+unsigned long vmm_alloc(int num_pages)
+{
+  if(num_pages <= 0 || (unsigned int)num_pages > VMM_PAGES)
+    return 0;
+
+  unsigned int flags = spin_lock_irqsave(&vmm_lock);
+
+  unsigned int first = find_run(vmm_hint, VMM_PAGES, num_pages);
+  if(first == NO_PAGE)
+    first = find_run(0, VMM_PAGES, num_pages);
+
+  if(first != NO_PAGE) {
+    mark_pages(vmm_bitmap, first, num_pages, true);
+    vmm_used += num_pages;
+    vmm_hint = (first + num_pages) % VMM_PAGES;
+  }
+
+  spin_unlock_irqrestore(&vmm_lock, flags);
+
+  if(first == NO_PAGE)
+    return 0;
+
+  return VMM_BASE + ((unsigned long)first << 12);
+}
+
+bool vmm_free(unsigned long virt_addr, int num_pages)
+{
+  if(!vmm_owns(virt_addr) || (virt_addr & 0xFFF) || num_pages <= 0)
+    return false;
+
+  unsigned int first = (virt_addr - VMM_BASE) >> 12;
+  if(first + num_pages > VMM_PAGES)
+    return false;
+
+  unsigned int flags = spin_lock_irqsave(&vmm_lock);
+  if(!pages_reserved(first, num_pages)) {
+    spin_unlock_irqrestore(&vmm_lock, flags);
+    return false;
+  }
+
+  mark_pages(vmm_bitmap, first, num_pages, false);
+  mark_pages(vmm_lazy, first, num_pages, false);
+  vmm_used -= num_pages;
+  spin_unlock_irqrestore(&vmm_lock, flags);
+
+  return true;
+}
+
+// Whether the whole run was handed out by vmm_alloc() or vmm_reserve().
+bool vmm_allocated(unsigned long virt_addr, int num_pages)
+{
+  if(!vmm_owns(virt_addr) || (virt_addr & 0xFFF) || num_pages <= 0)
+    return false;
+
+  unsigned int first = (virt_addr - VMM_BASE) >> 12;
+  if(first + num_pages > VMM_PAGES)
+    return false;
+
+  unsigned int flags = spin_lock_irqsave(&vmm_lock);
+  bool allocated = pages_reserved(first, num_pages);
+  spin_unlock_irqrestore(&vmm_lock, flags);
+
+  return allocated;
+}
+
+// Reserves a run whose pages are only backed when first touched.
+unsigned long vmm_reserve(int num_pages)
+{
+  unsigned long virt_addr = vmm_alloc(num_pages);
+
+  if(!virt_addr)
+    return 0;
+
+  unsigned int flags = spin_lock_irqsave(&vmm_lock);
+  mark_pages(vmm_lazy, (virt_addr - VMM_BASE) >> 12, num_pages, true);
+  spin_unlock_irqrestore(&vmm_lock, flags);
+
+  return virt_addr;
+}
+
+bool vmm_lazy_page(unsigned long virt_addr)
+{
+  if(!vmm_owns(virt_addr))
+    return false;
+
+  unsigned int page = (virt_addr - VMM_BASE) >> 12;
+  return (vmm_lazy[page >> 5] >> (page & 31)) & 1;
+}
+
+bool vmm_owns(unsigned long virt_addr)
+{
+  return virt_addr >= VMM_BASE && virt_addr < VMM_END;
+}
+
+unsigned int vmm_pages_used()
+{
+  return vmm_used;
+}
@@ -1,6 +1,7 @@
 [BITS 32]
 
 global loader
+global boot_stack_top
 	
 extern kill
 extern k_main
@@ -26,6 +27,7 @@ section .bss
 align 4
 stack:	
 	resb 0x8000
+boot_stack_top:
 
 	
 
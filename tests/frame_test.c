@@ -0,0 +1,285 @@
+#include <frame.h>
+#include <multiboot.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdsymbols.h>
+#include <host.h>
+
+/* Hosted test of the buddy frame allocator.
+ *
+ * frame.c runs against a fake multiboot memory map describing an arena
+ * of process memory, which it treats as physical memory, so the page
+ * frame tables are carved out of the arena as they are at boot. The map
+ * has a reserved hole, and the boot data sits in the arena's first page,
+ * and neither may ever be handed out or freed. Every page handed out is recorded
+ * in seen[], so an overlap between two allocations fails the test.
+ */
+
+#define ARENA_HINT 0x10000000
+#define ARENA_PAGES 8192
+#define HOLE_FIRST 3000
+#define HOLE_PAGES 16
+
+// Blocks of this order bypass the per-CPU magazines.
+#define BIG_ORDER 5
+#define MAGAZINE_PAGES 32
+
+static unsigned long arena;
+static unsigned int initial_free;
+static unsigned int top_order;
+static unsigned char seen[ARENA_PAGES];
+
+static unsigned long blocks[ARENA_PAGES >> BIG_ORDER];
+static unsigned long pages[ARENA_PAGES];
+
+static bool usable(unsigned long addr, unsigned int count)
+{
+  unsigned long meta_begin, meta_end;
+  frame_metadata(&meta_begin, &meta_end);
+
+  if(addr < arena + FRAME_SIZE || addr + count * FRAME_SIZE > arena + ARENA_PAGES * FRAME_SIZE)
+    return false;
+
+  unsigned int first = (addr - arena) / FRAME_SIZE;
+  if(first < HOLE_FIRST + HOLE_PAGES && first + count > HOLE_FIRST)
+    return false;
+
+  return addr >= meta_end || addr + count * FRAME_SIZE <= meta_begin;
+}
+
+// Records count pages at addr as handed out, failing if any already were.
+static bool claim(unsigned long addr, unsigned int count)
+{
+  if(!addr || !usable(addr, count))
+    return false;
+
+  unsigned int first = (addr - arena) / FRAME_SIZE;
+  for(unsigned int i = 0; i < count; i++)
+    {
+      if(seen[first + i])
+	return false;
+      seen[first + i] = 1;
+    }
+
+  return true;
+}
+
+static void release(unsigned long addr, unsigned int count)
+{
+  unsigned int first = (addr - arena) / FRAME_SIZE;
+
+  for(unsigned int i = 0; i < count; i++)
+    seen[first + i] = 0;
+}
+
+static unsigned int largest_order()
+{
+  for(unsigned int order = FRAME_MAX_ORDER; order >= BIG_ORDER; order--)
+    {
+      unsigned long addr = frame_alloc(order);
+      if(addr)
+	{
+	  frame_free(addr, order);
+	  return order;
+	}
+    }
+
+  return 0;
+}
+
+static void set_region(memory_map_t* region, unsigned int first, unsigned int count, unsigned int type)
+{
+  region->size = sizeof(memory_map_t) - sizeof(unsigned long);
+  region->base_addr_low = arena + first * FRAME_SIZE;
+  region->base_addr_high = 0;
+  region->length_low = count * FRAME_SIZE;
+  region->length_high = 0;
+  region->type = type;
+}
+
+static bool setup()
+{
+  void* memory = host_alloc(ARENA_HINT, ARENA_PAGES * FRAME_SIZE);
+  if(!check(memory != NULL))
+    return false;
+  arena = (unsigned long)memory;
+
+  // Like GRUB's, the boot data lies in memory the map calls usable.
+  multiboot_info_t* info = (multiboot_info_t*)arena;
+  memory_map_t* map = (memory_map_t*)(arena + sizeof(multiboot_info_t));
+
+  set_region(&map[0], 0, HOLE_FIRST, 1);
+  set_region(&map[1], HOLE_FIRST, HOLE_PAGES, 2);
+  set_region(&map[2], HOLE_FIRST + HOLE_PAGES, ARENA_PAGES - HOLE_FIRST - HOLE_PAGES, 1);
+
+  info->flags = MULTIBOOT_MMAP;
+  info->mmap_addr = (unsigned long)map;
+  info->mmap_length = 3 * sizeof(memory_map_t);
+
+  if(!check(init_frames(info)))
+    return false;
+
+  unsigned long meta_begin, meta_end;
+  frame_metadata(&meta_begin, &meta_end);
+
+  initial_free = frames_free();
+  check(frames_total() == (arena >> 12) + ARENA_PAGES);
+  check(initial_free == ARENA_PAGES - HOLE_PAGES - 1 - (meta_end - meta_begin) / FRAME_SIZE);
+
+  top_order = largest_order();
+  check(top_order > BIG_ORDER);
+
+  return true;
+}
+
+static void test_split_coalesce()
+{
+  unsigned long block = frame_alloc(top_order);
+  check(!(block & ((FRAME_SIZE << top_order) - 1)));
+  check(claim(block, 1u << top_order));
+  check(frames_free() == initial_free - (1u << top_order));
+  check(frame_free(block, top_order));
+  release(block, 1u << top_order);
+  check(frames_free() == initial_free);
+
+  // Split everything down to BIG_ORDER blocks.
+  unsigned int count = 0;
+  while((blocks[count] = frame_alloc(BIG_ORDER)))
+    {
+      check(!(blocks[count] & ((FRAME_SIZE << BIG_ORDER) - 1)));
+      if(!check(claim(blocks[count], 1u << BIG_ORDER)))
+	break;
+      count++;
+    }
+  check(count > 0);
+  check(frames_free() == initial_free - (count << BIG_ORDER));
+
+  // Give them back out of order, so buddies meet from both sides.
+  for(unsigned int start = 0; start < 2; start++)
+    for(unsigned int i = start; i < count; i += 2)
+      {
+	check(frame_free(blocks[i], BIG_ORDER));
+	release(blocks[i], 1u << BIG_ORDER);
+      }
+
+  check(frames_free() == initial_free);
+  check(largest_order() == top_order);
+}
+
+static void test_runs()
+{
+  unsigned int sizes[] = {3, 5, 17, 100};
+  unsigned long runs[4];
+  unsigned int expected = initial_free;
+
+  // Runs that are not a power of two give the tail of their block back.
+  for(unsigned int i = 0; i < 4; i++)
+    {
+      runs[i] = frame_alloc_pages(sizes[i]);
+      check(claim(runs[i], sizes[i]));
+      expected -= sizes[i];
+      check(frames_free() == expected);
+    }
+
+  for(unsigned int i = 0; i < 4; i++)
+    {
+      check(frame_free_pages(runs[i], sizes[i]));
+      release(runs[i], sizes[i]);
+    }
+
+  check(frames_free() == initial_free);
+  check(largest_order() == top_order);
+}
+
+static void test_bad_frees()
+{
+  unsigned long block = frame_alloc(BIG_ORDER);
+
+  check(block != 0);
+  check(!frame_free(block + 0x800, BIG_ORDER));
+  check(!frame_free(block + FRAME_SIZE, BIG_ORDER));
+  check(!frame_free(block, FRAME_MAX_ORDER + 1));
+  check(!frame_free((unsigned long)frames_total() << 12, 0));
+
+  check(frame_free(block, BIG_ORDER));
+  check(!frame_free(block, BIG_ORDER));
+  check(!frame_free_pages(block, 3));
+
+  // A run whose tail is already free must be refused whole, even though
+  // its first words were valid.
+  unsigned long run = frame_alloc_pages(100);
+  check(run != 0);
+  check(frame_free_pages(run + 97 * FRAME_SIZE, 3));
+  check(!frame_free_pages(run, 100));
+  check(frame_free_pages(run, 97));
+
+  check(frames_free() == initial_free);
+}
+
+// What was never handed out is refused, though its frames are not free.
+static void test_reserved()
+{
+  unsigned long meta_begin, meta_end;
+  frame_metadata(&meta_begin, &meta_end);
+
+  check(!frames_allocated(arena, 1));
+  check(!frame_free(arena, 0));
+  check(!frames_allocated(arena + HOLE_FIRST * FRAME_SIZE, HOLE_PAGES));
+  check(!frame_free_pages(arena + HOLE_FIRST * FRAME_SIZE, HOLE_PAGES));
+  check(!frame_free_pages(arena - 2 * FRAME_SIZE, 2));
+  check(!frame_free_pages(meta_begin, 1));
+
+  unsigned long page = frame_alloc(0);
+  check(page != 0 && frames_allocated(page, 1));
+  frame_reserve(page, page + FRAME_SIZE);
+  check(frames_allocated(page, 1));
+  check(frame_free(page, 0));
+}
+
+// Allocates single pages until none are left, returning how many there were.
+static unsigned int exhaust()
+{
+  unsigned int count = 0;
+
+  while(count < ARENA_PAGES && (pages[count] = frame_alloc(0)))
+    if(check(claim(pages[count], 1)))
+      count++;
+    else
+      break;
+
+  return count;
+}
+
+static void test_magazines()
+{
+  for(unsigned int round = 0; round < 2; round++)
+    {
+      unsigned int count = exhaust();
+
+      // Pages cached in the magazines must be reachable too.
+      check(count == initial_free);
+      check(frames_free() == 0);
+
+      for(unsigned int i = 0; i < count; i++)
+	{
+	  check(frame_free(pages[i], 0));
+	  release(pages[i], 1);
+	}
+
+      check(frames_free() <= initial_free && initial_free - frames_free() <= MAGAZINE_PAGES);
+    }
+}
+
+int main()
+{
+  if(setup())
+    {
+      test_split_coalesce();
+      test_runs();
+      test_bad_frees();
+      test_reserved();
+      test_magazines();
+    }
+
+  return test_result("frame allocator");
+}
@@ -0,0 +1,321 @@
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdsymbols.h>
+#include <host.h>
+
+/* Host side of the hosted tests.
+ *
+ * The kernel sources under test are built with the kernel's own headers
+ * and flags for a 32-bit Linux process, without a C library. This file
+ * supplies the process entry point, a print() writing to stdout through
+ * system calls, and stand-ins for the few kernel services the tested
+ * code expects: locks and interrupt masking are no-ops, since a test is
+ * single threaded, and there is only processor 0.
+ *
+ * Tests of code built for several threads, the RTS's in particular, get
+ * real ones from clone() and real futexes. Those threads must not use
+ * print() or check(), which are not safe to share.
+ */
+
+#define SYS_EXIT 1
+#define SYS_WRITE 4
+#define SYS_TIME 13
+#define SYS_MMAP 90
+#define SYS_CLONE 120
+#define SYS_SCHED_YIELD 158
+#define SYS_GETTID 224
+#define SYS_FUTEX 240
+#define SYS_EXIT_GROUP 252
+#define SYS_CLOCK_GETTIME 265
+
+#define FUTEX_WAIT_PRIVATE 128
+#define FUTEX_WAKE_PRIVATE 129
+
+#define CLOCK_MONOTONIC 1
+
+// CLONE_VM, FS, FILES, SIGHAND, THREAD and SYSVSEM.
+#define CLONE_THREAD_FLAGS 0x50F00
+#define HOST_THREAD_STACK 0x10000
+
+#define ASM_STRING(x) #x
+#define ASM_NUMBER(x) ASM_STRING(x)
+
+#define PROT_READ 0x1
+#define PROT_WRITE 0x2
+#define MAP_PRIVATE 0x02
+#define MAP_ANONYMOUS 0x20
+
+extern int main();
+
+bool sse_enabled = false;
+const unsigned int _begin = 0;
+
+static char out[256];
+static unsigned int out_length = 0;
+static unsigned int failures = 0;
+
+static int host_syscall(int number, int a, int b, int c)
+{
+  int result;
+  __asm__ __volatile__ ("int 0x80" : "=a"(result) : "a"(number), "b"(a), "c"(b), "d"(c) : "memory");
+  return result;
+}
+
+static void flush_out()
+{
+  if(out_length)
+    host_syscall(SYS_WRITE, 1, (int)out, out_length);
+  out_length = 0;
+}
+
+void putch(char c)
+{
+  out[out_length++] = c;
+  if(c == '\n' || out_length == sizeof(out))
+    flush_out();
+}
+
+static void put_number(unsigned int num, unsigned int base, int digits)
+{
+  char buffer[12];
+  int length = 0;
+
+  do
+    {
+      buffer[length++] = "0123456789ABCDEF"[num % base];
+      num /= base;
+    }
+  while(num || length < digits);
+
+  while(length)
+    putch(buffer[--length]);
+}
+
+// The subset of the kernel's formats the tested code uses.
+void print(char* string, ...)
+{
+  va_list list;
+  va_start(list, string);
+
+  for(int i = 0; string[i]; i++)
+    {
+      if(string[i] != '%' || !string[i + 1])
+	{
+	  putch(string[i]);
+	  continue;
+	}
+
+      switch(string[++i])
+	{
+	case 'i':
+	  {
+	    int num = va_arg(list, int);
+	    if(num < 0)
+	      putch('-');
+	    put_number(num < 0 ? -num : num, 10, 1);
+	    break;
+	  }
+	case 'u':
+	  put_number(va_arg(list, unsigned int), 10, 1);
+	  break;
+	case 'h':
+	  putch('0');
+	  putch('x');
+	  put_number(va_arg(list, unsigned int), 16, 8);
+	  break;
+	case 'x':
+	  putch('0');
+	  putch('x');
+	  put_number(va_arg(list, unsigned int) & 0xFFFF, 16, 1);
+	  break;
+	case 'c':
+	  putch((char)va_arg(list, int));
+	  break;
+	case 's':
+	  for(char* s = va_arg(list, char*); *s; s++)
+	    putch(*s);
+	  break;
+	default:
+	  putch('%');
+	  i--;
+	  break;
+	}
+    }
+
+  va_end(list);
+}
+
+bool test_check(bool ok, char* what, char* file, int line)
+{
+  if(!ok)
+    {
+      print("  %s:%u: check failed: %s\n", file, line, what);
+      failures++;
+    }
+  return ok;
+}
+
+int test_result(char* name)
+{
+  print("%s: %s\n", name, failures ? "FAILED" : "passed");
+  flush_out();
+  return failures ? 1 : 0;
+}
+
+void* host_alloc(unsigned long hint, unsigned long size)
+{
+  unsigned long args[6] = {hint, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, (unsigned long)-1, 0};
+  int result = host_syscall(SYS_MMAP, (int)args, 0, 0);
+
+  // Errors come back as -4095 to -1.
+  return (unsigned int)result > 0xFFFFF000 ? NULL : (void*)result;
+}
+
+void __attribute__ ((force_align_arg_pointer)) _start()
+{
+  int status = main();
+
+  // Ends any threads the test left behind too.
+  flush_out();
+  host_syscall(SYS_EXIT_GROUP, status, 0, 0);
+  while(true);
+}
+
+/* int host_clone(void* stack)
+ *
+ * The child starts on stack, where host_thread() left the function to
+ * run and its argument, and exits once it returns.
+ */
+__asm__ (".pushsection .text\n"
+	 ".globl host_clone\n"
+	 "host_clone:\n"
+	 " push ebx\n"
+	 " push esi\n"
+	 " push edi\n"
+	 " mov eax, " ASM_NUMBER(SYS_CLONE) "\n"
+	 " mov ebx, " ASM_NUMBER(CLONE_THREAD_FLAGS) "\n"
+	 " mov ecx, [esp + 16]\n"
+	 " xor edx, edx\n"
+	 " xor esi, esi\n"
+	 " xor edi, edi\n"
+	 " int 0x80\n"
+	 " test eax, eax\n"
+	 " jz 1f\n"
+	 " pop edi\n"
+	 " pop esi\n"
+	 " pop ebx\n"
+	 " ret\n"
+	 "1:\n"
+	 " pop eax\n"
+	 " call eax\n"
+	 " mov eax, " ASM_NUMBER(SYS_EXIT) "\n"
+	 " xor ebx, ebx\n"
+	 " int 0x80\n"
+	 ".popsection\n");
+
+extern int host_clone(void* stack);
+
+// Runs fn(arg) in a thread of its own, returning its id or 0.
+int host_thread(void (*fn)(void* arg), void* arg)
+{
+  void** stack = host_alloc(0, HOST_THREAD_STACK);
+  if(!stack)
+    return 0;
+
+  // fn is entered with the stack 16 byte aligned, as after any call.
+  stack += HOST_THREAD_STACK / sizeof(void*) - 5;
+  stack[0] = (void*)fn;
+  stack[1] = arg;
+
+  int tid = host_clone(stack);
+  return tid > 0 ? tid : 0;
+}
+
+void host_thread_exit()
+{
+  while(true)
+    host_syscall(SYS_EXIT, 0, 0, 0);
+}
+
+int host_thread_id()
+{
+  return host_syscall(SYS_GETTID, 0, 0, 0);
+}
+
+void host_yield()
+{
+  host_syscall(SYS_SCHED_YIELD, 0, 0, 0);
+}
+
+unsigned int host_seconds()
+{
+  return host_syscall(SYS_TIME, 0, 0, 0);
+}
+
+// Monotonic, wrapping every 71 minutes, so only good for differences.
+unsigned int host_microseconds()
+{
+  int now[2];
+
+  host_syscall(SYS_CLOCK_GETTIME, CLOCK_MONOTONIC, (int)now, 0);
+  return (unsigned int)now[0] * 1000000 + now[1] / 1000;
+}
+
+// Sleeps while *addr is expected, false if it was not or on a signal.
+bool host_futex_wait(volatile unsigned int* addr, unsigned int expected)
+{
+  int result;
+  __asm__ __volatile__ ("push esi\n xor esi, esi\n int 0x80\n pop esi"
+			: "=a"(result) : "a"(SYS_FUTEX), "b"(addr), "c"(FUTEX_WAIT_PRIVATE), "d"(expected) : "memory");
+  return result == 0;
+}
+
+unsigned int host_futex_wake(volatile unsigned int* addr, unsigned int count)
+{
+  // Linux takes the count as an int, so waking everyone is INT_MAX.
+  if(count > 0x7FFFFFFF)
+    count = 0x7FFFFFFF;
+  return host_syscall(SYS_FUTEX, (int)addr, FUTEX_WAKE_PRIVATE, count);
+}
+
+// Kernel services.
+
+unsigned int cpu_id()
+{
+  return 0;
+}
+
+unsigned int irq_save()
+{
+  return 0;
+}
+
+void irq_restore(unsigned int flags __attribute__ ((unused)))
+{
+}
+
+void spin_lock(void* lock __attribute__ ((unused)))
+{
+}
+
+bool spin_trylock(void* lock __attribute__ ((unused)))
+{
+  return true;
+}
+
+void spin_unlock(void* lock __attribute__ ((unused)))
+{
+}
+
+unsigned int spin_lock_irqsave(void* lock __attribute__ ((unused)))
+{
+  return 0;
+}
+
+void spin_unlock_irqrestore(void* lock __attribute__ ((unused)), unsigned int flags __attribute__ ((unused)))
+{
+}
+
+void install_stat(void* counter __attribute__ ((unused)))
+{
+}
@@ -0,0 +1,22 @@
+#ifndef HOST_H
+#define HOST_H
+
+#include <stdbool.h>
+
+#define check(cond) test_check((cond), #cond, __FILE__, __LINE__)
+
+extern bool test_check(bool ok, char* what, char* file, int line);
+extern int test_result(char* name);
+
+extern void* host_alloc(unsigned long hint, unsigned long size);
+
+extern int host_thread(void (*fn)(void* arg), void* arg);
+extern void host_thread_exit() __attribute__ ((noreturn));
+extern int host_thread_id();
+extern void host_yield();
+extern unsigned int host_seconds();
+extern unsigned int host_microseconds();
+extern bool host_futex_wait(volatile unsigned int* addr, unsigned int expected);
+extern unsigned int host_futex_wake(volatile unsigned int* addr, unsigned int count);
+
+#endif
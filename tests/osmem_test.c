@@ -0,0 +1,235 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdsymbols.h>
+#include <frame.h>
+#include <paging.h>
+#include <vmm.h>
+#include <host.h>
+#include <sm/OSMem.h>
+
+/* Hosted test of the RTS megablock backend, rts/gestalt/OSMem.c.
+ *
+ * OSMem.c runs unchanged on top of the real vmm.c. Only the part of
+ * paging.c it relies on is modelled: palloc_lazy() is a reservation,
+ * and pfree() in the VMM window refuses any run that is not wholly handed
+ * out, as the real one does. Nothing is touched, so no page is ever
+ * backed and no page tables are needed.
+ *
+ * Megablocks are taken and given back in a random order, among short
+ * kernel runs that knock the VMM's next fit off megablock alignment,
+ * checking that each is aligned, that the slop around it went back to
+ * the VMM at once, and that a bad osFreeMBlocks() barfs without changing
+ * anything.
+ */
+
+#define MBLOCK_PAGES (MBLOCK_SIZE / FRAME_SIZE)
+#define CHURN_SLOTS 64
+#define CHURN_ROUNDS 4000
+
+typedef struct mblocks mblocks;
+
+struct mblocks
+{
+  char* addr;
+  nat n;
+};
+
+static mblocks live[CHURN_SLOTS];
+static unsigned long runs[CHURN_SLOTS];
+static unsigned int run_pages[CHURN_SLOTS];
+static unsigned int live_pages = 0;
+static unsigned int barfs = 0;
+static unsigned int seed = 1;
+
+unsigned long palloc_lazy(int num_pages)
+{
+  return num_pages > 0 ? vmm_reserve(num_pages) : 0;
+}
+
+bool pfree(unsigned long page_address, int num_pages)
+{
+  if((page_address & 0xFFF) || !vmm_owns(page_address) || !vmm_allocated(page_address, num_pages))
+    return false;
+
+  return vmm_free(page_address, num_pages);
+}
+
+unsigned int frames_total()
+{
+  return 1024;
+}
+
+void barf(char* s __attribute__ ((unused)), ...)
+{
+  barfs++;
+}
+
+void errorBelch(char* s, ...)
+{
+  print("  errorBelch: %s\n", s);
+}
+
+void stg_exit(int n)
+{
+  print("  stg_exit(%i)\n", n);
+  check(false);
+}
+
+// osFreeAllMBlocks() walks what sm/MBlock.c would have recorded, here live[].
+void* getNextMBlock(void** state, void* mblock __attribute__ ((unused)))
+{
+  unsigned int slot = (unsigned int)*state;
+
+  for(; slot < CHURN_SLOTS; slot++)
+    if(live[slot].addr)
+      {
+	*state = (void*)(slot + 1);
+	return live[slot].addr;
+      }
+
+  return NULL;
+}
+
+void* getFirstMBlock(void** state)
+{
+  *state = (void*)0;
+  return getNextMBlock(state, NULL);
+}
+
+static unsigned int next_random()
+{
+  seed = seed * 1103515245 + 12345;
+  return seed >> 16;
+}
+
+static bool get_mblocks(mblocks* m, nat n)
+{
+  m->addr = osGetMBlocks(n);
+  m->n = n;
+
+  if(!check(m->addr && !((W_)m->addr & MBLOCK_MASK)))
+    return false;
+
+  live_pages += n * MBLOCK_PAGES;
+  check(vmm_allocated((W_)m->addr, n * MBLOCK_PAGES));
+  check(vmm_lazy_page((W_)m->addr) && vmm_lazy_page((W_)m->addr + n * MBLOCK_SIZE - 1));
+
+  // Nothing but the megablocks stays reserved, the slop went straight back.
+  return check(vmm_pages_used() == live_pages);
+}
+
+static void free_mblocks(mblocks* m)
+{
+  unsigned int before = barfs;
+
+  osFreeMBlocks(m->addr, m->n);
+  check(barfs == before);
+  check(!vmm_allocated((W_)m->addr, 1));
+
+  live_pages -= m->n * MBLOCK_PAGES;
+  m->addr = NULL;
+  check(vmm_pages_used() == live_pages);
+}
+
+// A kernel allocation of less than a megablock from the same window.
+static void toggle_run(unsigned int slot)
+{
+  if(runs[slot])
+    {
+      check(vmm_free(runs[slot], run_pages[slot]));
+      live_pages -= run_pages[slot];
+      runs[slot] = 0;
+      return;
+    }
+
+  run_pages[slot] = 1 + next_random() % (MBLOCK_PAGES - 1);
+  runs[slot] = vmm_alloc(run_pages[slot]);
+  if(check(runs[slot] != 0))
+    live_pages += run_pages[slot];
+}
+
+static void test_churn()
+{
+  for(unsigned int round = 0; round < CHURN_ROUNDS; round++)
+    {
+      unsigned int slot = next_random() % CHURN_SLOTS;
+      mblocks* m = &live[slot];
+
+      if(next_random() % 4 == 0)
+	toggle_run(slot);
+      else if(m->addr)
+	free_mblocks(m);
+      else if(!get_mblocks(m, 1 + next_random() % 4))
+	return;
+    }
+
+  for(unsigned int slot = 0; slot < CHURN_SLOTS; slot++)
+    {
+      if(live[slot].addr)
+	free_mblocks(&live[slot]);
+      if(runs[slot])
+	toggle_run(slot);
+    }
+
+  check(vmm_pages_used() == 0);
+}
+
+// Each of these must barf and leave the megablocks reserved.
+static void test_bad_frees()
+{
+  mblocks m;
+  if(!get_mblocks(&m, 2))
+    return;
+
+  osFreeMBlocks(m.addr, 3);
+  osFreeMBlocks(m.addr, 0);
+  osFreeMBlocks(m.addr + MBLOCK_SIZE, 2);
+  osFreeMBlocks(m.addr - MBLOCK_SIZE, 1);
+  check(barfs == 4);
+  check(vmm_allocated((W_)m.addr, 2 * MBLOCK_PAGES));
+
+  free_mblocks(&m);
+}
+
+static void test_double_free()
+{
+  mblocks m;
+  if(!get_mblocks(&m, 1))
+    return;
+
+  char* addr = m.addr;
+  free_mblocks(&m);
+
+  osFreeMBlocks(addr, 1);
+  check(barfs == 5);
+  check(vmm_pages_used() == 0);
+}
+
+static void test_free_all()
+{
+  for(unsigned int slot = 0; slot < CHURN_SLOTS; slot += 3)
+    if(!get_mblocks(&live[slot], 1 + slot % 3))
+      return;
+
+  osFreeAllMBlocks();
+  check(vmm_pages_used() == 0);
+
+  for(unsigned int slot = 0; slot < CHURN_SLOTS; slot++)
+    live[slot].addr = NULL;
+  live_pages = 0;
+}
+
+int main()
+{
+  init_vmm();
+  osMemInit();
+
+  check(getPageSize() == FRAME_SIZE);
+
+  test_churn();
+  test_bad_frees();
+  test_double_free();
+  test_free_all();
+
+  return test_result("megablock allocation");
+}
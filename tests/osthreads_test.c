@@ -0,0 +1,287 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdsymbols.h>
+#include <futex.h>
+#include <sched.h>
+#include <smp.h>
+#include <host.h>
+#include <Rts.h>
+
+/* Hosted stress test of the RTS thread backend, rts/gestalt/OSThreads.c.
+ *
+ * OSThreads.c runs unchanged, with kernel threads played by Linux threads
+ * and the kernel's futex_wait()/futex_wake() by Linux futexes, which
+ * promise the same: the word is compared with the waiter queued, so a
+ * wake racing with the wait is not lost. What is under test is the
+ * mutex and condition variable built on top.
+ *
+ * Workers go round a barrier made of waitCondition() and
+ * broadcastCondition(), counting under the mutex, and producers hand
+ * tokens to consumers with signalCondition(). A lost wakeup leaves
+ * somebody asleep, which the main thread notices as a missed deadline,
+ * and a broken mutex shows up as two workers inside it at once. The
+ * producer and consumer run is timed and reported in handoffs per second.
+ */
+
+#define WORKERS 8
+#define BARRIER_ROUNDS 2000
+#define PRODUCERS 4
+#define TOKENS 5000
+#define DEADLINE_SECONDS 30
+#define MAX_THREADS (WORKERS + 2 * PRODUCERS)
+
+static thread threads[MAX_THREADS];
+static volatile unsigned int thread_count = 0;
+static volatile unsigned int barfs = 0;
+
+static Mutex lock;
+static Condition turned;
+static Condition nonempty;
+
+static volatile unsigned int inside = 0;
+static volatile unsigned int overlaps = 0;
+static volatile unsigned int counter = 0;
+static volatile unsigned int arrived = 0;
+static volatile unsigned int generation = 0;
+static volatile unsigned int tokens = 0;
+static volatile unsigned int consumed = 0;
+static volatile unsigned int finished = 0;
+
+// Kernel services, from Linux.
+
+static void thread_start(void* arg)
+{
+  thread* t = arg;
+
+  t->id = host_thread_id();
+  t->entry(t->arg);
+}
+
+thread* thread_create(void (*entry)(void* arg), void* arg, unsigned int priority)
+{
+  unsigned int i = __sync_fetch_and_add(&thread_count, 1);
+  if(i >= MAX_THREADS)
+    return NULL;
+
+  thread* t = &threads[i];
+  t->entry = entry;
+  t->arg = arg;
+  t->priority = priority;
+
+  return host_thread(thread_start, t) ? t : NULL;
+}
+
+thread* thread_current()
+{
+  int id = host_thread_id();
+
+  for(unsigned int i = 0; i < thread_count && i < MAX_THREADS; i++)
+    if(threads[i].id == (unsigned int)id)
+      return &threads[i];
+
+  return NULL;
+}
+
+void thread_yield()
+{
+  host_yield();
+}
+
+void thread_exit()
+{
+  host_thread_exit();
+}
+
+bool thread_set_affinity(unsigned int mask __attribute__ ((unused)))
+{
+  return true;
+}
+
+unsigned int smp_cpu_count()
+{
+  return 4;
+}
+
+bool futex_wait(volatile unsigned int* addr, unsigned int expected)
+{
+  return host_futex_wait(addr, expected);
+}
+
+unsigned int futex_wake(volatile unsigned int* addr, unsigned int count)
+{
+  return host_futex_wake(addr, count);
+}
+
+// RTS services, only reached through forkOS.
+
+void barf(char* s __attribute__ ((unused)), ...)
+{
+  __sync_fetch_and_add(&barfs, 1);
+}
+
+Capability* rts_lock(void)
+{
+  return NULL;
+}
+
+void rts_unlock(Capability* cap __attribute__ ((unused)))
+{
+}
+
+void rts_evalStableIO(Capability** cap __attribute__ ((unused)), HsStablePtr s __attribute__ ((unused)),
+		      void* ret __attribute__ ((unused)))
+{
+}
+
+// The tests.
+
+static void enter()
+{
+  gestaltAcquireLock(&lock);
+  if(inside++)
+    overlaps++;
+}
+
+static void leave()
+{
+  inside--;
+  gestaltReleaseLock(&lock);
+}
+
+static void wait_turned()
+{
+  inside--;
+  waitCondition(&turned, &lock);
+  if(inside++)
+    overlaps++;
+}
+
+static void barrier_worker(void* arg __attribute__ ((unused)))
+{
+  for(unsigned int round = 0; round < BARRIER_ROUNDS; round++)
+    {
+      enter();
+      counter++;
+
+      if(++arrived == WORKERS)
+	{
+	  arrived = 0;
+	  generation++;
+	  broadcastCondition(&turned);
+	}
+      else
+	{
+	  unsigned int seen = generation;
+	  while(generation == seen)
+	    wait_turned();
+	}
+
+      leave();
+    }
+
+  __sync_fetch_and_add(&finished, 1);
+}
+
+static void producer(void* arg __attribute__ ((unused)))
+{
+  for(unsigned int i = 0; i < TOKENS; i++)
+    {
+      enter();
+      tokens++;
+      signalCondition(&nonempty);
+      leave();
+
+      if(!(i & 63))
+	yieldThread();
+    }
+
+  __sync_fetch_and_add(&finished, 1);
+}
+
+static void consumer(void* arg __attribute__ ((unused)))
+{
+  for(unsigned int i = 0; i < TOKENS; i++)
+    {
+      enter();
+      while(!tokens)
+	{
+	  inside--;
+	  waitCondition(&nonempty, &lock);
+	  if(inside++)
+	    overlaps++;
+	}
+      tokens--;
+      consumed++;
+      leave();
+    }
+
+  __sync_fetch_and_add(&finished, 1);
+}
+
+static bool start(OSThreadProc* proc, unsigned int count)
+{
+  for(unsigned int i = 0; i < count; i++)
+    {
+      OSThreadId id;
+      if(!check(createOSThread(&id, "test", proc, NULL) == 0))
+	return false;
+    }
+
+  return true;
+}
+
+// Waits without the primitives under test, so a hang in them cannot hang this.
+static bool wait_finished(unsigned int count)
+{
+  unsigned int deadline = host_seconds() + DEADLINE_SECONDS;
+
+  while(finished < count && host_seconds() < deadline)
+    host_yield();
+
+  return check(finished == count);
+}
+
+static void test_barrier()
+{
+  finished = 0;
+  if(!start(barrier_worker, WORKERS) || !wait_finished(WORKERS))
+    return;
+
+  check(counter == WORKERS * BARRIER_ROUNDS);
+  check(generation == BARRIER_ROUNDS);
+  check(overlaps == 0);
+}
+
+static void test_producers()
+{
+  finished = 0;
+  unsigned int started = host_microseconds();
+  if(!start(producer, PRODUCERS) || !start(consumer, PRODUCERS) || !wait_finished(2 * PRODUCERS))
+    return;
+  unsigned int ms = (host_microseconds() - started) / 1000;
+
+  check(consumed == PRODUCERS * TOKENS && tokens == 0);
+  check(overlaps == 0);
+
+  print("  %u handoffs in %u ms, %u per second\n", consumed, ms, consumed * 1000 / (ms ? ms : 1));
+}
+
+int main()
+{
+  initMutex(&lock);
+  initCondition(&turned);
+  initCondition(&nonempty);
+
+  check(gestaltTryAcquireLock(&lock) == 0);
+  check(gestaltTryAcquireLock(&lock) != 0);
+  gestaltReleaseLock(&lock);
+  check(lock.state == 0);
+
+  test_barrier();
+  test_producers();
+
+  check(lock.state == 0);
+  check(barfs == 0);
+
+  return test_result("mutexes and condition variables");
+}
@@ -0,0 +1,39 @@
+#ifndef RTS_H
+#define RTS_H
+
+/* Just enough of the RTS headers to build the Gestalt backends in
+ * rts/gestalt for the hosted tests, with the 32-bit values from
+ * includes/rts/storage/Block.h.
+ */
+
+#include <stdsymbols.h>
+
+typedef unsigned long W_;
+typedef unsigned int nat;
+typedef unsigned int StgWord32;
+typedef unsigned long StgWord;
+typedef unsigned long long StgWord64;
+typedef int rtsBool;
+
+#define rtsFalse 0
+#define rtsTrue 1
+
+#define STG_UNUSED __attribute__ ((unused))
+#define FMT_Word "lu"
+#define EXIT_HEAPOVERFLOW 251
+
+#define MBLOCK_SHIFT 20
+#define MBLOCK_SIZE (1 << MBLOCK_SHIFT)
+#define MBLOCK_MASK (MBLOCK_SIZE - 1)
+#define MBLOCK_ROUND_UP(p) ((void *)(((W_)(p) + MBLOCK_SIZE - 1) & ~MBLOCK_MASK))
+
+extern void barf(char* s, ...);
+extern void errorBelch(char* s, ...);
+extern void stg_exit(int n);
+
+extern void* getFirstMBlock(void** state);
+extern void* getNextMBlock(void** state, void* mblock);
+
+#include <rts/OSThreads.h>
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef RTSUTILS_H
+#define RTSUTILS_H
+
+// barf() and errorBelch() are declared in Rts.h here.
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef RTS_OSTHREADS_H
+#define RTS_OSTHREADS_H
+
+// The Gestalt part of includes/rts/OSThreads.h, with what it relies on.
+
+typedef struct { volatile StgWord32 state; } Mutex;
+typedef struct { volatile StgWord32 seq; } Condition;
+typedef StgWord OSThreadId;
+typedef StgWord32 ThreadLocalKey;
+typedef StgWord64 KernelThreadId;
+typedef void OSThreadProc(void*);
+
+typedef void* HsStablePtr;
+typedef struct Capability_ Capability;
+
+extern void gestaltAcquireLock(Mutex* mutex);
+extern int gestaltTryAcquireLock(Mutex* mutex);
+extern void gestaltReleaseLock(Mutex* mutex);
+
+extern void initMutex(Mutex* pMut);
+extern void closeMutex(Mutex* pMut);
+extern void initCondition(Condition* pCond);
+extern void closeCondition(Condition* pCond);
+extern rtsBool broadcastCondition(Condition* pCond);
+extern rtsBool signalCondition(Condition* pCond);
+extern rtsBool waitCondition(Condition* pCond, Mutex* pMut);
+
+extern void yieldThread(void);
+extern int createOSThread(OSThreadId* pId, char* name, OSThreadProc* startProc, void* param);
+extern OSThreadId osThreadId(void);
+
+extern Capability* rts_lock(void);
+extern void rts_unlock(Capability* cap);
+extern void rts_evalStableIO(Capability** cap, HsStablePtr s, void* ret);
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef SM_HEAPALLOC_H
+#define SM_HEAPALLOC_H
+
+// The HEAP_ALLOCED map is sm/MBlock.c's business, OSMem.c needs none of it.
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef SM_OSMEM_H
+#define SM_OSMEM_H
+
+#include <Rts.h>
+
+extern void osMemInit(void);
+extern void* osGetMBlocks(nat n);
+extern void osFreeMBlocks(char* addr, nat n);
+extern void osReleaseFreeMemory(void);
+extern void osFreeAllMBlocks(void);
+extern W_ getPageSize(void);
+extern StgWord64 getPhysicalMemorySize(void);
+extern void setExecutable(void* p, W_ len, rtsBool exec);
+
+#endif
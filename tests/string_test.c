@@ -0,0 +1,163 @@
+#include <cpu.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdsymbols.h>
+#include <string.h>
+#include <host.h>
+
+/* Hosted test of the string routines.
+ *
+ * Every size and alignment that selects a different path through
+ * memcpy, memset and memmove is checked against a byte loop, once with
+ * the rep string instructions and once with the SSE2 loops, including
+ * copies long enough for non-temporal stores and for more than one
+ * interrupt-masked chunk. Guard bytes around each destination catch
+ * writes past either end.
+ */
+
+#define BUFFER_SIZE (640 * 1024)
+#define GUARD 64
+#define GUARD_BYTE 0xAA
+
+static unsigned char* src;
+static unsigned char* dst;
+static unsigned char* expected;
+
+static size_t sizes[] = {0, 1, 3, 15, 16, 17, 63, 64, 100, 1023, 1024, 1025, 4097,
+			 16 * 1024 + 13, 70000, 256 * 1024, 300001, 512 * 1024 + 7};
+static size_t offsets[] = {0, 1, 3, 8, 13};
+
+#define SIZES (sizeof(sizes) / sizeof(size_t))
+#define OFFSETS (sizeof(offsets) / sizeof(size_t))
+
+static void fill_pattern(unsigned char* buffer, size_t n, unsigned int seed)
+{
+  for(size_t i = 0; i < n; i++)
+    buffer[i] = (unsigned char)(i * 7 + seed + (i >> 8));
+}
+
+static void byte_fill(unsigned char* buffer, unsigned char c, size_t n)
+{
+  for(size_t i = 0; i < n; i++)
+    buffer[i] = c;
+}
+
+static bool same(unsigned char* a, unsigned char* b, size_t n)
+{
+  for(size_t i = 0; i < n; i++)
+    if(a[i] != b[i])
+      return false;
+  return true;
+}
+
+static void test_memcpy()
+{
+  for(size_t i = 0; i < SIZES; i++)
+    for(size_t s = 0; s < OFFSETS; s++)
+      for(size_t d = 0; d < OFFSETS; d++)
+	{
+	  size_t n = sizes[i];
+
+	  fill_pattern(src, n + GUARD, i + s);
+	  byte_fill(dst, GUARD_BYTE, n + offsets[d] + 2 * GUARD);
+	  byte_fill(expected, GUARD_BYTE, n + offsets[d] + 2 * GUARD);
+	  for(size_t k = 0; k < n; k++)
+	    expected[GUARD + offsets[d] + k] = src[offsets[s] + k];
+
+	  check(memcpy(dst + GUARD + offsets[d], src + offsets[s], n) == dst + GUARD + offsets[d]);
+	  if(!check(same(dst, expected, n + offsets[d] + 2 * GUARD)))
+	    {
+	      print("  memcpy of %u bytes, offsets %u and %u\n", n, offsets[s], offsets[d]);
+	      return;
+	    }
+	}
+}
+
+static void test_memset()
+{
+  for(size_t i = 0; i < SIZES; i++)
+    for(size_t d = 0; d < OFFSETS; d++)
+      {
+	size_t n = sizes[i];
+	unsigned char c = (unsigned char)(0x11 * (i + 1));
+
+	byte_fill(dst, GUARD_BYTE, n + offsets[d] + 2 * GUARD);
+	byte_fill(expected, GUARD_BYTE, n + offsets[d] + 2 * GUARD);
+	byte_fill(expected + GUARD + offsets[d], c, n);
+
+	check(memset(dst + GUARD + offsets[d], c, n) == dst + GUARD + offsets[d]);
+	if(!check(same(dst, expected, n + offsets[d] + 2 * GUARD)))
+	  {
+	    print("  memset of %u bytes, offset %u\n", n, offsets[d]);
+	    return;
+	  }
+      }
+}
+
+// Overlapping moves both ways, by distances below and above a dword.
+static void test_memmove()
+{
+  size_t distances[] = {1, 3, 4, 17, 1000};
+
+  for(size_t i = 0; i < SIZES; i++)
+    for(size_t k = 0; k < sizeof(distances) / sizeof(size_t); k++)
+      for(int up = 0; up < 2; up++)
+	{
+	  size_t n = sizes[i], gap = distances[k];
+	  size_t total = n + gap + 2 * GUARD;
+	  unsigned char* from = dst + GUARD + (up ? 0 : gap);
+	  unsigned char* to = dst + GUARD + (up ? gap : 0);
+
+	  if(total > BUFFER_SIZE)
+	    continue;
+
+	  fill_pattern(dst, total, i + k);
+	  for(size_t j = 0; j < total; j++)
+	    expected[j] = dst[j];
+	  for(size_t j = 0; j < n; j++)
+	    expected[to - dst + j] = dst[from - dst + j];
+
+	  check(memmove(to, from, n) == to);
+	  if(!check(same(dst, expected, total)))
+	    {
+	      print("  memmove of %u bytes, %s by %u\n", n, up ? "up" : "down", gap);
+	      return;
+	    }
+	}
+}
+
+static void test_compare()
+{
+  fill_pattern(src, 4096, 1);
+  fill_pattern(dst, 4096, 1);
+
+  check(memcmp(src, dst, 4096) == 0);
+  dst[4001] ^= 1;
+  check(memcmp(src, dst, 4096) != 0);
+  check(memcmp(src, dst, 4001) == 0);
+
+  check(strcmp("gestalt", "gestalt") == 0);
+  check(strcmp("gestalt", "gestalts") < 0);
+  check(strcmp("b", "a") > 0);
+  check(strlen("gestalt") == 7);
+}
+
+int main()
+{
+  src = host_alloc(0x10000000, BUFFER_SIZE);
+  dst = host_alloc(0x20000000, BUFFER_SIZE);
+  expected = host_alloc(0x30000000, BUFFER_SIZE);
+  if(!check(src && dst && expected))
+    return test_result("string routines");
+
+  for(int sse = 0; sse < 2; sse++)
+    {
+      sse_enabled = sse;
+      test_memcpy();
+      test_memset();
+      test_memmove();
+    }
+  test_compare();
+
+  return test_result("string routines");
+}
@@ -0,0 +1,123 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <vmm.h>
+#include <host.h>
+
+/* Hosted test of the kernel virtual address allocator.
+ *
+ * vmm.c only keeps bitmaps, so it runs here unchanged. Runs are checked
+ * to stay inside the window and never overlap, frees of anything that
+ * was not handed out are refused without touching the accounting, and
+ * the lazy flag follows reservations, including partial frees of them.
+ */
+
+#define VMM_PAGES ((VMM_END - VMM_BASE) >> 12)
+
+static bool inside(unsigned long virt_addr, int num_pages)
+{
+  return virt_addr >= VMM_BASE && !(virt_addr & 0xFFF)
+    && virt_addr + ((unsigned long)num_pages << 12) <= VMM_END;
+}
+
+static void test_alloc_free()
+{
+  unsigned long a = vmm_alloc(1);
+  unsigned long b = vmm_alloc(100);
+  unsigned long c = vmm_alloc(33);
+
+  check(inside(a, 1) && inside(b, 100) && inside(c, 33));
+  check(a + 4096 <= b || b + 100 * 4096 <= a);
+  check(b + 100 * 4096 <= c || c + 33 * 4096 <= b);
+  check(vmm_pages_used() == 134);
+  check(vmm_allocated(b, 100) && !vmm_allocated(b, 101 + (c == b + 100 * 4096 ? 33 : 0)));
+  check(!vmm_lazy_page(a));
+
+  check(vmm_free(b, 100));
+  check(!vmm_free(b, 100));
+  check(!vmm_allocated(b, 1));
+  check(vmm_pages_used() == 34);
+
+  check(vmm_free(a, 1) && vmm_free(c, 33));
+  check(vmm_pages_used() == 0);
+}
+
+static void test_bad_frees()
+{
+  unsigned long a = vmm_alloc(8);
+
+  check(!vmm_free(a + 1, 1));
+  check(!vmm_free(a, 0));
+  check(!vmm_free(a, 9));
+  check(!vmm_free(a - 4096, 2));
+  check(!vmm_free(0x1000, 1));
+  check(!vmm_free(VMM_END - 4096, 2));
+  check(vmm_pages_used() == 8);
+
+  check(vmm_free(a, 8));
+  check(!vmm_free(a, 8));
+  check(vmm_pages_used() == 0);
+}
+
+static void test_reserve()
+{
+  unsigned long r = vmm_reserve(16);
+
+  check(inside(r, 16));
+  check(vmm_lazy_page(r) && vmm_lazy_page(r + 15 * 4096 + 123));
+  check(!vmm_lazy_page(r + 16 * 4096));
+
+  // Part of a reservation can go back on its own.
+  check(vmm_free(r + 4 * 4096, 4));
+  check(!vmm_lazy_page(r + 4 * 4096) && vmm_lazy_page(r + 3 * 4096) && vmm_lazy_page(r + 8 * 4096));
+  check(!vmm_free(r, 16));
+  check(vmm_pages_used() == 12);
+
+  // A plain run placed in the gap is not lazy.
+  unsigned long a = vmm_alloc(4);
+  check(inside(a, 4));
+  if(a == r + 4 * 4096)
+    check(!vmm_lazy_page(a));
+
+  check(vmm_free(r, 4) && vmm_free(r + 8 * 4096, 8) && vmm_free(a, 4));
+  check(vmm_pages_used() == 0);
+}
+
+// Filling the window, wherever the search starts, must hand out every
+// page exactly once.
+static unsigned long big_runs[VMM_PAGES / 1024];
+static unsigned long pages[2048];
+
+static void test_exhaust()
+{
+  unsigned int big = 0, small = 0;
+
+  while(big < VMM_PAGES / 1024 && (big_runs[big] = vmm_alloc(1024)))
+    check(inside(big_runs[big++], 1024));
+  while(small < 2048 && (pages[small] = vmm_alloc(1)))
+    check(inside(pages[small++], 1));
+
+  check(big * 1024 + small == VMM_PAGES);
+  check(vmm_pages_used() == VMM_PAGES);
+  check(vmm_alloc(1) == 0);
+
+  for(unsigned int i = 0; i < big; i++)
+    check(vmm_free(big_runs[i], 1024));
+  for(unsigned int i = 0; i < small; i++)
+    check(vmm_free(pages[i], 1));
+
+  check(vmm_pages_used() == 0);
+  check(vmm_alloc(VMM_PAGES) == VMM_BASE);
+  check(vmm_free(VMM_BASE, VMM_PAGES));
+}
+
+int main()
+{
+  init_vmm();
+
+  test_alloc_free();
+  test_bad_frees();
+  test_reserve();
+  test_exhaust();
+
+  return test_result("virtual address allocator");
+}